@@ -2,12 +2,16 @@
 #define _BLE_MIDI_H_
 
 #include <zephyr/bluetooth/uuid.h>
+#include "ble_midi_types.h"
 
 /** UUID of the BLE MIDI service */
 #define BLE_MIDI_SERVICE_UUID BT_UUID_128_ENCODE(0x03B80E5A, 0xEDE8, 0x4B33, 0xA751, 0x6CE34EC4C700)
 /** UUID of the MIDI data I/O characteristic */
 #define BLE_MIDI_CHAR_UUID    BT_UUID_128_ENCODE(0x7772E5DB, 0x3868, 0x4112, 0xA1A9, 0xF2669D106BF3)
 
+/** The maximum number of messages passed to ble_midi_tx_msg_group */
+#define BLE_MIDI_TX_MSG_GROUP_MAX_COUNT 16
+
 enum ble_midi_error_t {
 	BLE_MIDI_SUCCESS = 0,
 	BLE_MIDI_ALREADY_INITIALIZED = -100,
@@ -41,6 +45,21 @@ typedef void (*ble_midi_sysex_start_cb_t)(uint16_t timestamp);
 typedef void (*ble_midi_sysex_data_cb_t)(uint8_t data_byte);
 /** Called when a sysex message ends */
 typedef void (*ble_midi_sysex_end_cb_t)(uint16_t timestamp);
+/**
+ * Called with a contiguous run of received sysex data bytes. data_bytes points
+ * into the received packet and is only valid for the duration of the call.
+ */
+typedef void (*ble_midi_sysex_data_span_cb_t)(const uint8_t *data_bytes, uint32_t num_data_bytes);
+
+/**
+ * Called with consecutive non-sysex messages parsed from a received packet.
+ * At most CONFIG_BLE_MIDI_RX_BATCH_SIZE messages are passed per call.
+ */
+typedef void (*ble_midi_message_batch_cb_t)(const struct ble_midi_message_t *msgs,
+					    uint32_t num_msgs);
+
+/** Called when a parameter change has been received, see param_cb. */
+typedef void (*ble_midi_param_cb_t)(const struct ble_midi_param_t *param);
 
 /** Callbacks set to NULL are ignored. */
 struct ble_midi_callbacks {
@@ -50,6 +69,16 @@ struct ble_midi_callbacks {
 	ble_midi_sysex_start_cb_t sysex_start_cb;
 	ble_midi_sysex_data_cb_t sysex_data_cb;
 	ble_midi_sysex_end_cb_t sysex_end_cb;
+	/* If set, received sysex data bytes are passed to this callback in runs
+	   and sysex_data_cb is not called. */
+	ble_midi_sysex_data_span_cb_t sysex_data_span_cb;
+	/* If set, received non-sysex messages are passed to this callback in batches
+	   and midi_message_cb is not called. */
+	ble_midi_message_batch_cb_t midi_message_batch_cb;
+	/* If set, received RPN/NRPN sequences, and 14 bit controller pairs if
+	   CONFIG_BLE_MIDI_RX_PARAMS_CC14 is enabled, are passed to this callback as single
+	   parameter changes and their control change messages are not passed on. */
+	ble_midi_param_cb_t param_cb;
 };
 
 /**
@@ -57,6 +86,14 @@ struct ble_midi_callbacks {
  */
 enum ble_midi_error_t ble_midi_init(struct ble_midi_callbacks *callbacks);
 
+/*
+ * With a buffered tx mode and CONFIG_BLE_MIDI_TX_MULTI_PRODUCER, ble_midi_tx_msg,
+ * ble_midi_tx_msgs, ble_midi_tx_msg_group, ble_midi_tx_param and ble_midi_tx_sysex_msg may be
+ * called concurrently from threads and interrupt handlers. A sysex message sent with
+ * ble_midi_tx_sysex_start/data/end, and ble_midi_tx_stream, must come from one caller at a
+ * time. With CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG, no calls may be concurrent.
+ */
+
 /**
  * Sends a non-sysex MIDI message.
  * @param bytes A zero padded buffer of length 3 containing the message bytes to send.
@@ -64,6 +101,68 @@ enum ble_midi_error_t ble_midi_init(struct ble_midi_callbacks *callbacks);
  */
 enum ble_midi_error_t ble_midi_tx_msg(uint8_t *bytes);
 
+/**
+ * Sends several non-sysex MIDI messages with the same timestamp, e.g. the notes of a chord.
+ * Cheaper than calling ble_midi_tx_msg for each message.
+ * @param msgs Zero padded 3 byte buffers containing the message bytes to send.
+ * @param num_msgs The number of messages to send.
+ * @return 0 on success or a non-zero number on failure. If buffered tx is used, either all
+ *         or none of the messages are sent.
+ */
+enum ble_midi_error_t ble_midi_tx_msgs(const uint8_t (*msgs)[3], int num_msgs);
+
+/**
+ * Sends a group of simultaneous non-sysex MIDI messages, e.g the notes of a chord, in a single
+ * packet so that they reach the central in the same connection event. If buffered tx is used and
+ * the group doesn't fit in the rest of the packet being filled, the whole group goes to the next
+ * packet. A group is only split if it doesn't fit in an empty packet.
+ * @param msgs Zero padded 3 byte buffers containing the message bytes to send.
+ * @param num_msgs The number of messages to send, at most BLE_MIDI_TX_MSG_GROUP_MAX_COUNT.
+ * @return 0 on success or a non-zero number on failure. If buffered tx is used, either all
+ *         or none of the messages are sent.
+ */
+enum ble_midi_error_t ble_midi_tx_msg_group(const uint8_t (*msgs)[3], int num_msgs);
+
+/**
+ * Sends an RPN, NRPN or 14 bit controller change as a group of control change messages, see
+ * ble_midi_tx_msg_group. With CONFIG_BLE_MIDI_SEND_RUNNING_STATUS, the group takes up one
+ * status byte followed by data byte pairs. The selected RPN/NRPN is not reset afterwards.
+ * @param type A ble_midi_param_type_t value.
+ * @param channel 0-15.
+ * @param number The controller number (0-31) of a 14 bit controller or the 14 bit parameter
+ *        number.
+ * @param value The 14 bit value.
+ * @return 0 on success or a non-zero number on failure.
+ */
+enum ble_midi_error_t ble_midi_tx_param(enum ble_midi_param_type_t type, uint8_t channel,
+					uint16_t number, uint16_t value);
+
+/**
+ * Sends a complete sysex message. Unlike a ble_midi_tx_sysex_start/data/end sequence, a short
+ * message is packed into the same packet as other pending messages, e.g to send parameter
+ * changes alongside channel messages.
+ * @param bytes The message bytes, starting with 0xf0 and ending with 0xf7.
+ * @param num_bytes The number of message bytes. When buffered tx is used, at most 255.
+ * @return 0 on success or a non-zero number on failure. If buffered tx is used, either the
+ *         entire message or none of it is sent.
+ */
+enum ble_midi_error_t ble_midi_tx_sysex_msg(const uint8_t *bytes, int num_bytes);
+
+/**
+ * Sends a MIDI 1.0 byte stream, e.g received from a DIN/UART MIDI input. The stream is split
+ * into messages and sysex data, handling running status, real time messages in the middle of
+ * other messages and messages split across calls, and consecutive messages are sent in bulk.
+ * A sysex message is ended by 0xf7 or by the next non real time status byte. Data bytes
+ * without a status byte and undefined status bytes are dropped.
+ * @param bytes The stream bytes.
+ * @param num_bytes The number of stream bytes.
+ * @return The number of bytes consumed, i.e sent or buffered. This is less than num_bytes if
+ *         the tx FIFO filled up or sending failed part way, in which case the rest should be
+ *         passed in a later call. A negative ble_midi_error_t value if sending failed before
+ *         any bytes were consumed.
+ */
+int ble_midi_tx_stream(const uint8_t *bytes, size_t num_bytes);
+
 /**
  * Start transmission of a sysex message.
  * @return 0 on success or a non-zero number on failure.
@@ -84,6 +183,77 @@ int ble_midi_tx_sysex_data(uint8_t *bytes, int num_bytes);
  */
 enum ble_midi_error_t ble_midi_tx_sysex_end();
 
+/**
+ * Returns the sender time of the most recently received message, i.e its 13 bit
+ * timestamp unwrapped into a monotonic ms count that does not wrap every 8.192 s.
+ * Call this from a receive callback to get the sender time of the message or sysex
+ * event being reported. The sender time wraps after about 49 days and is reset
+ * when a new connection is made.
+ */
+uint32_t ble_midi_rx_sender_time();
+
+/**
+ * Converts a sender time to the local k_uptime_get() time at which an event at that
+ * sender time is expected to arrive, using the estimated sender clock offset and drift
+ * and the minimum observed transport latency. Add a constant latency budget to the
+ * result to schedule playback of received events with low jitter.
+ */
+int64_t ble_midi_rx_local_time_ms(uint32_t sender_time);
+
+/**
+ * Returns the estimated drift of the sender clock relative to the local clock in ppm.
+ * Positive if the sender clock is slower. 0 until enough data has been received.
+ */
+int32_t ble_midi_rx_clock_drift_ppm();
+
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT
+struct ble_midi_rx_playout_stats {
+	/* The number of received messages released to the application. */
+	uint32_t num_released;
+	/* The number of messages that arrived after their playout time. */
+	uint32_t num_late;
+	/* The largest amount of ms a message arrived after its playout time. */
+	uint32_t max_late_ms;
+	/* The number of messages released on arrival because the playout queue was full. */
+	uint32_t num_overflows;
+};
+
+/**
+ * Gets statistics for the playout queue of the current connection.
+ */
+void ble_midi_rx_playout_stats(struct ble_midi_rx_playout_stats *stats);
+#endif // CONFIG_BLE_MIDI_RX_PLAYOUT
+
+#ifdef CONFIG_BLE_MIDI_RX_DEFERRED
+struct ble_midi_rx_deferred_stats {
+	/* The number of received packets queued for parsing. */
+	uint32_t num_packets;
+	/* The number of received packets dropped because the rx FIFO was full. */
+	uint32_t num_overflows;
+	/* The largest number of bytes waiting in the rx FIFO. */
+	uint32_t max_fifo_usage;
+};
+
+/**
+ * Gets statistics for the rx FIFO of the current connection.
+ */
+void ble_midi_rx_deferred_stats(struct ble_midi_rx_deferred_stats *stats);
+#endif // CONFIG_BLE_MIDI_RX_DEFERRED
+
+#ifdef CONFIG_BLE_MIDI_TX_REORDER_MSGS
+struct ble_midi_tx_reorder_stats {
+	/* The number of sent messages that were reordered for running status. */
+	uint32_t num_msgs;
+	/* The number of bytes saved by reordering. */
+	uint32_t num_bytes_saved;
+};
+
+/**
+ * Gets statistics for reordering of sent messages for the current connection.
+ */
+void ble_midi_tx_reorder_stats(struct ble_midi_tx_reorder_stats *stats);
+#endif // CONFIG_BLE_MIDI_TX_REORDER_MSGS
+
 #ifdef CONFIG_BLE_MIDI_TX_MODE_MANUAL
 /**
  * Send buffered MIDI messages, if any.
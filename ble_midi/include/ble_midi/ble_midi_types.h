@@ -0,0 +1,47 @@
+#ifndef _BLE_MIDI_TYPES_H_
+#define _BLE_MIDI_TYPES_H_
+
+/* Types shared by the public API and the sources that build without Zephyr, e.g the packet
+   codec and the parameter change encoding. */
+
+#include <stdint.h>
+
+/** A received non-sysex message. */
+struct ble_midi_message_t {
+	/* Status byte followed by zero, one or two data bytes. Unused bytes are zero. */
+	uint8_t bytes[3];
+	/* The number of message bytes, i.e 1-3. */
+	uint8_t num_bytes;
+	/* 13 bit, wrapped ms timestamp */
+	uint16_t timestamp;
+	/* Unwrapped ms sender time, see ble_midi_rx_sender_time. 0 if the parser has no clock. */
+	uint32_t sender_time;
+};
+
+/** Parameter types, see ble_midi_param_t. */
+enum ble_midi_param_type_t {
+	/* A 14 bit controller, i.e controller 0-31 (MSB) paired with 32-63 (LSB). */
+	BLE_MIDI_PARAM_CC14 = 0,
+	/* A registered parameter number, selected with controllers 101 and 100. */
+	BLE_MIDI_PARAM_RPN = 1,
+	/* A non-registered parameter number, selected with controllers 99 and 98. */
+	BLE_MIDI_PARAM_NRPN = 2
+};
+
+/** A parameter change made up of several control change messages. */
+struct ble_midi_param_t {
+	/* A ble_midi_param_type_t value. */
+	uint8_t type;
+	/* 0-15 */
+	uint8_t channel;
+	/* The controller number (0-31) of a 14 bit controller or the 14 bit parameter number. */
+	uint16_t number;
+	/* 14 bit value. If only the MSB was received, the low 7 bits are zero. */
+	uint16_t value;
+	/* 13 bit, wrapped ms timestamp of the last message of the change. */
+	uint16_t timestamp;
+	/* Unwrapped ms sender time of the last message of the change. */
+	uint32_t sender_time;
+};
+
+#endif
@@ -7,13 +7,19 @@
 #include "ble_midi_packet.h"
 #include "ble_midi_context.h"
 #include "conn_event_trigger.h"
+#include "midi_params.h"
+#include "midi_stream.h"
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT
+#include "rx_playout.h"
+#endif
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(ble_midi, CONFIG_BLE_MIDI_LOG_LEVEL);
 
-#ifndef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
+#ifdef CONFIG_BLE_MIDI_RX_DEFERRED
 #include <zephyr/sys/ring_buffer.h>
-#endif /* !CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG */
+#include <string.h>
+#endif
 
 static uint16_t timestamp_ms()
 {
@@ -22,6 +28,9 @@ static uint16_t timestamp_ms()
 
 struct ble_midi_context context;
 
+/* Parses the byte stream passed to ble_midi_tx_stream. */
+static struct midi_stream tx_stream;
+
 int send_packet(uint8_t *bytes, int num_bytes);
 
 void on_ready_state_changed(ble_midi_ready_state_t state) {
@@ -42,19 +51,282 @@ static ssize_t midi_read_cb(struct bt_conn *conn, const struct bt_gatt_attr *att
 	return 0;
 }
 
+/* Storage for received messages passed to midi_message_batch_cb. */
+static struct ble_midi_message_t rx_batch_buf[CONFIG_BLE_MIDI_RX_BATCH_SIZE];
+
+/* Passes received messages to the user callbacks. */
+static void deliver_rx_msgs(const struct ble_midi_message_t *msgs, uint32_t num_msgs)
+{
+	if (context.user_callbacks.midi_message_batch_cb) {
+		context.user_callbacks.midi_message_batch_cb(msgs, num_msgs);
+	} else if (context.user_callbacks.midi_message_cb) {
+		for (uint32_t i = 0; i < num_msgs; i++) {
+			uint8_t bytes[3] = {msgs[i].bytes[0], msgs[i].bytes[1], msgs[i].bytes[2]};
+			context.user_callbacks.midi_message_cb(bytes, msgs[i].num_bytes,
+								msgs[i].timestamp);
+		}
+	}
+}
+
+/* Parser callbacks forwarding to the user callbacks. Only used if the user callback is set. */
+static void parsed_msg_cb(void *user_data, uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
+{
+	context.user_callbacks.midi_message_cb(bytes, num_bytes, timestamp);
+}
+
+static void parsed_sysex_start_cb(void *user_data, uint16_t timestamp)
+{
+	context.user_callbacks.sysex_start_cb(timestamp);
+}
+
+static void parsed_sysex_data_cb(void *user_data, uint8_t data_byte)
+{
+	context.user_callbacks.sysex_data_cb(data_byte);
+}
+
+static void parsed_sysex_end_cb(void *user_data, uint16_t timestamp)
+{
+	context.user_callbacks.sysex_end_cb(timestamp);
+}
+
+static void parsed_sysex_data_span_cb(void *user_data, const uint8_t *data_bytes,
+				      uint32_t num_data_bytes)
+{
+	context.user_callbacks.sysex_data_span_cb(data_bytes, num_data_bytes);
+}
+
+static void parsed_msg_batch_cb(void *user_data, const struct ble_midi_message_t *msgs,
+				uint32_t num_msgs)
+{
+	context.user_callbacks.midi_message_batch_cb(msgs, num_msgs);
+}
+
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT
+/* Received non-sysex messages waiting for their playout time. */
+static struct rx_playout rx_playout;
+static struct k_spinlock rx_playout_lock;
+
+static void rx_playout_work_cb(struct k_work *w);
+static K_WORK_DELAYABLE_DEFINE(rx_playout_work, rx_playout_work_cb);
+
+/* Schedules the playout work item for the earliest queued message, if any. */
+static void schedule_rx_playout_work()
+{
+	k_spinlock_key_t key = k_spin_lock(&rx_playout_lock);
+	int64_t due_ms;
+	int has_msgs = rx_playout_next_due_ms(&rx_playout, &due_ms);
+	k_spin_unlock(&rx_playout_lock, key);
+
+	if (has_msgs) {
+		int64_t delay_ms = due_ms - k_uptime_get();
+		k_work_reschedule(&rx_playout_work, K_MSEC(delay_ms > 0 ? delay_ms : 0));
+	}
+}
+
+/* Releases all messages whose playout time has come. */
+static void rx_playout_work_cb(struct k_work *w)
+{
+	struct ble_midi_message_t msg;
+	while (1) {
+		k_spinlock_key_t key = k_spin_lock(&rx_playout_lock);
+		int has_msg = rx_playout_pop_due(&rx_playout, k_uptime_get(), &msg);
+		k_spin_unlock(&rx_playout_lock, key);
+		if (!has_msg) {
+			break;
+		}
+		deliver_rx_msgs(&msg, 1);
+	}
+	schedule_rx_playout_work();
+}
+
+/* Queues parsed messages for release at their sender time plus a fixed latency. */
+static void rx_playout_batch_cb(void *user_data, const struct ble_midi_message_t *msgs,
+				uint32_t num_msgs)
+{
+	int64_t now_ms = k_uptime_get();
+	for (uint32_t i = 0; i < num_msgs; i++) {
+		int64_t due_ms = rx_clock_local_time_ms(&context.rx_clock, msgs[i].sender_time) +
+				 CONFIG_BLE_MIDI_RX_PLAYOUT_LATENCY_MS;
+		k_spinlock_key_t key = k_spin_lock(&rx_playout_lock);
+		enum rx_playout_error rc = rx_playout_add(&rx_playout, &msgs[i], due_ms, now_ms);
+		k_spin_unlock(&rx_playout_lock, key);
+		if (rc == RX_PLAYOUT_QUEUE_FULL) {
+			/* Better early than never */
+			deliver_rx_msgs(&msgs[i], 1);
+		}
+	}
+	schedule_rx_playout_work();
+}
+
+static void reset_rx_playout()
+{
+	k_work_cancel_delayable(&rx_playout_work);
+	k_spinlock_key_t key = k_spin_lock(&rx_playout_lock);
+	rx_playout_reset(&rx_playout);
+	k_spin_unlock(&rx_playout_lock, key);
+}
+#endif /* CONFIG_BLE_MIDI_RX_PLAYOUT */
+
+/* Aggregates received parameter changes if param_cb is set. */
+static struct midi_params_aggregator rx_params;
+/* Received messages not consumed by rx_params and not yet passed on. */
+static const struct ble_midi_message_t *rx_params_run;
+static uint32_t rx_params_run_size;
+
+/* Passes on the messages preceding the current one, keeping them ahead of any parameter
+   change reported next. */
+static void pass_on_rx_params_run()
+{
+	if (rx_params_run_size > 0) {
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT
+		rx_playout_batch_cb(NULL, rx_params_run, rx_params_run_size);
+#else
+		deliver_rx_msgs(rx_params_run, rx_params_run_size);
+#endif
+		rx_params_run += rx_params_run_size;
+		rx_params_run_size = 0;
+	}
+}
+
+static void rx_params_param_cb(const struct ble_midi_param_t *param)
+{
+	pass_on_rx_params_run();
+	context.user_callbacks.param_cb(param);
+}
+
+/* Passes parsed messages through rx_params. Messages it does not consume are passed on
+   in runs. Parameter changes are reported on arrival, also if playout is enabled. */
+static void rx_params_batch_cb(void *user_data, const struct ble_midi_message_t *msgs,
+			       uint32_t num_msgs)
+{
+	rx_params_run = msgs;
+	rx_params_run_size = 0;
+	for (uint32_t i = 0; i < num_msgs; i++) {
+		if (midi_params_aggregator_add(&rx_params, &msgs[i])) {
+			pass_on_rx_params_run();
+			rx_params_run++;
+		} else {
+			rx_params_run_size++;
+		}
+	}
+	pass_on_rx_params_run();
+}
+
+static void parse_rx_packet(const uint8_t *bytes, uint16_t len, int64_t rx_time_ms)
+{
+	enum ble_midi_packet_error_t rc =
+		ble_midi_parser_feed_at(&context.rx_parser, bytes, len, rx_time_ms);
+	if (rc != BLE_MIDI_PACKET_SUCCESS) {
+		LOG_ERR("ble_midi_parser_feed returned error %d", rc);
+	}
+	if (context.user_callbacks.param_cb) {
+		/* A data entry or controller MSB is only held within a packet. */
+		midi_params_aggregator_flush(&rx_params);
+	}
+}
+
+#ifdef CONFIG_BLE_MIDI_RX_DEFERRED
+/* The maximum length of an attribute value, and thus of a received packet. */
+#define RX_PACKET_MAX_SIZE 512
+
+/* Precedes each packet in the rx FIFO. */
+struct rx_packet_header {
+	int64_t rx_time_ms;
+	uint16_t len;
+};
+
+/* Received packets waiting to be parsed, each a header followed by the packet bytes.
+   Written only from midi_write_cb and read only from rx_work_cb, so no locking is needed.
+   Each packet is published with its header in a single ring_buf_put_finish call. */
+RING_BUF_DECLARE(rx_fifo, CONFIG_BLE_MIDI_RX_FIFO_SIZE);
+static atomic_t rx_num_packets = ATOMIC_INIT(0);
+static atomic_t rx_num_overflows = ATOMIC_INIT(0);
+static atomic_t rx_max_fifo_usage = ATOMIC_INIT(0);
+
+static K_THREAD_STACK_DEFINE(rx_work_q_stack, CONFIG_BLE_MIDI_RX_THREAD_STACK_SIZE);
+static struct k_work_q rx_work_q;
+
+/* Parses the packets in the rx FIFO. Runs on rx_work_q, so user callbacks
+   do not block the Bluetooth RX thread. */
+static void rx_work_cb(struct k_work *w)
+{
+	static uint8_t packet[RX_PACKET_MAX_SIZE];
+	struct rx_packet_header header;
+	while (ring_buf_get(&rx_fifo, (uint8_t *)&header, sizeof(header)) == sizeof(header)) {
+		if (header.len > RX_PACKET_MAX_SIZE ||
+		    ring_buf_get(&rx_fifo, packet, header.len) != header.len) {
+			/* Out of sync with the packet boundaries, so drop everything */
+			LOG_ERR("Corrupt rx FIFO, dropping received packets");
+			ring_buf_reset(&rx_fifo);
+			break;
+		}
+		parse_rx_packet(packet, header.len, header.rx_time_ms);
+	}
+}
+static K_WORK_DEFINE(rx_work, rx_work_cb);
+
+/* Copies bytes to newly claimed space in the rx FIFO. The claim may be split where the
+   FIFO wraps around. The caller has checked that there is enough space. */
+static void claim_rx_fifo_bytes(const uint8_t *bytes, uint32_t num_bytes)
+{
+	while (num_bytes > 0) {
+		uint8_t *dst;
+		uint32_t num_claimed = ring_buf_put_claim(&rx_fifo, &dst, num_bytes);
+		memcpy(dst, bytes, num_claimed);
+		bytes += num_claimed;
+		num_bytes -= num_claimed;
+	}
+}
+
+/* Copies a received packet to the rx FIFO. Returns 0 on success, -ENOMEM if
+   the packet was dropped. */
+static int defer_rx_packet(const uint8_t *bytes, uint16_t len)
+{
+	struct rx_packet_header header = {.rx_time_ms = k_uptime_get(), .len = len};
+	if (len > RX_PACKET_MAX_SIZE || ring_buf_space_get(&rx_fifo) < sizeof(header) + len) {
+		atomic_inc(&rx_num_overflows);
+		return -ENOMEM;
+	}
+	/* Publish the header and the packet together, so rx_work_cb never sees a header
+	   without its packet */
+	claim_rx_fifo_bytes((const uint8_t *)&header, sizeof(header));
+	claim_rx_fifo_bytes(bytes, len);
+	ring_buf_put_finish(&rx_fifo, sizeof(header) + len);
+	atomic_inc(&rx_num_packets);
+
+	atomic_val_t usage = ring_buf_size_get(&rx_fifo);
+	if (usage > atomic_get(&rx_max_fifo_usage)) {
+		atomic_set(&rx_max_fifo_usage, usage);
+	}
+
+	k_work_submit_to_queue(&rx_work_q, &rx_work);
+	return 0;
+}
+
+/* Drops packets left over from the previous connection. */
+static void reset_rx_fifo()
+{
+	struct k_work_sync sync;
+	k_work_cancel_sync(&rx_work, &sync);
+	ring_buf_reset(&rx_fifo);
+	atomic_set(&rx_num_packets, 0);
+	atomic_set(&rx_num_overflows, 0);
+	atomic_set(&rx_max_fifo_usage, 0);
+}
+#endif /* CONFIG_BLE_MIDI_RX_DEFERRED */
+
 static ssize_t midi_write_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr, const void *buf,
 			     uint16_t len, uint16_t offset, uint8_t flags)
 {
-	struct ble_midi_parse_cb_t parse_cb = {.midi_message_cb = context.user_callbacks.midi_message_cb,
-					       .sysex_start_cb = context.user_callbacks.sysex_start_cb,
-					       .sysex_data_cb = context.user_callbacks.sysex_data_cb,
-					       .sysex_end_cb = context.user_callbacks.sysex_end_cb};
 	/* log_buffer("MIDI rx:", &((uint8_t *)buf)[offset], len); */
 	
-	enum ble_midi_packet_error_t rc = ble_midi_parse_packet(&((uint8_t *)buf)[offset], len, &parse_cb);
-	if (rc != BLE_MIDI_PACKET_SUCCESS) {
-		LOG_ERR("ble_midi_parse_packet returned error %d", rc);
+#ifdef CONFIG_BLE_MIDI_RX_DEFERRED
+	if (defer_rx_packet(&((const uint8_t *)buf)[offset], len)) {
+		LOG_WRN("rx FIFO full, dropped %d byte packet", len);
 	}
+#else
+	parse_rx_packet(&((const uint8_t *)buf)[offset], len, k_uptime_get());
+#endif
 	return len;
 }
 
@@ -104,49 +376,18 @@ BT_GATT_SERVICE_DEFINE(ble_midi_gatt_service, BLE_MIDI_GATT_ATTRIBUTES);
 #ifndef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
 atomic_t has_tx_data = ATOMIC_INIT(0x00);
 atomic_t waiting_for_notif_buf = ATOMIC_INIT(0x00);
-RING_BUF_DECLARE(tx_queue_fifo, CONFIG_BLE_MIDI_TX_FIFO_SIZE);
-
-int fifo_peek(uint8_t *bytes, int num_bytes) {
-    return ring_buf_peek(&tx_queue_fifo, bytes, num_bytes);
-}
-
-int fifo_read(int num_bytes) {
-    return ring_buf_get(&tx_queue_fifo, NULL, num_bytes);
-}
-
-int fifo_get_free_space()
-{
-    return ring_buf_space_get(&tx_queue_fifo);
-}
-
-int fifo_is_empty()
-{
-    return ring_buf_is_empty(&tx_queue_fifo);
-}
-
-int fifo_clear()
-{
-    ring_buf_reset(&tx_queue_fifo);
-	return 0;
-}
-
-int fifo_write(const uint8_t *bytes, int num_bytes)
-{
-    return ring_buf_put(&tx_queue_fifo, bytes, num_bytes);
-}
+/* Storage for the tx queue's built-in ring buffer. */
+BUILD_ASSERT((CONFIG_BLE_MIDI_TX_FIFO_SIZE & (CONFIG_BLE_MIDI_TX_FIFO_SIZE - 1)) == 0,
+	     "CONFIG_BLE_MIDI_TX_FIFO_SIZE must be a power of two");
+static uint8_t tx_queue_fifo_buf[CONFIG_BLE_MIDI_TX_FIFO_SIZE];
 
 void notify_has_data(int has_data)
 {
     has_data ? atomic_set_bit(&has_tx_data, 0) : atomic_clear_bit(&has_tx_data, 0);
 }
 
+/* The FIFO is the tx queue's built-in ring, see tx_queue_set_ring. */
 static struct tx_queue_callbacks tx_queue_callbacks = {
-    .fifo_peek = fifo_peek,
-    .fifo_read = fifo_read,
-    .fifo_get_free_space = fifo_get_free_space,
-    .fifo_is_empty = fifo_is_empty,
-    .fifo_clear = fifo_clear,
-    .fifo_write = fifo_write,
     .ble_timestamp = timestamp_ms,
 	.notify_has_data = notify_has_data
 };
@@ -183,7 +424,7 @@ K_WORK_DEFINE(tx_pending_packets_work, tx_pending_packets_work_cb);
 static void radio_notif_handler(void)
 {
 	/* If there is data to send, submit a work item to send it. */
-	int has_fifo_data = !ring_buf_is_empty(&tx_queue_fifo);
+	int has_fifo_data = !tx_queue_fifo_is_empty(&context.tx_queue);
 	int has_ble_tx_packets = atomic_test_bit(&has_tx_data, 0);
 	int waiting_for_notify_buffers = atomic_test_bit(&waiting_for_notif_buf, 0);
 	if (!waiting_for_notify_buffers && (has_ble_tx_packets || has_fifo_data)) {
@@ -229,6 +470,11 @@ static void on_notify_done(struct bt_conn *conn, void *user_data)
 	}
 }
 
+/* Sends a packet as a notification. bt_gatt_notify_cb copies the packet into an ATT buffer
+   before returning, and the public GATT API has no way to hand over a buffer reserved from the
+   stack, so the packet is copied once more here. The copy means the caller's buffer can be
+   reused as soon as this returns: tx packets are reset right after being sent, so queued
+   packets only need to cover what is built between connection events. */
 int send_packet(uint8_t *bytes, int num_bytes)
 {
 	struct bt_gatt_notify_params notify_params = {
@@ -259,14 +505,12 @@ static void on_mtu_changed(struct bt_conn *conn, uint16_t mtu_size)
 				      : tx_buf_size_new;
 
 #ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
-	if (context.tx_writer.tx_buf_size > tx_buf_size_new) {
-		// TODO: handle this somehow, e.g by decreasing size _after_ having sent the packet
-		// TODO: warn about this also when doing buffered TX
-		LOG_WRN("Lowering tx_buf_size from %d to %d", context.tx_writer.tx_buf_size,
-			tx_buf_size_new);
-	}
+	/* Packets are handed to the stack as soon as they are written, so there are
+	   no pending packets to re-pack. */
 	context.tx_writer.tx_buf_max_size = tx_buf_max_size;
 #else
+	/* Pending packets are re-packed to the new size when the tx queue reads this
+	   from the FIFO, i.e after the messages enqueued before it. */
 	tx_queue_fifo_add_tx_packet_size(&context.tx_queue, tx_buf_max_size);
 	submit_tx_queue_fifo_work();
 #endif
@@ -296,9 +540,17 @@ static void on_connected(struct bt_conn *conn, uint8_t err)
 	#endif
 	int tx_note_off_as_note_on = 0;
 	#ifdef CONFIG_BLE_MIDI_SEND_NOTE_OFF_AS_NOTE_ON
-	tx_note_off_as_note_on = 1
+	tx_note_off_as_note_on = 1;
 	#endif
+#ifdef CONFIG_BLE_MIDI_RX_DEFERRED
+	/* Stop parsing before resetting the parser */
+	reset_rx_fifo();
+#endif
 	ble_midi_context_reset(&context, tx_running_status, tx_note_off_as_note_on);
+	midi_params_aggregator_reset(&rx_params);
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT
+	reset_rx_playout();
+#endif
 
 	int actual_mtu = bt_gatt_get_mtu(conn);
 	// the att_mtu_updated callback may have been invoked before the connected callback,
@@ -409,10 +661,62 @@ enum ble_midi_error_t ble_midi_init(struct ble_midi_callbacks *callbacks)
 	context.user_callbacks.midi_message_cb = callbacks->midi_message_cb;
 	context.user_callbacks.sysex_start_cb = callbacks->sysex_start_cb;
 	context.user_callbacks.sysex_data_cb = callbacks->sysex_data_cb;
+	context.user_callbacks.sysex_data_span_cb = callbacks->sysex_data_span_cb;
 	context.user_callbacks.sysex_end_cb = callbacks->sysex_end_cb;
+	context.user_callbacks.midi_message_batch_cb = callbacks->midi_message_batch_cb;
+	context.user_callbacks.param_cb = callbacks->param_cb;
+
+	struct ble_midi_parse_cb_t parse_cb = {.batch_buf = rx_batch_buf,
+					       .batch_buf_size = CONFIG_BLE_MIDI_RX_BATCH_SIZE};
+	/* Unset callbacks stay NULL, so the parser ignores what they would have been passed. */
+	if (callbacks->midi_message_cb) {
+		parse_cb.midi_message_cb = parsed_msg_cb;
+	}
+	if (callbacks->sysex_start_cb) {
+		parse_cb.sysex_start_cb = parsed_sysex_start_cb;
+	}
+	if (callbacks->sysex_data_cb) {
+		parse_cb.sysex_data_cb = parsed_sysex_data_cb;
+	}
+	if (callbacks->sysex_end_cb) {
+		parse_cb.sysex_end_cb = parsed_sysex_end_cb;
+	}
+	if (callbacks->sysex_data_span_cb) {
+		parse_cb.sysex_data_span_cb = parsed_sysex_data_span_cb;
+	}
+	if (callbacks->midi_message_batch_cb) {
+		parse_cb.midi_message_batch_cb = parsed_msg_batch_cb;
+	}
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT
+	/* Received messages go through the playout queue, which calls the
+	   user's message callbacks. */
+	parse_cb.midi_message_cb = NULL;
+	parse_cb.midi_message_batch_cb = rx_playout_batch_cb;
+	rx_playout_init(&rx_playout);
+#endif
+	if (callbacks->param_cb) {
+		/* Received messages go through rx_params, which passes on the rest. */
+		parse_cb.midi_message_cb = NULL;
+		parse_cb.midi_message_batch_cb = rx_params_batch_cb;
+		int cc14 = 0;
+#ifdef CONFIG_BLE_MIDI_RX_PARAMS_CC14
+		cc14 = 1;
+#endif
+		midi_params_aggregator_init(&rx_params, rx_params_param_cb, cc14);
+	}
+	ble_midi_parser_init(&context.rx_parser, &parse_cb);
+	midi_stream_init(&tx_stream);
+	rx_clock_init(&context.rx_clock);
+	ble_midi_parser_set_clock(&context.rx_parser, &context.rx_clock);
+#ifdef CONFIG_BLE_MIDI_RX_DEFERRED
+	struct k_work_queue_config rx_work_q_config = {.name = "ble_midi_rx"};
+	k_work_queue_start(&rx_work_q, rx_work_q_stack, K_THREAD_STACK_SIZEOF(rx_work_q_stack),
+			   CONFIG_BLE_MIDI_RX_THREAD_PRIORITY, &rx_work_q_config);
+#endif
 
 #ifndef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
 	tx_queue_set_callbacks(&context.tx_queue, &tx_queue_callbacks);
+	tx_queue_set_ring(&context.tx_queue, tx_queue_fifo_buf, sizeof(tx_queue_fifo_buf));
 	conn_event_trigger_init(radio_notif_handler); // TODO: return error
 #endif
 	LOG_INF("Initialized BLE MIDI");
@@ -420,6 +724,43 @@ enum ble_midi_error_t ble_midi_init(struct ble_midi_callbacks *callbacks)
 	return BLE_MIDI_SUCCESS;
 }
 
+#ifndef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
+static enum ble_midi_error_t tx_queue_add_result_to_error(int add_result)
+{
+	switch (add_result) {
+	case TX_QUEUE_SUCCESS:
+		return BLE_MIDI_SUCCESS;
+	case TX_QUEUE_INVALID_DATA:
+		/* A status byte that doesn't start a message */
+		return BLE_MIDI_INVALID_ARGUMENT;
+	default:
+		return BLE_MIDI_TX_FIFO_FULL;
+	}
+}
+#endif
+
+#ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
+/* Maps an error returned by send_packet, i.e bt_gatt_notify_cb, to a ble_midi_error_t. */
+static enum ble_midi_error_t send_result_to_error(int send_rc)
+{
+	switch (send_rc) {
+	case 0:
+		return BLE_MIDI_SUCCESS;
+	case -ENOTCONN:
+	case -EPERM:
+		/* Not connected, or notifications not enabled */
+		return BLE_MIDI_NOT_CONNECTED;
+	case -ENOMEM:
+	case -ENOBUFS:
+	case -EAGAIN:
+		/* Out of tx buffers. Try again later. */
+		return BLE_MIDI_TX_FIFO_FULL;
+	default:
+		return BLE_MIDI_INVALID_ARGUMENT;
+	}
+}
+#endif
+
 enum ble_midi_error_t ble_midi_tx_msg(uint8_t *bytes)
 {
 #ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
@@ -432,16 +773,230 @@ enum ble_midi_error_t ble_midi_tx_msg(uint8_t *bytes)
 	if (add_result == TX_QUEUE_SUCCESS) {
 		submit_tx_queue_fifo_work();
 	}
+	return tx_queue_add_result_to_error(add_result);
+#endif
+}
+
+/* Like ble_midi_tx_msgs. Sets num_sent to the number of messages sent, which may be less
+   than num_msgs on failure if some packets were sent before it. */
+static enum ble_midi_error_t tx_msgs(const uint8_t (*msgs)[3], int num_msgs, int *num_sent)
+{
+	*num_sent = 0;
+#ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
+	/* Send as few packets as possible. */
+	uint16_t timestamp = timestamp_ms();
+	while (*num_sent < num_msgs) {
+		ble_midi_writer_reset(&context.tx_writer);
+		int add_result = ble_midi_writer_add_msgs(&context.tx_writer, &msgs[*num_sent],
+							  num_msgs - *num_sent, timestamp);
+		if (add_result <= 0) {
+			LOG_ERR("ble_midi_writer_add_msgs failed with error %d", add_result);
+			return BLE_MIDI_INVALID_ARGUMENT;
+		}
+		int send_rc = send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size);
+		if (send_rc) {
+			return send_result_to_error(send_rc);
+		}
+		*num_sent += add_result;
+	}
+	return BLE_MIDI_SUCCESS;
+#else
+	/* All messages are added or none of them */
+	int add_result = tx_queue_fifo_add_msgs(&context.tx_queue, msgs, num_msgs);
+	if (add_result == TX_QUEUE_SUCCESS) {
+		*num_sent = num_msgs;
+		submit_tx_queue_fifo_work();
+	}
+	return tx_queue_add_result_to_error(add_result);
+#endif
+}
+
+enum ble_midi_error_t ble_midi_tx_msgs(const uint8_t (*msgs)[3], int num_msgs)
+{
+	if (num_msgs <= 0) {
+		return BLE_MIDI_INVALID_ARGUMENT;
+	}
+	int num_sent;
+	return tx_msgs(msgs, num_msgs, &num_sent);
+}
+
+enum ble_midi_error_t ble_midi_tx_msg_group(const uint8_t (*msgs)[3], int num_msgs)
+{
+	if (num_msgs <= 0 || num_msgs > BLE_MIDI_TX_MSG_GROUP_MAX_COUNT) {
+		return BLE_MIDI_INVALID_ARGUMENT;
+	}
+
+#ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
+	/* Every call starts a new packet, so this keeps the group in one packet if it fits. */
+	return ble_midi_tx_msgs(msgs, num_msgs);
+#else
+	int add_result = tx_queue_fifo_add_msg_group(&context.tx_queue, msgs, num_msgs);
+	if (add_result == TX_QUEUE_SUCCESS) {
+		submit_tx_queue_fifo_work();
+	}
+	return tx_queue_add_result_to_error(add_result);
+#endif
+}
+
+enum ble_midi_error_t ble_midi_tx_param(enum ble_midi_param_type_t type, uint8_t channel,
+				       uint16_t number, uint16_t value)
+{
+	uint8_t msgs[MIDI_PARAMS_MAX_MSGS][3];
+	int num_msgs = midi_params_encode(type, channel, number, value, msgs);
+	if (num_msgs == 0) {
+		return BLE_MIDI_INVALID_ARGUMENT;
+	}
+	return ble_midi_tx_msg_group((const uint8_t(*)[3])msgs, num_msgs);
+}
+
+enum ble_midi_error_t ble_midi_tx_sysex_msg(const uint8_t *bytes, int num_bytes)
+{
+	if (num_bytes < 2 || bytes[0] != 0xf0 || bytes[num_bytes - 1] != 0xf7) {
+		return BLE_MIDI_INVALID_ARGUMENT;
+	}
+	for (int i = 1; i < num_bytes - 1; i++) {
+		if (bytes[i] & 0x80) {
+			return BLE_MIDI_INVALID_ARGUMENT;
+		}
+	}
+
+#ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
+	ble_midi_writer_reset(&context.tx_writer);
+	int add_result = ble_midi_writer_add_sysex_msg(&context.tx_writer, bytes, num_bytes,
+						       timestamp_ms());
+	if (add_result == BLE_MIDI_SUCCESS) {
+		return send_result_to_error(
+			send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size));
+	}
+
+	/* Too long for one packet. Send the start, data and end in consecutive packets. */
+	enum ble_midi_error_t rc = ble_midi_tx_sysex_start();
+	int num_sent = 1;
+	while (rc == BLE_MIDI_SUCCESS && num_sent < num_bytes - 1) {
+		ble_midi_writer_reset(&context.tx_writer);
+		add_result = ble_midi_writer_add_sysex_data(&context.tx_writer, &bytes[num_sent],
+							    num_bytes - 1 - num_sent, timestamp_ms());
+		if (add_result <= 0) {
+			LOG_ERR("ble_midi_writer_add_sysex_data failed with error %d", add_result);
+			return BLE_MIDI_INVALID_ARGUMENT;
+		}
+		rc = send_result_to_error(
+			send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size));
+		num_sent += add_result;
+	}
+	return rc == BLE_MIDI_SUCCESS ? ble_midi_tx_sysex_end() : rc;
+#else
+	if (num_bytes > TX_QUEUE_SYSEX_MSG_MAX_SIZE) {
+		return BLE_MIDI_INVALID_ARGUMENT;
+	}
+	int add_result = tx_queue_fifo_add_sysex_msg(&context.tx_queue, bytes, num_bytes);
+	if (add_result == TX_QUEUE_SUCCESS) {
+		submit_tx_queue_fifo_work();
+	}
 	return add_result == TX_QUEUE_SUCCESS ? BLE_MIDI_SUCCESS : BLE_MIDI_TX_FIFO_FULL;
 #endif
 }
 
+/* The maximum number of consecutive messages from the byte stream sent at once */
+#define TX_STREAM_MSG_RUN_MAX_COUNT 16
+
+/* The return value of ble_midi_tx_stream when sending stops at pos because of rc. The
+   bytes consumed so far are reported first, and any other error on the next call. */
+static int tx_stream_result(size_t pos, int rc)
+{
+	return rc == BLE_MIDI_TX_FIFO_FULL || pos > 0 ? (int)pos : rc;
+}
+
+int ble_midi_tx_stream(const uint8_t *bytes, size_t num_bytes)
+{
+	uint8_t msgs[TX_STREAM_MSG_RUN_MAX_COUNT][3];
+	int num_msgs = 0;
+	/* Where the run of messages in msgs starts, to resume from if it can't be sent. */
+	struct midi_stream run_start_stream;
+	size_t run_start_pos = 0;
+	size_t pos = 0;
+
+	while (pos < num_bytes || num_msgs > 0) {
+		struct midi_stream prev_stream = tx_stream;
+		struct midi_stream_event event = {.type = MIDI_STREAM_NONE};
+		size_t event_end = pos;
+		if (pos < num_bytes) {
+			event_end += midi_stream_next(&tx_stream, &bytes[pos], num_bytes - pos, &event);
+		}
+
+		if (event.type == MIDI_STREAM_MSG) {
+			if (num_msgs == 0) {
+				run_start_stream = prev_stream;
+				run_start_pos = pos;
+			}
+			msgs[num_msgs][0] = event.msg[0];
+			msgs[num_msgs][1] = event.msg[1];
+			msgs[num_msgs][2] = event.msg[2];
+			num_msgs++;
+			pos = event_end;
+			if (num_msgs < TX_STREAM_MSG_RUN_MAX_COUNT && pos < num_bytes) {
+				continue;
+			}
+		}
+
+		/* Send the run of messages before anything else, and once it is full. */
+		if (num_msgs > 0) {
+			int num_sent;
+			int rc = tx_msgs((const uint8_t(*)[3])msgs, num_msgs, &num_sent);
+			if (rc != BLE_MIDI_SUCCESS) {
+				/* Resume after the messages that were sent, if any, by parsing them
+				   again from the start of the run. */
+				tx_stream = run_start_stream;
+				pos = run_start_pos;
+				for (int i = 0; i < num_sent; i++) {
+					pos += midi_stream_next(&tx_stream, &bytes[pos], num_bytes - pos,
+								&event);
+				}
+				return tx_stream_result(pos, rc);
+			}
+			num_msgs = 0;
+		}
+
+		int rc = BLE_MIDI_SUCCESS;
+		switch (event.type) {
+		case MIDI_STREAM_SYSEX_START:
+			rc = ble_midi_tx_sysex_start();
+			break;
+		case MIDI_STREAM_SYSEX_END:
+			rc = ble_midi_tx_sysex_end();
+			break;
+		case MIDI_STREAM_SYSEX_DATA: {
+			const uint8_t *data = event.data;
+			const uint8_t *data_end = event.data + event.num_data_bytes;
+			while (data < data_end) {
+				int num_sent = ble_midi_tx_sysex_data((uint8_t *)data, data_end - data);
+				if (num_sent == BLE_MIDI_TX_FIFO_FULL || num_sent == 0) {
+					/* Still in the sysex message, resume after the sent data bytes. */
+					return data - bytes;
+				}
+				if (num_sent < 0) {
+					return tx_stream_result(data - bytes, num_sent);
+				}
+				data += num_sent;
+			}
+			break;
+		}
+		}
+		if (rc != BLE_MIDI_SUCCESS) {
+			tx_stream = prev_stream;
+			return tx_stream_result(pos, rc);
+		}
+		pos = event_end;
+	}
+	return num_bytes;
+}
+
 enum ble_midi_error_t ble_midi_tx_sysex_start()
 {
 #ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
 	ble_midi_writer_reset(&context.tx_writer);
 	ble_midi_writer_start_sysex_msg(&context.tx_writer, timestamp_ms());
-	return send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size);
+	return send_result_to_error(send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size));
 #else
 	int add_result = tx_queue_fifo_add_sysex_start(&context.tx_queue); 
 	if (add_result == TX_QUEUE_SUCCESS) {
@@ -456,7 +1011,7 @@ enum ble_midi_error_t ble_midi_tx_sysex_end()
 	#ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
 	ble_midi_writer_reset(&context.tx_writer);
 	ble_midi_writer_end_sysex_msg(&context.tx_writer, timestamp_ms());
-	return send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size);
+	return send_result_to_error(send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size));
 #else
 	int add_result = tx_queue_fifo_add_sysex_end(&context.tx_queue);
 	if (add_result == TX_QUEUE_SUCCESS) {
@@ -482,11 +1037,11 @@ int ble_midi_tx_sysex_data(uint8_t *bytes, int num_bytes)
 		return add_result;
 	}
 
-	int send_rc = send_packet(context.tx_writer.tx_buf, add_result);
+	int send_rc = send_packet(context.tx_writer.tx_buf, context.tx_writer.tx_buf_size);
 	if (send_rc == 0) {
 		return add_result; /* Return number of sent bytes on success */
 	}
-	return BLE_MIDI_SUCCESS; // TODO: report errors
+	return send_result_to_error(send_rc);
 #else
 	int add_result = tx_queue_fifo_add_sysex_data(&context.tx_queue, bytes, num_bytes);
 	if (add_result > 0) {
@@ -496,6 +1051,50 @@ int ble_midi_tx_sysex_data(uint8_t *bytes, int num_bytes)
 #endif
 }
 
+uint32_t ble_midi_rx_sender_time()
+{
+	return context.rx_parser.sender_time;
+}
+
+int64_t ble_midi_rx_local_time_ms(uint32_t sender_time)
+{
+	return rx_clock_local_time_ms(&context.rx_clock, sender_time);
+}
+
+int32_t ble_midi_rx_clock_drift_ppm()
+{
+	return context.rx_clock.drift_ppm;
+}
+
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT
+void ble_midi_rx_playout_stats(struct ble_midi_rx_playout_stats *stats)
+{
+	k_spinlock_key_t key = k_spin_lock(&rx_playout_lock);
+	stats->num_released = rx_playout.stats.num_released;
+	stats->num_late = rx_playout.stats.num_late;
+	stats->max_late_ms = rx_playout.stats.max_late_ms;
+	stats->num_overflows = rx_playout.stats.num_overflows;
+	k_spin_unlock(&rx_playout_lock, key);
+}
+#endif
+
+#ifdef CONFIG_BLE_MIDI_RX_DEFERRED
+void ble_midi_rx_deferred_stats(struct ble_midi_rx_deferred_stats *stats)
+{
+	stats->num_packets = atomic_get(&rx_num_packets);
+	stats->num_overflows = atomic_get(&rx_num_overflows);
+	stats->max_fifo_usage = atomic_get(&rx_max_fifo_usage);
+}
+#endif
+
+#ifdef CONFIG_BLE_MIDI_TX_REORDER_MSGS
+void ble_midi_tx_reorder_stats(struct ble_midi_tx_reorder_stats *stats)
+{
+	stats->num_msgs = context.tx_queue.num_reordered_msgs;
+	stats->num_bytes_saved = context.tx_queue.num_reorder_bytes_saved;
+}
+#endif
+
 #ifdef CONFIG_BLE_MIDI_TX_MODE_MANUAL
 /**
  * 
@@ -13,6 +13,10 @@ struct ble_midi_context {
     ble_midi_ready_state_t ready_state;
     int is_initialized;
     struct ble_midi_callbacks user_callbacks;
+    /* Parsing state of received packets, carried over between packets. */
+    struct ble_midi_parser_t rx_parser;
+    /* Unwraps received timestamps and tracks the sender clock. */
+    struct rx_clock rx_clock;
 #ifdef CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG
     struct ble_midi_writer_t tx_writer;
 #else
@@ -1,3 +1,4 @@
+#include <string.h>
 #include "ble_midi_packet.h"
 
 /* Returns the 6 high bits of a 13 bit BLE MIDI timestamp */
@@ -37,101 +38,238 @@ inline static uint32_t is_data_byte(uint8_t byte)
 	return byte < 0x80;
 }
 
-static uint32_t is_realtime_message(uint8_t status_byte)
+/* Word type for scanning several bytes at a time for status bytes. */
+#if UINTPTR_MAX > 0xffffffff
+typedef uint64_t scan_word_t;
+#define SCAN_WORD_HIGH_BITS 0x8080808080808080ull
+#else
+typedef uint32_t scan_word_t;
+#define SCAN_WORD_HIGH_BITS 0x80808080ul
+#endif
+
+/**
+ * Returns the number of data bytes before the first status byte, or num_bytes if
+ * there is no status byte. Checks the high bit of a word of bytes at a time.
+ */
+static uint32_t count_data_bytes(const uint8_t *bytes, uint32_t num_bytes)
 {
-	switch (status_byte) {
-	case 0xf8: /* Timing Clock */
-	case 0xfa: /* Start */
-	case 0xfb: /* Continue */
-	case 0xfc: /* Stop */
-	case 0xfe: /* Active Sensing */
-	case 0xff: /* System Reset */
-		return 1;
+	uint32_t i = 0;
+	while (num_bytes - i >= sizeof(scan_word_t)) {
+		scan_word_t word;
+		/* memcpy compiles to a single, possibly unaligned, load */
+		memcpy(&word, &bytes[i], sizeof(word));
+		if (word & SCAN_WORD_HIGH_BITS) {
+			break;
+		}
+		i += sizeof(scan_word_t);
+	}
+	while (i < num_bytes && is_data_byte(bytes[i])) {
+		i++;
 	}
+	return i;
+}
 
-	return 0;
+#define REPEAT_16(x) x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x
+
+#define CHANNEL_1_DATA_BYTE  (BLE_MIDI_STATUS_CHANNEL | 2)
+#define CHANNEL_2_DATA_BYTES (BLE_MIDI_STATUS_CHANNEL | 3)
+
+const uint8_t ble_midi_status_info[256] = {
+	/* 0x00 - 0x7f are data bytes */
+	[0x80] = REPEAT_16(CHANNEL_2_DATA_BYTES), /* Note off */
+	REPEAT_16(CHANNEL_2_DATA_BYTES),	   /* Note on */
+	REPEAT_16(CHANNEL_2_DATA_BYTES),	   /* Poly KeyPress */
+	REPEAT_16(CHANNEL_2_DATA_BYTES),	   /* Control Change */
+	REPEAT_16(CHANNEL_1_DATA_BYTE),		   /* Program Change */
+	REPEAT_16(CHANNEL_1_DATA_BYTE),		   /* Channel Pressure */
+	REPEAT_16(CHANNEL_2_DATA_BYTES),	   /* PitchBend Change */
+	BLE_MIDI_STATUS_SYSEX,			   /* 0xf0 Sysex start */
+	BLE_MIDI_STATUS_SYSTEM_COMMON | 2,	   /* 0xf1 MIDI Time Code Quarter Frame */
+	BLE_MIDI_STATUS_SYSTEM_COMMON | 3,	   /* 0xf2 Song Position Pointer */
+	BLE_MIDI_STATUS_SYSTEM_COMMON | 2,	   /* 0xf3 Song Select */
+	0,					   /* 0xf4 Undefined */
+	0,					   /* 0xf5 Undefined */
+	BLE_MIDI_STATUS_SYSTEM_COMMON | 1,	   /* 0xf6 Tune request */
+	BLE_MIDI_STATUS_SYSEX,			   /* 0xf7 Sysex end */
+	BLE_MIDI_STATUS_REALTIME | 1,		   /* 0xf8 Timing Clock */
+	0,					   /* 0xf9 Undefined */
+	BLE_MIDI_STATUS_REALTIME | 1,		   /* 0xfa Start */
+	BLE_MIDI_STATUS_REALTIME | 1,		   /* 0xfb Continue */
+	BLE_MIDI_STATUS_REALTIME | 1,		   /* 0xfc Stop */
+	0,					   /* 0xfd Undefined */
+	BLE_MIDI_STATUS_REALTIME | 1,		   /* 0xfe Active Sensing */
+	BLE_MIDI_STATUS_REALTIME | 1,		   /* 0xff System Reset */
+};
+
+inline static uint32_t is_realtime_message(uint8_t status_byte)
+{
+	return ble_midi_status_info[status_byte] & BLE_MIDI_STATUS_REALTIME;
 }
 
-static uint32_t is_system_common_message(uint8_t status_byte)
+inline static uint32_t is_system_common_message(uint8_t status_byte)
 {
-	switch (status_byte) {
-	case 0xf1: /* MIDI Time Code Quarter Frame */
-	case 0xf3: /* Song Select */
-	case 0xf2: /* Song Position Pointer */
-	case 0xf6: /* Tune request */
-		return 1;
-	}
+	return ble_midi_status_info[status_byte] & BLE_MIDI_STATUS_SYSTEM_COMMON;
+}
 
-	return 0;
+inline static uint32_t is_channel_message(uint8_t status_byte)
+{
+	return ble_midi_status_info[status_byte] & BLE_MIDI_STATUS_CHANNEL;
+}
+
+inline static uint8_t message_size(uint8_t status_byte)
+{
+	return ble_midi_status_info[status_byte] & BLE_MIDI_STATUS_SIZE_MASK;
 }
 
-static uint32_t is_channel_message(uint8_t status_byte)
+/**
+ * Non-zero if a timestamp byte for timestamp can be appended to the packet. The parser
+ * reconstructs timestamps by incrementing the header's high bits each time the timestamp
+ * byte decreases, so a timestamp must be less than 128 ms after the latest one in the packet.
+ */
+static int can_append_timestamp(const struct ble_midi_writer_t *writer, uint16_t timestamp)
 {
-	uint8_t high_nibble = status_byte >> 4;
-	switch (high_nibble) {
-	case 0x8: /* Note off */
-	case 0x9: /* Note on */
-	case 0xa: /* Poly KeyPress */
-	case 0xb: /* Control Change */
-	case 0xe: /* PitchBend Change */
-	case 0xc: /* Program Change */
-	case 0xd: /* Channel Pressure */
-		return 1;
+	return writer->tx_buf_size == 0 ||
+	       ((timestamp - writer->latest_timestamp) & 0x1fff) < 0x80;
+}
+
+static void append_header_byte(struct ble_midi_writer_t *writer, uint16_t timestamp)
+{
+	writer->tx_buf[writer->tx_buf_size++] = header_byte(timestamp);
+	/* The header only holds the high bits of the timestamp. */
+	writer->latest_timestamp = timestamp & ~0x7f;
+}
+
+/* Checks that a zero padded non-sysex message has a valid status byte and data bytes. */
+static enum ble_midi_packet_error_t validate_msg(const uint8_t *message_bytes)
+{
+	if ((ble_midi_status_info[message_bytes[0]] & BLE_MIDI_STATUS_SIZE_MASK) == 0) {
+		return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
+	}
+	if (!is_data_byte(message_bytes[1]) || !is_data_byte(message_bytes[2])) {
+		return BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE;
 	}
+	return BLE_MIDI_PACKET_SUCCESS;
+}
 
-	return 0;
+/* Writer settings, constant if fixed at build time. */
+#ifdef BLE_MIDI_WRITER_RUNNING_STATUS
+#define running_status_enabled(writer) BLE_MIDI_WRITER_RUNNING_STATUS
+#else
+#define running_status_enabled(writer) ((writer)->running_status_enabled)
+#endif
+#ifdef BLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON
+#define note_off_as_note_on(writer) BLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON
+#else
+#define note_off_as_note_on(writer) ((writer)->note_off_as_note_on)
+#endif
+
+/* Describes how a non-sysex message is appended to the packet. */
+struct msg_layout {
+	/* The status byte to write, which differs from the message's for note offs sent as
+	   note ons. Also the status byte to store in the writer once the message is appended. */
+	uint8_t status_byte;
+	/* The running status byte to store in the writer once the message is appended. */
+	uint8_t running_status_byte;
+	uint8_t add_header_byte;
+	uint8_t add_timestamp_byte;
+	uint8_t add_status_byte;
+	uint8_t num_data_bytes;
+};
+
+/**
+ * Applies the running status and timestamp rules to a validated non-sysex message. A packet header
+ * is needed if the packet is empty, and the timestamp and status bytes can be skipped in running
+ * status sequences.
+ */
+static inline void layout_msg(const struct ble_midi_writer_t *writer, uint8_t status_byte,
+			      uint16_t timestamp, struct msg_layout *layout)
+{
+	uint8_t status_info = ble_midi_status_info[status_byte];
+
+	/* Use running status? */
+	uint8_t prev_running_status_byte = writer->prev_running_status_byte;
+
+	int is_channel_msg = status_info & BLE_MIDI_STATUS_CHANNEL;
+	if (!running_status_enabled(writer)) {
+		prev_running_status_byte = 0;
+	} else if (is_channel_msg) {
+		if ((status_byte >> 4) == 0x8 && note_off_as_note_on(writer)) {
+			/* This is a note off message. Represent it as a note
+				on with velocity 0 to increase running status efficiency. */
+			status_byte = 0x90 | (status_byte & 0xf);
+		}
+
+		prev_running_status_byte = status_byte;
+	} else if (status_info & BLE_MIDI_STATUS_KEEPS_RUNNING_STATUS) {
+		/*
+		   From the BLE MIDI spec:
+		   System Common and System Real-Time messages do not cancel Running Status if
+		   interspersed between Running Status MIDI messages. However, a timestamp byte
+		   must precede the Running Status MIDI message that follows.
+		*/
+	} else {
+		/* Cancel running status */
+		prev_running_status_byte = 0;
+	}
+
+	/* Skip the message timestamp if we're in a running status sequence, the timestamp
+	   hasn't changed and we're dealing with a channel message that was not preceded
+	   by a system realtime/common message. */
+	int is_running_status =
+		running_status_enabled(writer) && status_byte == writer->prev_running_status_byte;
+	int prev_msg_is_sys_rt_or_cmn = ble_midi_status_info[writer->prev_status_byte] &
+					BLE_MIDI_STATUS_KEEPS_RUNNING_STATUS;
+	int timestamp_has_changed = timestamp != writer->prev_timestamp;
+	int skip_msg_timestamp = is_running_status && !timestamp_has_changed && is_channel_msg &&
+				 !prev_msg_is_sys_rt_or_cmn;
+
+	/* Skip the status byte if we're in a running status sequence and this is a channel message
+	 */
+	int skip_status_byte = is_running_status && is_channel_msg;
+
+	layout->status_byte = status_byte;
+	layout->running_status_byte = prev_running_status_byte;
+	layout->add_header_byte = writer->tx_buf_size == 0;
+	layout->add_timestamp_byte = !skip_msg_timestamp;
+	layout->add_status_byte = !skip_status_byte;
+	layout->num_data_bytes = (status_info & BLE_MIDI_STATUS_SIZE_MASK) - 1;
 }
 
-static uint8_t message_size(uint8_t status_byte)
-{
-	/* Channel message? */
-	uint8_t high_nibble = status_byte >> 4;
-	switch (high_nibble) {
-	case 0x8: /* Note off */
-	case 0x9: /* Note on */
-	case 0xa: /* Poly KeyPress */
-	case 0xb: /* Control Change */
-	case 0xe: /* PitchBend Change */
-		/* Three byte channel Voice Message */
-		return 3;
-	case 0xc: /* Program Change */
-	case 0xd: /* Channel Pressure */
-		/* Two byte channel Voice Message */
-		return 2;
-	default:
-		break;
-	}
-
-	/* Real time message? */
-	switch (status_byte) {
-	case 0xf8: /* Timing Clock */
-	case 0xfa: /* Start */
-	case 0xfb: /* Continue */
-	case 0xfc: /* Stop */
-	case 0xfe: /* Active Sensing */
-	case 0xff: /* System Reset */
-		return 1;
-	default:
-		break;
-	}
-
-	/* System common message? */
-	switch (status_byte) {
-	case 0xf1: /* MIDI Time Code Quarter Frame */
-	case 0xf3: /* Song Select */
-		/* 2 byte System Common message */
-		return 2;
-	case 0xf2: /* Song Position Pointer */
-		/* 3 byte System Common message */
-		return 3;
-	case 0xf6: /* Tune request */
-		/* Single-byte System Common Message */
-		return 1;
-	default:
-		break;
+/**
+ * Encodes a validated non-sysex message laid out by layout_msg to dst, which must have room for
+ * 5 bytes. Does not modify the writer. Returns the number of bytes written.
+ */
+static inline int encode_msg(const uint8_t *message_bytes, uint16_t timestamp,
+			     const struct msg_layout *layout, uint8_t *dst)
+{
+	int num_bytes = 0;
+	if (layout->add_header_byte) {
+		dst[num_bytes++] = header_byte(timestamp);
+	}
+	if (layout->add_timestamp_byte) {
+		dst[num_bytes++] = timestamp_byte(timestamp);
+	}
+	if (layout->add_status_byte) {
+		dst[num_bytes++] = layout->status_byte;
 	}
+	if (layout->num_data_bytes > 0) {
+		dst[num_bytes++] = message_bytes[1];
+	}
+	if (layout->num_data_bytes > 1) {
+		/* Velocity 0 for note offs sent as note ons */
+		dst[num_bytes++] = layout->status_byte == message_bytes[0] ? message_bytes[2] : 0;
+	}
+	return num_bytes;
+}
 
-	return 0;
+/* Updates the writer state after appending a message encoded by encode_msg. */
+static inline void commit_msg(struct ble_midi_writer_t *writer, const struct msg_layout *layout,
+			      uint16_t timestamp)
+{
+	writer->latest_timestamp = timestamp;
+	writer->prev_status_byte = layout->status_byte;
+	writer->prev_running_status_byte = layout->running_status_byte;
+	writer->prev_timestamp = timestamp;
 }
 
 void ble_midi_writer_init(struct ble_midi_writer_t *writer, int running_status_enabled,
@@ -142,9 +280,14 @@ void ble_midi_writer_init(struct ble_midi_writer_t *writer, int running_status_e
 	writer->prev_running_status_byte = 0;
 	writer->prev_status_byte = 0;
 	writer->prev_timestamp = 0;
+	writer->latest_timestamp = 0;
 	writer->in_sysex_msg = 0;
+#ifndef BLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON
 	writer->note_off_as_note_on = note_off_as_note_on;
+#endif
+#ifndef BLE_MIDI_WRITER_RUNNING_STATUS
 	writer->running_status_enabled = running_status_enabled;
+#endif
 }
 
 void ble_midi_writer_reset(struct ble_midi_writer_t *writer)
@@ -157,14 +300,43 @@ void ble_midi_writer_reset(struct ble_midi_writer_t *writer)
 	writer->prev_status_byte = 0;
 }
 
+void ble_midi_writer_checkpoint(const struct ble_midi_writer_t *writer,
+				struct ble_midi_writer_checkpoint_t *checkpoint)
+{
+	checkpoint->tx_buf_size = writer->tx_buf_size;
+	checkpoint->prev_timestamp = writer->prev_timestamp;
+	checkpoint->latest_timestamp = writer->latest_timestamp;
+	checkpoint->prev_status_byte = writer->prev_status_byte;
+	checkpoint->prev_running_status_byte = writer->prev_running_status_byte;
+	checkpoint->in_sysex_msg = writer->in_sysex_msg;
+}
+
+void ble_midi_writer_rollback(struct ble_midi_writer_t *writer,
+			      const struct ble_midi_writer_checkpoint_t *checkpoint)
+{
+	writer->tx_buf_size = checkpoint->tx_buf_size;
+	writer->prev_timestamp = checkpoint->prev_timestamp;
+	writer->latest_timestamp = checkpoint->latest_timestamp;
+	writer->prev_status_byte = checkpoint->prev_status_byte;
+	writer->prev_running_status_byte = checkpoint->prev_running_status_byte;
+	writer->in_sysex_msg = checkpoint->in_sysex_msg;
+}
+
 enum ble_midi_packet_error_t ble_midi_writer_add_msg(struct ble_midi_writer_t *writer,
 					      uint8_t *message_bytes, uint16_t timestamp)
 {
 	/* First, handle special case of a system real time message in a sysex message */
 	if (writer->in_sysex_msg) {
 		if (is_realtime_message(message_bytes[0])) {
-			if (writer->tx_buf_max_size - writer->tx_buf_size >= 2) {
+			/* The sysex message may continue in a new, empty packet. */
+			int add_packet_header = writer->tx_buf_size == 0;
+			if (writer->tx_buf_max_size - writer->tx_buf_size >= 2 + add_packet_header &&
+			    can_append_timestamp(writer, timestamp)) {
+				if (add_packet_header) {
+					append_header_byte(writer, timestamp);
+				}
 				writer->tx_buf[writer->tx_buf_size++] = timestamp_byte(timestamp);
+				writer->latest_timestamp = timestamp;
 				writer->tx_buf[writer->tx_buf_size++] = message_bytes[0];
 				return BLE_MIDI_PACKET_SUCCESS;
 			} else {
@@ -177,110 +349,245 @@ enum ble_midi_packet_error_t ble_midi_writer_add_msg(struct ble_midi_writer_t *w
 	}
 
 	/* The following code appends a MIDI message to the BLE MIDI packet in two steps:
-	   1. Compute a maximum of 5 bytes to append:
+	   1. Lay out a maximum of 5 bytes to append:
 		 - packet header?
 		 - message timestamp?
 		 - 1-3 midi bytes
-	   2. Append the bytes if there is room in the packet.
+	   2. Encode the bytes if there is room in the packet.
 	*/
-	uint8_t status_byte = message_bytes[0];
-	uint8_t num_message_bytes = message_size(status_byte);
-	if (num_message_bytes == 0) {
-		return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
+	enum ble_midi_packet_error_t result = validate_msg(message_bytes);
+	if (result != BLE_MIDI_PACKET_SUCCESS) {
+		return result;
 	}
 
-	uint8_t data_bytes[2] = {message_bytes[1], message_bytes[2]};
+	struct msg_layout layout;
+	layout_msg(writer, message_bytes[0], timestamp, &layout);
+	int num_bytes_to_append = layout.add_header_byte + layout.add_timestamp_byte +
+				  layout.add_status_byte + layout.num_data_bytes;
 
-	if (!is_data_byte(data_bytes[0]) || !is_data_byte(data_bytes[1])) {
-		return BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE;
-	}
+	/* Append bytes to the BLE packet */
+	if (writer->tx_buf_size + num_bytes_to_append <= writer->tx_buf_max_size &&
+	    can_append_timestamp(writer, timestamp)) {
+		writer->tx_buf_size += encode_msg(message_bytes, timestamp, &layout,
+						  &writer->tx_buf[writer->tx_buf_size]);
+		commit_msg(writer, &layout, timestamp);
 
-	/* Use running status? */
-	uint8_t prev_running_status_byte = writer->prev_running_status_byte;
+		return BLE_MIDI_PACKET_SUCCESS;
+	} else {
+		return BLE_MIDI_PACKET_ERROR_PACKET_FULL;
+	}
+}
 
-	if (!writer->running_status_enabled) {
-		prev_running_status_byte = 0;
-	} else if (is_channel_message(status_byte)) {
-		if ((status_byte >> 4) == 0x8 && writer->note_off_as_note_on) {
-			/* This is a note off message. Represent it as a note
-				on with velocity 0 to increase running status efficiency. */
-			status_byte = 0x90 | (status_byte & 0xf);
-			data_bytes[1] = 0; /* Velocity 0 */
+int ble_midi_writer_add_msgs(struct ble_midi_writer_t *writer, const uint8_t (*msgs)[3],
+			     uint32_t num_msgs, uint16_t timestamp)
+{
+	for (uint32_t i = 0; i < num_msgs; i++) {
+		enum ble_midi_packet_error_t result = validate_msg(msgs[i]);
+		if (result != BLE_MIDI_PACKET_SUCCESS) {
+			return result;
 		}
+	}
 
-		prev_running_status_byte = status_byte;
-	} else if (is_realtime_message(status_byte) || is_system_common_message(status_byte)) {
-		/*
-		   From the BLE MIDI spec:
-		   System Common and System Real-Time messages do not cancel Running Status if
-		   interspersed between Running Status MIDI messages. However, a timestamp byte
-		   must precede the Running Status MIDI message that follows.
-		*/
-	} else {
-		/* Cancel running status */
-		prev_running_status_byte = 0;
+	/* Each message takes up at most 4 bytes, plus a packet header if the packet is empty. */
+	uint32_t max_num_bytes = 4 * num_msgs + 1;
+	if (writer->in_sysex_msg || writer->tx_buf_max_size < writer->tx_buf_size + max_num_bytes ||
+	    !can_append_timestamp(writer, timestamp)) {
+		/* Add messages one at a time until the packet is full */
+		for (uint32_t i = 0; i < num_msgs; i++) {
+			uint8_t bytes[3] = {msgs[i][0], msgs[i][1], msgs[i][2]};
+			enum ble_midi_packet_error_t result =
+				ble_midi_writer_add_msg(writer, bytes, timestamp);
+			if (result == BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
+				return i;
+			} else if (result != BLE_MIDI_PACKET_SUCCESS) {
+				return i > 0 ? (int)i : result;
+			}
+		}
+		return num_msgs;
 	}
 
-	uint8_t bytes_to_append[5] = {0, 0, 0, 0, 0};
-	uint8_t num_bytes_to_append = 0;
+	/* All messages fit. Encode them straight into the packet. */
+	for (uint32_t i = 0; i < num_msgs; i++) {
+		struct msg_layout layout;
+		layout_msg(writer, msgs[i][0], timestamp, &layout);
+		writer->tx_buf_size += encode_msg(msgs[i], timestamp, &layout,
+						  &writer->tx_buf[writer->tx_buf_size]);
+		commit_msg(writer, &layout, timestamp);
+	}
+	return num_msgs;
+}
 
-	/* Add packet header byte? */
-	if (writer->tx_buf_size == 0) {
-		bytes_to_append[num_bytes_to_append] = header_byte(timestamp);
-		num_bytes_to_append++;
+/* The status byte a channel message is written with, i.e note on for note offs sent as note ons. */
+static uint8_t written_status_byte(const struct ble_midi_writer_t *writer, uint8_t status_byte)
+{
+	if ((status_byte >> 4) == 0x8 && note_off_as_note_on(writer)) {
+		return 0x90 | (status_byte & 0xf);
 	}
+	return status_byte;
+}
 
-	/* Skip the message timestamp if we're in a running status sequence, the timestamp
-	   hasn't changed and we're dealing with a channel message that was not preceded
-	   by a system realtime/common message. */
-	int is_running_status = status_byte == writer->prev_running_status_byte;
-	int prev_msg_is_sys_rt_or_cmn = is_system_common_message(writer->prev_status_byte) ||
-					is_realtime_message(writer->prev_status_byte);
-	int timestamp_has_changed = timestamp != writer->prev_timestamp;
-	int skip_msg_timestamp = is_running_status && !timestamp_has_changed &&
-				 is_channel_message(status_byte) && !prev_msg_is_sys_rt_or_cmn;
-	if (!skip_msg_timestamp) {
-		bytes_to_append[num_bytes_to_append] = timestamp_byte(timestamp);
-		num_bytes_to_append++;
+/**
+ * Reorders validated messages sharing a timestamp so that messages with the same status byte
+ * follow each other. Picks the earliest message continuing the current running status, or the
+ * earliest message if there is none. A message may only move ahead of messages on other
+ * channels, so the order of messages on each channel is kept, and system messages stay
+ * where they are relative to all other messages.
+ */
+static void reorder_msgs(const struct ble_midi_writer_t *writer, const uint8_t (*msgs)[3],
+			 uint32_t num_msgs, uint8_t (*reordered_msgs)[3])
+{
+	uint8_t is_picked[BLE_MIDI_WRITER_REORDER_MAX_MSGS] = {0};
+	uint8_t running_status_byte = writer->prev_running_status_byte;
+
+	for (uint32_t num_picked = 0; num_picked < num_msgs; num_picked++) {
+		int first_idx = -1;
+		int pick_idx = -1;
+		uint16_t blocked_channels = 0;
+		for (uint32_t i = 0; i < num_msgs; i++) {
+			if (is_picked[i]) {
+				continue;
+			}
+			if (first_idx < 0) {
+				first_idx = i;
+			}
+			uint8_t status_byte = msgs[i][0];
+			if (!(ble_midi_status_info[status_byte] & BLE_MIDI_STATUS_CHANNEL)) {
+				/* Don't move messages past system messages */
+				break;
+			}
+			uint16_t channel_bit = 1 << (status_byte & 0xf);
+			if (!(blocked_channels & channel_bit) &&
+			    written_status_byte(writer, status_byte) == running_status_byte) {
+				pick_idx = i;
+				break;
+			}
+			/* Later messages on this channel must stay behind this one */
+			blocked_channels |= channel_bit;
+		}
+		if (pick_idx < 0) {
+			pick_idx = first_idx;
+		}
+		is_picked[pick_idx] = 1;
+		memcpy(reordered_msgs[num_picked], msgs[pick_idx], 3);
+
+		uint8_t status_byte = msgs[pick_idx][0];
+		uint8_t status_info = ble_midi_status_info[status_byte];
+		if (status_info & BLE_MIDI_STATUS_CHANNEL) {
+			running_status_byte = written_status_byte(writer, status_byte);
+		} else if (!(status_info & BLE_MIDI_STATUS_KEEPS_RUNNING_STATUS)) {
+			running_status_byte = 0;
+		}
 	}
+}
 
-	/* Skip the status byte if we're in a running status sequence and this is a channel message
-	 */
-	int skip_status_byte = is_running_status && is_channel_message(status_byte);
-	if (!skip_status_byte) {
-		bytes_to_append[num_bytes_to_append] = status_byte;
-		num_bytes_to_append++;
+/* The number of bytes appending validated messages would take, regardless of the packet size. */
+static uint32_t msgs_size(struct ble_midi_writer_t *writer, const uint8_t (*msgs)[3],
+			  uint32_t num_msgs, uint16_t timestamp)
+{
+	/* Lay out the messages as if they were appended, then restore the writer */
+	struct ble_midi_writer_checkpoint_t checkpoint;
+	ble_midi_writer_checkpoint(writer, &checkpoint);
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < num_msgs; i++) {
+		struct msg_layout layout;
+		layout_msg(writer, msgs[i][0], timestamp, &layout);
+		int num_bytes = layout.add_header_byte + layout.add_timestamp_byte +
+				layout.add_status_byte + layout.num_data_bytes;
+		size += num_bytes;
+		writer->tx_buf_size += num_bytes;
+		commit_msg(writer, &layout, timestamp);
 	}
+	ble_midi_writer_rollback(writer, &checkpoint);
+	return size;
+}
 
-	/* Add data bytes */
-	uint8_t num_data_bytes = num_message_bytes - 1;
-	for (int i = 0; i < num_data_bytes; i++) {
-		bytes_to_append[num_bytes_to_append] = data_bytes[i];
-		num_bytes_to_append++;
+int ble_midi_writer_add_msgs_reordered(struct ble_midi_writer_t *writer, const uint8_t (*msgs)[3],
+				       uint32_t num_msgs, uint16_t timestamp,
+				       uint32_t *num_bytes_saved)
+{
+	*num_bytes_saved = 0;
+	if (writer->in_sysex_msg || !running_status_enabled(writer)) {
+		return ble_midi_writer_add_msgs(writer, msgs, num_msgs, timestamp);
 	}
 
-	/* Append bytes to the BLE packet */
-	if (writer->tx_buf_size + num_bytes_to_append <= writer->tx_buf_max_size) {
-		for (int i = 0; i < num_bytes_to_append; i++) {
-			writer->tx_buf[writer->tx_buf_size] = bytes_to_append[i];
-			writer->tx_buf_size++;
+	for (uint32_t i = 0; i < num_msgs; i++) {
+		enum ble_midi_packet_error_t result = validate_msg(msgs[i]);
+		if (result != BLE_MIDI_PACKET_SUCCESS) {
+			return result;
 		}
+	}
 
-		/* Update packet state */
-		writer->prev_status_byte = status_byte;
-		writer->prev_running_status_byte = prev_running_status_byte;
-		writer->prev_timestamp = timestamp;
+	uint32_t num_msgs_to_add = num_msgs < BLE_MIDI_WRITER_REORDER_MAX_MSGS
+					   ? num_msgs
+					   : BLE_MIDI_WRITER_REORDER_MAX_MSGS;
+	uint8_t reordered_msgs[BLE_MIDI_WRITER_REORDER_MAX_MSGS][3];
+	struct ble_midi_writer_checkpoint_t checkpoint;
+	ble_midi_writer_checkpoint(writer, &checkpoint);
+
+	/* Add as many of the first messages as possible. If the reordered messages don't all fit,
+	   try again with as many of the first messages as did fit, so that the added messages are
+	   always the first ones in msgs. */
+	while (num_msgs_to_add > 0) {
+		reorder_msgs(writer, msgs, num_msgs_to_add, reordered_msgs);
+		uint32_t size = msgs_size(writer, msgs, num_msgs_to_add, timestamp);
+		uint32_t reordered_size =
+			msgs_size(writer, (const uint8_t (*)[3])reordered_msgs, num_msgs_to_add, timestamp);
+		int use_reordered_msgs = reordered_size < size;
+		const uint8_t (*msgs_to_add)[3] =
+			use_reordered_msgs ? (const uint8_t (*)[3])reordered_msgs : msgs;
+
+		int num_added = ble_midi_writer_add_msgs(writer, msgs_to_add, num_msgs_to_add, timestamp);
+		if (num_added == (int)num_msgs_to_add) {
+			*num_bytes_saved = use_reordered_msgs ? size - reordered_size : 0;
+			return num_added;
+		}
+		ble_midi_writer_rollback(writer, &checkpoint);
+		num_msgs_to_add = num_added;
+	}
+	return 0;
+}
 
-		return BLE_MIDI_PACKET_SUCCESS;
-	} else {
+int ble_midi_writer_bytes_needed(const struct ble_midi_writer_t *writer, const uint8_t *bytes,
+				 uint16_t timestamp)
+{
+	if (!can_append_timestamp(writer, timestamp)) {
 		return BLE_MIDI_PACKET_ERROR_PACKET_FULL;
 	}
+
+	int num_header_bytes = writer->tx_buf_size == 0;
+	if (bytes[0] == 0xf0) {
+		/* Sysex start, with a timestamp byte */
+		return writer->in_sysex_msg ? BLE_MIDI_PACKET_ERROR_ALREADY_IN_SYSEX_SEQUENCE
+					    : num_header_bytes + 2;
+	}
+	if (bytes[0] == 0xf7) {
+		/* Sysex end, with a timestamp byte */
+		return writer->in_sysex_msg ? num_header_bytes + 2
+					    : BLE_MIDI_PACKET_ERROR_NOT_IN_SYSEX_SEQUENCE;
+	}
+	if (writer->in_sysex_msg) {
+		/* Only real time messages allowed in sysex data, with a timestamp byte */
+		return is_realtime_message(bytes[0]) ? num_header_bytes + 2
+						     : BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
+	}
+
+	enum ble_midi_packet_error_t result = validate_msg(bytes);
+	if (result != BLE_MIDI_PACKET_SUCCESS) {
+		return result;
+	}
+	struct msg_layout layout;
+	layout_msg(writer, bytes[0], timestamp, &layout);
+	return layout.add_header_byte + layout.add_timestamp_byte + layout.add_status_byte +
+	       layout.num_data_bytes;
 }
 
 enum ble_midi_packet_error_t ble_midi_writer_add_sysex_msg(struct ble_midi_writer_t *writer,
-						    uint8_t *bytes, uint32_t num_bytes,
+						    const uint8_t *bytes, uint32_t num_bytes,
 						    uint16_t timestamp)
 {
+	if (writer->in_sysex_msg) {
+		return BLE_MIDI_PACKET_ERROR_ALREADY_IN_SYSEX_SEQUENCE;
+	}
 	/* The sysex message should have zero or more data bytes
 	   between the start byte 0xf0 and end byte 0xf7. */
 	if (num_bytes < 2) {
@@ -289,10 +596,9 @@ enum ble_midi_packet_error_t ble_midi_writer_add_sysex_msg(struct ble_midi_write
 	if (bytes[0] != 0xf0 || bytes[num_bytes - 1] != 0xf7) {
 		return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
 	}
-	for (int i = 1; i < num_bytes - 1; i++) {
-		if (!is_data_byte(bytes[i])) {
-			return BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE;
-		}
+	uint32_t num_data_bytes = num_bytes - 2;
+	if (count_data_bytes(&bytes[1], num_data_bytes) != num_data_bytes) {
+		return BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE;
 	}
 
 	/* See if there's room in the packet */
@@ -302,23 +608,26 @@ enum ble_midi_packet_error_t ble_midi_writer_add_sysex_msg(struct ble_midi_write
 	if (add_packet_header) {
 		num_bytes_to_append++; /* Empty packet. A packet header byte is needed. */
 	}
-	if (writer->tx_buf_max_size - writer->tx_buf_size < num_bytes_to_append) {
+	if (writer->tx_buf_max_size - writer->tx_buf_size < num_bytes_to_append ||
+	    !can_append_timestamp(writer, timestamp)) {
 		return BLE_MIDI_PACKET_ERROR_PACKET_FULL;
 	}
 
 	/* Add packet header? */
 	if (add_packet_header) {
-		writer->tx_buf[writer->tx_buf_size++] = header_byte(timestamp);
+		append_header_byte(writer, timestamp);
 	}
 
-	/* Add message bytes */
-	for (int i = 0; i < num_bytes; i++) {
-		if (i == 0 || i == num_bytes - 1) {
-			/* Timestamp bytes for sysex start and end status bytes */
-			writer->tx_buf[writer->tx_buf_size++] = timestamp_byte(timestamp);
-		}
-		writer->tx_buf[writer->tx_buf_size++] = bytes[i];
-	}
+	/* Add message bytes, with timestamp bytes for sysex start and end status bytes */
+	uint8_t *dst = &writer->tx_buf[writer->tx_buf_size];
+	*dst++ = timestamp_byte(timestamp);
+	*dst++ = 0xf0;
+	memcpy(dst, &bytes[1], num_data_bytes);
+	dst += num_data_bytes;
+	*dst++ = timestamp_byte(timestamp);
+	*dst++ = 0xf7;
+	writer->tx_buf_size += num_bytes_to_append - add_packet_header;
+	writer->latest_timestamp = timestamp;
 
 	/* Cancel running status */
 	writer->prev_running_status_byte = 0;
@@ -335,16 +644,18 @@ static enum ble_midi_packet_error_t append_status_byte_with_timestamp(struct ble
 		/* Empty packet. Also add packet header. */
 		num_bytes_to_append++;
 	}
-	if (writer->tx_buf_max_size - writer->tx_buf_size < num_bytes_to_append) {
+	if (writer->tx_buf_max_size - writer->tx_buf_size < num_bytes_to_append ||
+	    !can_append_timestamp(writer, timestamp)) {
 		return BLE_MIDI_PACKET_ERROR_PACKET_FULL;
 	}
 
 	/* If we made it here, there's room in the packet for the sysex start message. */
 	if (add_packet_header) {
-		writer->tx_buf[writer->tx_buf_size++] = header_byte(timestamp);
+		append_header_byte(writer, timestamp);
 	}
 
 	writer->tx_buf[writer->tx_buf_size++] = timestamp_byte(timestamp);
+	writer->latest_timestamp = timestamp;
 	writer->tx_buf[writer->tx_buf_size++] = status;
 
 	return BLE_MIDI_PACKET_SUCCESS;
@@ -387,10 +698,8 @@ int ble_midi_writer_add_sysex_data(struct ble_midi_writer_t *writer, const uint8
 	}
 
 	/* Validate data bytes */
-	for (int i = 0; i < num_data_bytes; i++) {
-		if (!is_data_byte(data_bytes[i])) {
-			return BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE;
-		}
+	if (count_data_bytes(data_bytes, num_data_bytes) != num_data_bytes) {
+		return BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE;
 	}
 
 	/* Add packet header? */
@@ -399,260 +708,328 @@ int ble_midi_writer_add_sysex_data(struct ble_midi_writer_t *writer, const uint8
 			/* Pathological case: not enough room for a packet header. */
 			return BLE_MIDI_PACKET_ERROR_PACKET_FULL;
 		}
-		writer->tx_buf[writer->tx_buf_size++] = header_byte(timestamp);
+		append_header_byte(writer, timestamp);
 	}
 
 	/* Add data bytes until end of data or end of packet. */
-	int num_bytes_left = writer->tx_buf_max_size - writer->tx_buf_size;
-	int num_data_bytes_to_add =
+	uint32_t num_bytes_left = writer->tx_buf_max_size - writer->tx_buf_size;
+	uint32_t num_data_bytes_to_add =
 		num_bytes_left < num_data_bytes ? num_bytes_left : num_data_bytes;
-	for (int i = 0; i < num_data_bytes_to_add; i++) {
-		writer->tx_buf[writer->tx_buf_size++] = data_bytes[i];
-	}
+	memcpy(&writer->tx_buf[writer->tx_buf_size], data_bytes, num_data_bytes_to_add);
+	writer->tx_buf_size += num_data_bytes_to_add;
 
 	/* Return the number of data bytes added */
 	return num_data_bytes_to_add;
 }
 
-struct ble_midi_parser_t {
-	uint8_t in_sysex_msg;
-	uint8_t running_status_byte;
-	uint8_t prev_timestamp_byte;
-	uint32_t read_pos;
-	uint8_t *rx_buf;
-	uint32_t rx_buf_size;
-};
+static int is_batch_mode(struct ble_midi_parser_t *parser)
+{
+	return parser->cb.midi_message_batch_cb && parser->cb.batch_buf &&
+	       parser->cb.batch_buf_size > 0;
+}
+
+/* Hands over batched messages, if any. */
+static void flush_batch(struct ble_midi_parser_t *parser)
+{
+	if (parser->batch_size > 0) {
+		parser->cb.midi_message_batch_cb(parser->cb.user_data, parser->cb.batch_buf,
+						 parser->batch_size);
+		parser->batch_size = 0;
+	}
+}
 
-static enum ble_midi_packet_error_t ble_midi_parser_read(struct ble_midi_parser_t *parser, uint8_t *result,
-						  uint32_t num_bytes)
+/* Reports a parsed non-sysex message, either directly or by adding it to the batch. */
+static void emit_message(struct ble_midi_parser_t *parser, uint8_t *bytes, uint8_t num_bytes,
+			 uint16_t timestamp)
 {
-	if (parser->read_pos <= parser->rx_buf_size - num_bytes) {
-		for (int i = 0; i < num_bytes; i++) {
-			result[i] = parser->rx_buf[parser->read_pos];
-			parser->read_pos++;
+	if (is_batch_mode(parser)) {
+		struct ble_midi_message_t *msg = &parser->cb.batch_buf[parser->batch_size++];
+		msg->bytes[0] = bytes[0];
+		msg->bytes[1] = num_bytes > 1 ? bytes[1] : 0;
+		msg->bytes[2] = num_bytes > 2 ? bytes[2] : 0;
+		msg->num_bytes = num_bytes;
+		msg->timestamp = timestamp;
+		msg->sender_time = parser->sender_time;
+		if (parser->batch_size == parser->cb.batch_buf_size) {
+			flush_batch(parser);
 		}
-		return BLE_MIDI_PACKET_SUCCESS;
-	} else {
+	} else if (parser->cb.midi_message_cb) {
+		parser->cb.midi_message_cb(parser->cb.user_data, bytes, num_bytes, timestamp);
+	}
+}
+
+/* Reports a run of sysex data bytes, either as a span or byte by byte. */
+static void emit_sysex_data(struct ble_midi_parser_t *parser, const uint8_t *data_bytes,
+			    uint32_t num_data_bytes)
+{
+	struct ble_midi_parse_cb_t *cb = &parser->cb;
+	if (cb->sysex_data_span_cb) {
+		flush_batch(parser);
+		cb->sysex_data_span_cb(cb->user_data, data_bytes, num_data_bytes);
+	} else if (cb->sysex_data_cb) {
+		flush_batch(parser);
+		for (uint32_t i = 0; i < num_data_bytes; i++) {
+			cb->sysex_data_cb(cb->user_data, data_bytes[i]);
+		}
+	}
+}
+
+/**
+ * Reads the data bytes of a message with the given status byte, starting at *read_pos.
+ * message_bytes[0] must hold the status byte.
+ */
+static enum ble_midi_packet_error_t read_message_data(struct ble_midi_parser_t *parser,
+						      uint32_t *read_pos, uint8_t *message_bytes,
+						      uint8_t num_message_bytes)
+{
+	uint32_t pos = *read_pos;
+	if (parser->rx_buf_size - pos < (uint32_t)(num_message_bytes - 1)) {
 		return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
 	}
+	for (int i = 1; i < num_message_bytes; i++) {
+		uint8_t byte = parser->rx_buf[pos++];
+		if (!is_data_byte(byte)) {
+			return BLE_MIDI_PACKET_ERROR_UNEXPECTED_STATUS_BYTE;
+		}
+		message_bytes[i] = byte;
+	}
+	*read_pos = pos;
+	return BLE_MIDI_PACKET_SUCCESS;
 }
 
-static enum ble_midi_packet_error_t is_sysex_continuation(struct ble_midi_parser_t *parser, int *is_sysex)
+/**
+ * Parses a packet in a single pass. If the sysex state is not known from previous
+ * packets, whether the packet continues a sysex message is decided along the way:
+ * a sysex continuation packet starts with zero or more timestamped system real time
+ * messages followed by a data byte or a timestamped sysex end byte.
+ */
+static enum ble_midi_packet_error_t parse_packet(struct ble_midi_parser_t *parser)
 {
-	*is_sysex = 0;
+	struct ble_midi_parse_cb_t *cb = &parser->cb;
+	const uint8_t *rx_buf = parser->rx_buf;
+	uint32_t rx_buf_size = parser->rx_buf_size;
 
-	/* A sysex continuation packet starts with
-	  - a packet header
-	  - 0 or more system realtime messages with timestamps
-	  - a data byte */
-	uint8_t header = 0;
-	if (ble_midi_parser_read(parser, &header, 1)) {
+	/* Start by reading the packet header */
+	if (rx_buf_size < 1) {
 		return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
 	}
+	uint8_t packet_header = rx_buf[0];
+	if (!is_status_byte(packet_header)) {
+		return BLE_MIDI_PACKET_ERROR_INVALID_HEADER_BYTE;
+	}
+	uint8_t timestamp_high_bits = 0x3f & packet_header;
+	uint32_t read_pos = 1;
+
+	/* Running status does not carry over between packets. */
+	parser->running_status_byte = 0;
+	parser->prev_timestamp_byte = 0;
+
+	/* If the sysex state is unknown, this is non-zero until something other than
+	   a system real time message is read. */
+	int at_packet_start = !parser->sysex_state_known;
+
+	while (read_pos < rx_buf_size) {
+		uint8_t byte = rx_buf[read_pos];
+
+		if (is_data_byte(byte)) {
+			if (parser->in_sysex_msg || at_packet_start) {
+				/* Sysex data. Find the end of this run of data bytes and report
+				   all of them at once, straight from the packet buffer. */
+				parser->in_sysex_msg = 1;
+				at_packet_start = 0;
+				const uint8_t *span_start = &rx_buf[read_pos];
+				uint32_t span_size =
+					1 + count_data_bytes(span_start + 1, rx_buf_size - read_pos - 1);
+				read_pos += span_size;
+				emit_sysex_data(parser, span_start, span_size);
+				continue;
+			}
+
+			/* Running status without timestamp byte. */
+			uint8_t status_byte = parser->running_status_byte;
+			if (status_byte == 0) {
+				return BLE_MIDI_PACKET_ERROR_UNEXPECTED_DATA_BYTE;
+			}
+			uint8_t message_bytes[3] = {status_byte, 0, 0};
+			uint8_t num_message_bytes = message_size(status_byte);
+			int res = read_message_data(parser, &read_pos, message_bytes,
+						    num_message_bytes);
+			if (res != BLE_MIDI_PACKET_SUCCESS) {
+				return res;
+			}
+			emit_message(parser, message_bytes, num_message_bytes, parser->timestamp);
+			continue;
+		}
 
-	while (parser->read_pos < parser->rx_buf_size) {
-		uint8_t byte_1 = 0;
-		if (ble_midi_parser_read(parser, &byte_1, 1)) {
+		/* A timestamp byte. At least one byte should follow. */
+		uint8_t timestamp_byte = byte;
+		read_pos++;
+		if (read_pos >= rx_buf_size) {
 			return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
 		}
-		if (is_data_byte(byte_1)) {
-			*is_sysex = 1;
-			return BLE_MIDI_PACKET_SUCCESS;
+		if (parser->prev_timestamp_byte > timestamp_byte) {
+			timestamp_high_bits = (timestamp_high_bits + 1) % 0x40;
 		}
-		uint8_t byte_2 = 0;
-		if (ble_midi_parser_read(parser, &byte_2, 1)) {
-			return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
+		parser->prev_timestamp_byte = timestamp_byte;
+		uint16_t timestamp = timestamp_ms(timestamp_high_bits, timestamp_byte);
+		parser->timestamp = timestamp;
+		if (parser->clock) {
+			parser->sender_time =
+				rx_clock_update(parser->clock, timestamp, parser->rx_time_ms);
 		}
 
-		if (is_data_byte(byte_2)) {
-			return BLE_MIDI_PACKET_ERROR_UNEXPECTED_DATA_BYTE;
+		uint8_t status_byte = rx_buf[read_pos];
+		if (is_data_byte(status_byte)) {
+			/* Running status with timestamp */
+			if (parser->in_sysex_msg) {
+				return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
+			}
+			if (parser->running_status_byte == 0) {
+				return BLE_MIDI_PACKET_ERROR_UNEXPECTED_DATA_BYTE;
+			}
+			status_byte = parser->running_status_byte;
+			uint8_t message_bytes[3] = {status_byte, 0, 0};
+			uint8_t num_message_bytes = message_size(status_byte);
+			int res = read_message_data(parser, &read_pos, message_bytes,
+						    num_message_bytes);
+			if (res != BLE_MIDI_PACKET_SUCCESS) {
+				return res;
+			}
+			at_packet_start = 0;
+			emit_message(parser, message_bytes, num_message_bytes, timestamp);
+			continue;
 		}
-		if (is_realtime_message(byte_2)) {
-			/* A system real time message. Keep going.  */
-		} else {
-			/* A status byte other than system real time.
-			Not a sysex continuation packet */
-			return BLE_MIDI_PACKET_SUCCESS;
+		read_pos++;
+
+		uint8_t status_info = ble_midi_status_info[status_byte];
+		if (status_info & BLE_MIDI_STATUS_REALTIME) {
+			/* System real time messages may appear anywhere, also in sysex
+			   messages, and do not affect running status. */
+			emit_message(parser, &status_byte, 1, timestamp);
+			continue;
+		}
+
+		if (status_byte == 0xf7 && (parser->in_sysex_msg || at_packet_start)) {
+			/* End of sysex. At the start of a packet, this ends a sysex message
+			   whose last data byte was sent in the previous packet. */
+			parser->in_sysex_msg = 0;
+			parser->running_status_byte = 0;
+			at_packet_start = 0;
+			if (cb->sysex_end_cb) {
+				flush_batch(parser);
+				cb->sysex_end_cb(cb->user_data, timestamp);
+			}
+			continue;
+		}
+
+		if (parser->in_sysex_msg) {
+			/* Only data bytes, system real time and sysex end allowed in sysex
+			   messages. Bail. */
+			return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
 		}
+		at_packet_start = 0;
+
+		/* Update running status. */
+		if (status_info & BLE_MIDI_STATUS_CHANNEL) {
+			parser->running_status_byte = status_byte;
+		} else if (!(status_info & BLE_MIDI_STATUS_SYSTEM_COMMON)) {
+			parser->running_status_byte = 0;
+		}
+
+		if (status_byte == 0xf0) {
+			/* Sysex start */
+			parser->in_sysex_msg = 1;
+			if (cb->sysex_start_cb) {
+				flush_batch(parser);
+				cb->sysex_start_cb(cb->user_data, timestamp);
+			}
+			continue;
+		}
+
+		/* Non-sysex message */
+		uint8_t num_message_bytes = status_info & BLE_MIDI_STATUS_SIZE_MASK;
+		if (num_message_bytes == 0) {
+			return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
+		}
+		uint8_t message_bytes[3] = {status_byte, 0, 0};
+		int res = read_message_data(parser, &read_pos, message_bytes, num_message_bytes);
+		if (res != BLE_MIDI_PACKET_SUCCESS) {
+			return res;
+		}
+		emit_message(parser, message_bytes, num_message_bytes, timestamp);
 	}
 
 	return BLE_MIDI_PACKET_SUCCESS;
 }
 
-enum ble_midi_packet_error_t ble_midi_parse_packet(uint8_t *rx_buf, uint32_t rx_buf_size,
-					    struct ble_midi_parse_cb_t *cb)
+void ble_midi_parser_init(struct ble_midi_parser_t *parser, const struct ble_midi_parse_cb_t *cb)
 {
-	/* A parser instance keeping track of the parsing state. */
-	struct ble_midi_parser_t parser = {.in_sysex_msg = 0,
-					   .prev_timestamp_byte = 0,
-					   .rx_buf = rx_buf,
-					   .rx_buf_size = rx_buf_size,
-					   .read_pos = 0,
-					   .running_status_byte = 0};
+	parser->cb = *cb;
+	parser->clock = 0;
+	ble_midi_parser_reset(parser);
+}
 
-	/* First, check if this is a sysex continuation packet. */
-	int is_sysex_cont = 0;
-	int res = is_sysex_continuation(&parser, &is_sysex_cont);
-	if (res != BLE_MIDI_PACKET_SUCCESS) {
-		return res;
+void ble_midi_parser_reset(struct ble_midi_parser_t *parser)
+{
+	parser->in_sysex_msg = 0;
+	parser->sysex_state_known = 0;
+	parser->running_status_byte = 0;
+	parser->prev_timestamp_byte = 0;
+	parser->timestamp = 0;
+	parser->num_errors = 0;
+	parser->rx_buf = 0;
+	parser->rx_buf_size = 0;
+	parser->batch_size = 0;
+	parser->rx_time_ms = 0;
+	parser->sender_time = 0;
+	if (parser->clock) {
+		rx_clock_reset(parser->clock);
 	}
-	parser.in_sysex_msg = is_sysex_cont;
+}
 
-	/* Reset read position and do the actual parsing */
-	parser.read_pos = 0;
+void ble_midi_parser_set_clock(struct ble_midi_parser_t *parser, struct rx_clock *clock)
+{
+	parser->clock = clock;
+}
 
-	/* Start actual parsing by reading packet header */
-	uint8_t packet_header = 0;
-	if (ble_midi_parser_read(&parser, &packet_header, 1)) {
-		return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-	}
-	uint8_t timestamp_high_bits = 0x3f & packet_header;
+enum ble_midi_packet_error_t ble_midi_parser_feed(struct ble_midi_parser_t *parser,
+						  const uint8_t *rx_buf, uint32_t rx_buf_size)
+{
+	return ble_midi_parser_feed_at(parser, rx_buf, rx_buf_size, parser->rx_time_ms);
+}
 
-	if (!is_status_byte(packet_header)) {
-		return BLE_MIDI_PACKET_ERROR_INVALID_HEADER_BYTE;
-	}
+enum ble_midi_packet_error_t ble_midi_parser_feed_at(struct ble_midi_parser_t *parser,
+						     const uint8_t *rx_buf, uint32_t rx_buf_size,
+						     int64_t rx_time_ms)
+{
+	parser->rx_time_ms = rx_time_ms;
+	parser->rx_buf = rx_buf;
+	parser->rx_buf_size = rx_buf_size;
+	parser->batch_size = 0;
 
-	/* Parse messages */
-	while (parser.read_pos < parser.rx_buf_size) {
-		if (parser.in_sysex_msg) {
-			/* Only data bytes or system real time with timestamp allowed in sysex
-			 * messages */
-			uint8_t byte = 0;
-			if (ble_midi_parser_read(&parser, &byte, 1)) {
-				return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-			}
+	enum ble_midi_packet_error_t result = parse_packet(parser);
 
-			if (is_data_byte(byte)) {
-				if (cb->sysex_data_cb) {
-					cb->sysex_data_cb(byte);
-				}
-			} else {
-				/* Assume we just read a timestamp byte. It may be followed by a
-				  system real time status or sysex end */
-				uint8_t status = 0;
-				if (ble_midi_parser_read(&parser, &status, 1)) {
-					return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-				}
-				if (is_realtime_message(status)) {
-					if (cb->midi_message_cb) {
-						cb->midi_message_cb(
-							&status, 1,
-							timestamp_ms(timestamp_high_bits, byte));
-					}
-				} else if (status == 0xf7) {
-					/* End of sysex */
-					parser.in_sysex_msg = 0;
-					if (cb->sysex_end_cb) {
-						cb->sysex_end_cb(
-							timestamp_ms(timestamp_high_bits, byte));
-					}
-				} else {
-					/* Invalid status byte. Bail. */
-					return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
-				}
-			}
-		} else {
-			/*
-			Expecting one of these cases:
-			Case 1. data byte(s) (running status without timestamp)
-			Case 2. timestamp byte + data byte(s) (running status with timestamp)
-			Case 3. timestamp byte + status byte + zero or more data bytes (complete
-			MIDI message with timestamp)
-			*/
-			uint8_t byte_0 = 0;
-			if (ble_midi_parser_read(&parser, &byte_0, 1)) {
-				return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-			}
-			if (is_data_byte(byte_0)) {
-				/* Case 1 - running status without timestamp byte.
-				Read the rest of the data bytes. */
-				uint8_t status_byte = parser.running_status_byte;
-				uint8_t message_bytes[3] = {status_byte, byte_0, 0};
-				uint8_t num_message_bytes = message_size(status_byte);
-				uint8_t num_additional_data_bytes = num_message_bytes - 2;
-				if (ble_midi_parser_read(&parser, &message_bytes[2],
-							 num_additional_data_bytes)) {
-					return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-				}
-				if (cb->midi_message_cb) {
-					cb->midi_message_cb(
-						message_bytes, num_message_bytes,
-						timestamp_ms(timestamp_high_bits,
-							     parser.prev_timestamp_byte));
-				}
-			} else {
-				/* Assume byte_0 is a timestamp byte. At least one byte should
-				 * follow. */
-				uint8_t byte_1 = 0;
-				if (parser.prev_timestamp_byte > byte_0) {
-					timestamp_high_bits = (timestamp_high_bits + 1) % 0x40;
-				}
-				parser.prev_timestamp_byte = byte_0;
-				if (ble_midi_parser_read(&parser, &byte_1, 1)) {
-					return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-				}
+	/* Hand over remaining messages, also the ones parsed before an error. */
+	flush_batch(parser);
 
-				if (is_data_byte(byte_1)) {
-					/* Case 2 - running status with timestamp */
-					uint8_t status_byte = parser.running_status_byte;
-					uint8_t message_bytes[3] = {status_byte, byte_1, 0};
-					uint8_t num_message_bytes = message_size(status_byte);
-					uint8_t num_additional_data_bytes = num_message_bytes - 2;
-					if (ble_midi_parser_read(&parser, &message_bytes[2],
-								 num_additional_data_bytes)) {
-						return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-					}
-					if (cb->midi_message_cb) {
-						cb->midi_message_cb(
-							message_bytes, num_message_bytes,
-							timestamp_ms(timestamp_high_bits, byte_0));
-					}
-				} else {
-					/* Case 3 - full midi message with timestamp */
-
-					/* byte_1 is the status byte of this message. update running
-					 * status */
-					if (is_channel_message(byte_1)) {
-						parser.running_status_byte = byte_1;
-					} else if (!is_realtime_message(byte_1) &&
-						   !is_system_common_message(byte_1)) {
-						parser.running_status_byte = 0;
-					}
-
-					if (byte_1 == 0xf0) {
-						/* Sysex start */
-						parser.in_sysex_msg = 1;
-						if (cb->sysex_start_cb) {
-							cb->sysex_start_cb(timestamp_ms(
-								timestamp_high_bits, byte_0));
-						}
-					} else {
-						/* Non-sysex message */
-						uint8_t msg_size = message_size(byte_1);
-						if (msg_size > 0) {
-							uint8_t num_data_bytes = msg_size - 1;
-							uint8_t message_bytes[3] = {byte_1, 0, 0};
-							if (ble_midi_parser_read(&parser,
-										 &message_bytes[1],
-										 num_data_bytes)) {
-								return BLE_MIDI_PACKET_ERROR_UNEXPECTED_END_OF_DATA;
-							}
-							if (cb->midi_message_cb) {
-								cb->midi_message_cb(
-									message_bytes,
-									1 + num_data_bytes,
-									timestamp_ms(
-										timestamp_high_bits,
-										byte_0));
-							}
-						} else {
-							return BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE;
-						}
-					}
-				}
-			}
-		}
+	if (result == BLE_MIDI_PACKET_SUCCESS) {
+		parser->sysex_state_known = 1;
+	} else {
+		/* Drop the rest of the packet and infer the sysex state from the
+		   contents of the next one. */
+		parser->num_errors++;
+		parser->in_sysex_msg = 0;
+		parser->sysex_state_known = 0;
 	}
 
-	return BLE_MIDI_PACKET_SUCCESS;
+	return result;
+}
+
+enum ble_midi_packet_error_t ble_midi_parse_packet(uint8_t *rx_buf, uint32_t rx_buf_size,
+					    struct ble_midi_parse_cb_t *cb)
+{
+	/* A parser instance that only lives for the duration of this packet. */
+	struct ble_midi_parser_t parser;
+	ble_midi_parser_init(&parser, cb);
+	return ble_midi_parser_feed(&parser, rx_buf, rx_buf_size);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define _BLE_MIDI_PACKET_H_
 
 #include <stdint.h>
+#include "rx_clock.h"
+#include "../include/ble_midi/ble_midi_types.h"
 
 enum ble_midi_packet_error_t {
 	BLE_MIDI_PACKET_SUCCESS = 0,
@@ -17,28 +19,141 @@ enum ble_midi_packet_error_t {
 	BLE_MIDI_PACKET_ERROR_INVALID_HEADER_BYTE = -10
 };
 
+/* Status byte classification flags, see ble_midi_status_info. */
+/* Mask for the message size in bytes, including the status byte. 0 for sysex and
+   undefined status bytes. */
+#define BLE_MIDI_STATUS_SIZE_MASK     0x03
+/* A channel message. Sets running status. */
+#define BLE_MIDI_STATUS_CHANNEL       0x04
+/* A system common message. Does not affect running status. */
+#define BLE_MIDI_STATUS_SYSTEM_COMMON 0x08
+/* A system real time message. Does not affect running status. */
+#define BLE_MIDI_STATUS_REALTIME      0x10
+/* Sysex start or end. Cancels running status. */
+#define BLE_MIDI_STATUS_SYSEX	      0x20
+/* Messages that do not cancel running status. */
+#define BLE_MIDI_STATUS_KEEPS_RUNNING_STATUS                                                        \
+	(BLE_MIDI_STATUS_SYSTEM_COMMON | BLE_MIDI_STATUS_REALTIME)
+
+/**
+ * Classification of all byte values, indexed by status byte. Each entry holds the
+ * message size and class flags above. Data bytes and undefined status bytes are 0.
+ * Shared by the packet writer and parser.
+ */
+extern const uint8_t ble_midi_status_info[256];
+
+/* Parser callbacks. user_data is the user_data of ble_midi_parse_cb_t. */
+
 /** Called when a non-sysex message has been parsed */
-typedef void (*ble_midi_message_cb_t)(uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp);
+typedef void (*ble_midi_parse_message_cb_t)(void *user_data, uint8_t *bytes, uint8_t num_bytes,
+					    uint16_t timestamp);
 /** Called when a sysex message starts */
-typedef void (*ble_midi_sysex_start_cb_t)(uint16_t timestamp);
+typedef void (*ble_midi_parse_sysex_start_cb_t)(void *user_data, uint16_t timestamp);
 /** Called when a sysex data byte has been received */
-typedef void (*ble_midi_sysex_data_cb_t)(uint8_t data_byte);
+typedef void (*ble_midi_parse_sysex_data_cb_t)(void *user_data, uint8_t data_byte);
 /** Called when a sysex message ends */
-typedef void (*ble_midi_sysex_end_cb_t)(uint16_t timestamp);
+typedef void (*ble_midi_parse_sysex_end_cb_t)(void *user_data, uint16_t timestamp);
+/**
+ * Called with a contiguous run of received sysex data bytes. data_bytes points
+ * into the packet being parsed and is only valid for the duration of the call.
+ */
+typedef void (*ble_midi_parse_sysex_data_span_cb_t)(void *user_data, const uint8_t *data_bytes,
+						    uint32_t num_data_bytes);
+
+/** Called with a batch of consecutive non-sysex messages */
+typedef void (*ble_midi_parse_message_batch_cb_t)(void *user_data,
+						  const struct ble_midi_message_t *msgs,
+						  uint32_t num_msgs);
 
 /**
  * BLE MIDI packet parsing callbacks.
  * A callback that is set to NULL is ignored.
  */
 struct ble_midi_parse_cb_t {
-	ble_midi_message_cb_t midi_message_cb;
-	ble_midi_sysex_data_cb_t sysex_data_cb;
-	ble_midi_sysex_start_cb_t sysex_start_cb;
-	ble_midi_sysex_end_cb_t sysex_end_cb;
+	ble_midi_parse_message_cb_t midi_message_cb;
+	ble_midi_parse_sysex_data_cb_t sysex_data_cb;
+	ble_midi_parse_sysex_start_cb_t sysex_start_cb;
+	ble_midi_parse_sysex_end_cb_t sysex_end_cb;
+	/* If set, sysex data bytes are passed to this callback in runs, one per contiguous
+	   sequence of data bytes in the packet, and sysex_data_cb is not called. */
+	ble_midi_parse_sysex_data_span_cb_t sysex_data_span_cb;
+	/* If set, non-sysex messages are collected in batch_buf and handed over
+	   in batches instead of being passed to midi_message_cb one by one.
+	   A batch is delivered when batch_buf is full, before any sysex callback
+	   and at the end of the packet, so the message order is preserved. */
+	ble_midi_parse_message_batch_cb_t midi_message_batch_cb;
+	/* Caller provided storage for batched messages. */
+	struct ble_midi_message_t *batch_buf;
+	/* The number of messages batch_buf can hold. */
+	uint32_t batch_buf_size;
+	/* Passed to the callbacks, e.g to give them the state of the caller. */
+	void *user_data;
+};
+
+/**
+ * Keeps track of the state when parsing BLE MIDI packets. The state is carried
+ * over from one packet to the next, so use one parser instance per connection.
+ */
+struct ble_midi_parser_t {
+	/* Callbacks for parsed data. */
+	struct ble_midi_parse_cb_t cb;
+	/* Non-zero if a sysex message is in progress, possibly started in a previous packet. */
+	uint8_t in_sysex_msg;
+	/* Non-zero if in_sysex_msg is known from previous packets. If zero, e.g after
+	   init/reset or a parse error, the sysex state is inferred from the next packet. */
+	uint8_t sysex_state_known;
+	/* Status byte used for running status. Reset at the start of each packet. */
+	uint8_t running_status_byte;
+	/* The most recent timestamp byte in the current packet. */
+	uint8_t prev_timestamp_byte;
+	/* The most recent 13 bit timestamp. */
+	uint16_t timestamp;
+	/* The number of packets that failed to parse. */
+	uint32_t num_errors;
+	/* The packet being parsed. */
+	const uint8_t *rx_buf;
+	uint32_t rx_buf_size;
+	/* The number of messages in cb.batch_buf not yet handed over. */
+	uint32_t batch_size;
+	/* Optional clock used to unwrap timestamps. */
+	struct rx_clock *clock;
+	/* Local receive time in ms of the packet being parsed. Used with clock. */
+	int64_t rx_time_ms;
+	/* The most recent timestamp unwrapped by clock. */
+	uint32_t sender_time;
 };
 
+/* Called once before using the parser. The callbacks are copied. */
+void ble_midi_parser_init(struct ble_midi_parser_t *parser, const struct ble_midi_parse_cb_t *cb);
+
+/* Forgets all state carried over between packets, e.g when a new connection is made. */
+void ble_midi_parser_reset(struct ble_midi_parser_t *parser);
+
+/**
+ * Sets a clock for unwrapping received timestamps into sender times, or NULL for none.
+ * The clock is reset along with the parser.
+ */
+void ble_midi_parser_set_clock(struct ble_midi_parser_t *parser, struct rx_clock *clock);
+
+/**
+ * Parses an entire BLE MIDI packet, picking up where the previous packet left off.
+ * If parsing fails, the rest of the packet is dropped and the parser resynchronizes
+ * on the next packet.
+ */
+enum ble_midi_packet_error_t ble_midi_parser_feed(struct ble_midi_parser_t *parser,
+						  const uint8_t *rx_buf, uint32_t rx_buf_size);
+
+/**
+ * Like ble_midi_parser_feed, but also unwraps the timestamps of the packet using the
+ * parser's clock, if any. rx_time_ms is the local time in ms the packet was received.
+ */
+enum ble_midi_packet_error_t ble_midi_parser_feed_at(struct ble_midi_parser_t *parser,
+						     const uint8_t *rx_buf, uint32_t rx_buf_size,
+						     int64_t rx_time_ms);
+
 /**
- * Parses an entire BLE MIDI packet.
+ * Parses an entire BLE MIDI packet without any state from previous packets.
+ * Non-sysex messages are handed over in batches if cb->midi_message_batch_cb is set.
  */
 enum ble_midi_packet_error_t ble_midi_parse_packet(uint8_t *rx_buf, uint32_t rx_buf_size,
 					    struct ble_midi_parse_cb_t *cb);
@@ -49,6 +164,22 @@ enum ble_midi_packet_error_t ble_midi_parse_packet(uint8_t *rx_buf, uint32_t rx_
 #define BLE_MIDI_TX_PACKET_MAX_SIZE 64
 #endif
 
+/* The writer's running status and note off settings may be fixed at build time by defining
+   BLE_MIDI_WRITER_RUNNING_STATUS and BLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON as 0 or 1. The
+   encoder is then specialized for those settings and the writer doesn't store them. */
+#ifdef CONFIG_BLE_MIDI_TX_SPECIALIZED_WRITER
+#ifdef CONFIG_BLE_MIDI_SEND_RUNNING_STATUS
+#define BLE_MIDI_WRITER_RUNNING_STATUS 1
+#else
+#define BLE_MIDI_WRITER_RUNNING_STATUS 0
+#endif
+#ifdef CONFIG_BLE_MIDI_SEND_NOTE_OFF_AS_NOTE_ON
+#define BLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON 1
+#else
+#define BLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON 0
+#endif
+#endif
+
 /**
  * Keeps track of the state when writing BLE MIDI packets.
  */
@@ -66,30 +197,94 @@ struct ble_midi_writer_t {
 	/* The timestamp of the previously added message. Used to determine if timestamp bytes
 	   should be added to running status messages. */
 	uint16_t prev_timestamp;
+	/* The latest timestamp the parser can reconstruct from the packet. Timestamps less than
+	   128 ms after this one can be appended, later ones need a new packet. */
+	uint16_t latest_timestamp;
 	/* Non-zero if sysex writing is in progress */
 	uint8_t in_sysex_msg;
+#ifndef BLE_MIDI_WRITER_RUNNING_STATUS
 	/* Indicates if running status should be used. */
-	int running_status_enabled;
+	uint8_t running_status_enabled;
+#endif
+#ifndef BLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON
 	/* Indicates if note off messages should be represented as zero velocity note on messages. */
-	int note_off_as_note_on;
+	uint8_t note_off_as_note_on;
+#endif
+};
+
+/**
+ * The part of the writer state that changes when data is appended. Since the writer only
+ * appends, restoring it removes everything appended after it was saved.
+ */
+struct ble_midi_writer_checkpoint_t {
+	uint16_t tx_buf_size;
+	uint16_t prev_timestamp;
+	uint16_t latest_timestamp;
+	uint8_t prev_status_byte;
+	uint8_t prev_running_status_byte;
+	uint8_t in_sysex_msg;
 };
 
-/* Called once before using the writer. */
+/* Called once before using the writer. running_status_enabled and note_off_as_note_on are
+   ignored if fixed at build time. */
 void ble_midi_writer_init(struct ble_midi_writer_t *writer, int running_status_enabled,
 			  int note_off_as_note_on);
 
 /* Called after finishing writing a packet. */
 void ble_midi_writer_reset(struct ble_midi_writer_t *writer);
 
+/* Saves the writer state, e.g before adding messages that must end up in the same packet. */
+void ble_midi_writer_checkpoint(const struct ble_midi_writer_t *writer,
+				struct ble_midi_writer_checkpoint_t *checkpoint);
+
+/* Removes everything appended since the checkpoint was saved. */
+void ble_midi_writer_rollback(struct ble_midi_writer_t *writer,
+			      const struct ble_midi_writer_checkpoint_t *checkpoint);
+
+/* The add functions below return BLE_MIDI_PACKET_ERROR_PACKET_FULL if the packet is out of
+   space, or if the timestamp is 128 ms or more after the latest timestamp in the packet. In
+   both cases, the message should be added to a new packet. */
+
 /* Append a non-sysex MIDI message. */
 enum ble_midi_packet_error_t ble_midi_writer_add_msg(struct ble_midi_writer_t *writer,
 					      uint8_t *bytes,	 /* 3 bytes, zero padded */
 					      uint16_t timestamp /* 13 bit, wrapped ms timestamp */
 );
 
-/* Append an entire sysex MIDI message. Fails if the message does not fit into the packet. */
+/* Append non-sysex MIDI messages sharing a timestamp, e.g. the notes of a chord. Checks for room
+   once for the whole run instead of once per message. Returns the number of messages added, which
+   is less than num_msgs if the packet filled up, or a negative error code if a message is invalid,
+   in which case no messages are added. */
+int ble_midi_writer_add_msgs(struct ble_midi_writer_t *writer,
+			     const uint8_t (*msgs)[3], /* 3 bytes each, zero padded */
+			     uint32_t num_msgs, uint16_t timestamp);
+
+/* The maximum number of messages ble_midi_writer_add_msgs_reordered handles per call. */
+#define BLE_MIDI_WRITER_REORDER_MAX_MSGS 16
+
+/* Like ble_midi_writer_add_msgs, but first reorders the messages so that messages with the same
+   status byte follow each other, which saves the timestamp and status bytes of running status
+   messages. The order of messages on each channel and the position of system messages are kept.
+   The messages added are always the first ones in msgs, at most
+   BLE_MIDI_WRITER_REORDER_MAX_MSGS. num_bytes_saved is set to the number of bytes saved compared
+   to adding the messages in the original order. */
+int ble_midi_writer_add_msgs_reordered(struct ble_midi_writer_t *writer,
+				       const uint8_t (*msgs)[3], /* 3 bytes each, zero padded */
+				       uint32_t num_msgs, uint16_t timestamp,
+				       uint32_t *num_bytes_saved);
+
+/* The number of bytes that adding a message would append to the packet, following the same
+   packet header, running status and timestamp rules as the add functions. bytes holds a zero
+   padded non-sysex message, or 0xf0/0xf7 for sysex start/end. Returns
+   BLE_MIDI_PACKET_ERROR_PACKET_FULL if the timestamp can't be represented in the packet, or
+   another negative error code if the message can't be added. */
+int ble_midi_writer_bytes_needed(const struct ble_midi_writer_t *writer, const uint8_t *bytes,
+				 uint16_t timestamp);
+
+/* Append an entire sysex MIDI message, starting with 0xf0 and ending with 0xf7, sharing the
+   packet with other messages. Fails if the message does not fit into the packet. */
 enum ble_midi_packet_error_t ble_midi_writer_add_sysex_msg(struct ble_midi_writer_t *writer,
-						    uint8_t *bytes, uint32_t num_bytes,
+						    const uint8_t *bytes, uint32_t num_bytes,
 						    uint16_t timestamp);
 
 /* Start a sysex message, possibly spanning multiple messages. */
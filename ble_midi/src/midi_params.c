@@ -0,0 +1,186 @@
+#include "midi_params.h"
+
+/* Controller numbers */
+#define CC_DATA_ENTRY_MSB 6
+#define CC_DATA_ENTRY_LSB 38
+#define CC_NRPN_LSB	  98
+#define CC_NRPN_MSB	  99
+#define CC_RPN_LSB	  100
+#define CC_RPN_MSB	  101
+
+/* The RPN number that deselects the current parameter. */
+#define RPN_NULL 0x3fff
+
+static void set_cc(uint8_t *msg, uint8_t status, uint8_t controller, uint8_t value)
+{
+	msg[0] = status;
+	msg[1] = controller;
+	msg[2] = value;
+}
+
+int midi_params_encode(enum ble_midi_param_type_t type, uint8_t channel, uint16_t number,
+		       uint16_t value, uint8_t (*msgs)[3])
+{
+	if (channel > 15 || value > 0x3fff) {
+		return 0;
+	}
+	uint8_t status = 0xb0 | channel;
+
+	if (type == BLE_MIDI_PARAM_CC14) {
+		if (number > 31) {
+			return 0;
+		}
+		set_cc(msgs[0], status, number, value >> 7);
+		set_cc(msgs[1], status, number + 32, value & 0x7f);
+		return 2;
+	}
+
+	if (number > 0x3fff || (type == BLE_MIDI_PARAM_RPN && number == RPN_NULL)) {
+		return 0;
+	}
+	int is_rpn = type == BLE_MIDI_PARAM_RPN;
+	if (!is_rpn && type != BLE_MIDI_PARAM_NRPN) {
+		return 0;
+	}
+	set_cc(msgs[0], status, is_rpn ? CC_RPN_MSB : CC_NRPN_MSB, number >> 7);
+	set_cc(msgs[1], status, is_rpn ? CC_RPN_LSB : CC_NRPN_LSB, number & 0x7f);
+	set_cc(msgs[2], status, CC_DATA_ENTRY_MSB, value >> 7);
+	set_cc(msgs[3], status, CC_DATA_ENTRY_LSB, value & 0x7f);
+	return 4;
+}
+
+void midi_params_aggregator_init(struct midi_params_aggregator *aggregator,
+				 midi_params_cb_t param_cb, int cc14)
+{
+	aggregator->param_cb = param_cb;
+	aggregator->cc14 = cc14;
+	midi_params_aggregator_reset(aggregator);
+}
+
+void midi_params_aggregator_reset(struct midi_params_aggregator *aggregator)
+{
+	for (int i = 0; i < 16; i++) {
+		aggregator->channels[i].type = MIDI_PARAMS_NONE;
+		aggregator->channels[i].data_msb = 0;
+		aggregator->channels[i].number = 0;
+	}
+	aggregator->has_pending = 0;
+}
+
+void midi_params_aggregator_flush(struct midi_params_aggregator *aggregator)
+{
+	if (aggregator->has_pending) {
+		aggregator->has_pending = 0;
+		aggregator->param_cb(&aggregator->pending);
+	}
+}
+
+static void set_param(struct ble_midi_param_t *param, uint8_t type, uint8_t channel,
+		      uint16_t number, uint16_t value, const struct ble_midi_message_t *msg)
+{
+	param->type = type;
+	param->channel = channel;
+	param->number = number;
+	param->value = value;
+	param->timestamp = msg->timestamp;
+	param->sender_time = msg->sender_time;
+}
+
+/* Holds an MSB until the matching LSB or the next message arrives. */
+static void hold_msb(struct midi_params_aggregator *aggregator, uint8_t type, uint8_t channel,
+		     uint16_t number, uint8_t msb, const struct ble_midi_message_t *msg)
+{
+	midi_params_aggregator_flush(aggregator);
+	set_param(&aggregator->pending, type, channel, number, msb << 7, msg);
+	aggregator->has_pending = 1;
+}
+
+/* Reports a parameter change completed by an LSB, replacing any pending MSB it belongs to. */
+static void complete_lsb(struct midi_params_aggregator *aggregator, uint8_t type, uint8_t channel,
+			 uint16_t number, uint8_t msb, uint8_t lsb,
+			 const struct ble_midi_message_t *msg)
+{
+	struct ble_midi_param_t *pending = &aggregator->pending;
+	if (aggregator->has_pending && pending->type == type && pending->channel == channel &&
+	    pending->number == number) {
+		aggregator->has_pending = 0;
+	}
+	midi_params_aggregator_flush(aggregator);
+	struct ble_midi_param_t param;
+	set_param(&param, type, channel, number, (msb << 7) | lsb, msg);
+	aggregator->param_cb(&param);
+}
+
+static void select_param(struct midi_params_channel *channel, uint8_t type, uint8_t value,
+			 int is_msb)
+{
+	if (channel->type != type) {
+		channel->type = type;
+		channel->number = 0;
+	}
+	if (is_msb) {
+		channel->number = (value << 7) | (channel->number & 0x7f);
+	} else {
+		channel->number = (channel->number & 0x3f80) | value;
+	}
+	if (type == BLE_MIDI_PARAM_RPN && channel->number == RPN_NULL) {
+		channel->type = MIDI_PARAMS_NONE;
+	}
+}
+
+int midi_params_aggregator_add(struct midi_params_aggregator *aggregator,
+			       const struct ble_midi_message_t *msg)
+{
+	if ((msg->bytes[0] & 0xf0) != 0xb0) {
+		midi_params_aggregator_flush(aggregator);
+		return 0;
+	}
+	uint8_t channel_idx = msg->bytes[0] & 0x0f;
+	uint8_t controller = msg->bytes[1];
+	uint8_t value = msg->bytes[2];
+	struct midi_params_channel *channel = &aggregator->channels[channel_idx];
+
+	switch (controller) {
+	case CC_NRPN_MSB:
+	case CC_NRPN_LSB:
+	case CC_RPN_MSB:
+	case CC_RPN_LSB: {
+		midi_params_aggregator_flush(aggregator);
+		int is_rpn = controller == CC_RPN_MSB || controller == CC_RPN_LSB;
+		int is_msb = controller == CC_RPN_MSB || controller == CC_NRPN_MSB;
+		select_param(channel, is_rpn ? BLE_MIDI_PARAM_RPN : BLE_MIDI_PARAM_NRPN, value,
+			     is_msb);
+		return 1;
+	}
+	case CC_DATA_ENTRY_MSB:
+		if (channel->type != MIDI_PARAMS_NONE) {
+			channel->data_msb = value;
+			hold_msb(aggregator, channel->type, channel_idx, channel->number, value, msg);
+			return 1;
+		}
+		break;
+	case CC_DATA_ENTRY_LSB:
+		if (channel->type != MIDI_PARAMS_NONE) {
+			complete_lsb(aggregator, channel->type, channel_idx, channel->number,
+				     channel->data_msb, value, msg);
+			return 1;
+		}
+		break;
+	}
+
+	if (aggregator->cc14 && controller < 32) {
+		hold_msb(aggregator, BLE_MIDI_PARAM_CC14, channel_idx, controller, value, msg);
+		return 1;
+	}
+	struct ble_midi_param_t *pending = &aggregator->pending;
+	if (aggregator->cc14 && controller < 64 && aggregator->has_pending &&
+	    pending->type == BLE_MIDI_PARAM_CC14 && pending->channel == channel_idx &&
+	    pending->number == controller - 32) {
+		complete_lsb(aggregator, BLE_MIDI_PARAM_CC14, channel_idx, controller - 32,
+			     pending->value >> 7, value, msg);
+		return 1;
+	}
+
+	midi_params_aggregator_flush(aggregator);
+	return 0;
+}
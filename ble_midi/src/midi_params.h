@@ -0,0 +1,68 @@
+#ifndef BLE_MIDI_MIDI_PARAMS_H
+#define BLE_MIDI_MIDI_PARAMS_H
+
+#include <stdint.h>
+#include "ble_midi_packet.h"
+#include "../include/ble_midi/ble_midi_types.h"
+
+/* The largest number of messages making up a parameter change. */
+#define MIDI_PARAMS_MAX_MSGS 4
+
+/** Called with an aggregated parameter change. */
+typedef void (*midi_params_cb_t)(const struct ble_midi_param_t *param);
+
+/**
+ * Encodes a parameter change as the control change messages sending it. All messages
+ * have the same status byte, so with running status they take up one status byte
+ * followed by data byte pairs. The selected RPN/NRPN is not reset afterwards.
+ * Returns the number of messages written to msgs, or 0 if an argument is out of range.
+ */
+int midi_params_encode(enum ble_midi_param_type_t type, uint8_t channel, uint16_t number,
+		       uint16_t value, uint8_t (*msgs)[3]);
+
+/* The parameter selected on a channel with controllers 99/98 or 101/100. */
+struct midi_params_channel {
+	/* A ble_midi_param_type_t value or MIDI_PARAMS_NONE if no parameter is selected. */
+	uint8_t type;
+	/* The most recent data entry MSB, combined with a lone data entry LSB. */
+	uint8_t data_msb;
+	uint16_t number;
+};
+
+#define MIDI_PARAMS_NONE 0xff
+
+/**
+ * Aggregates received control change sequences into parameter changes. RPN/NRPN select
+ * and data entry controllers are consumed. So are 14 bit controller pairs, if enabled.
+ * A data entry or controller MSB is held until the matching LSB arrives. If another
+ * message arrives first, or the packet ends, the MSB is reported on its own.
+ * Not thread safe.
+ */
+struct midi_params_aggregator {
+	midi_params_cb_t param_cb;
+	/* Non-zero if controllers 0-31 and 32-63 should be paired. */
+	int cc14;
+	struct midi_params_channel channels[16];
+	/* Non-zero if pending holds an MSB waiting for its LSB. */
+	int has_pending;
+	struct ble_midi_param_t pending;
+};
+
+void midi_params_aggregator_init(struct midi_params_aggregator *aggregator,
+				 midi_params_cb_t param_cb, int cc14);
+
+/* Forgets all selected parameters and any pending MSB, e.g when a new connection is made. */
+void midi_params_aggregator_reset(struct midi_params_aggregator *aggregator);
+
+/**
+ * Passes a received message to the aggregator. A pending MSB the message does not complete
+ * is reported first. Returns non-zero if the message was consumed, otherwise the caller
+ * should handle it as usual.
+ */
+int midi_params_aggregator_add(struct midi_params_aggregator *aggregator,
+			       const struct ble_midi_message_t *msg);
+
+/* Reports a pending MSB, if any. Call at the end of each received packet. */
+void midi_params_aggregator_flush(struct midi_params_aggregator *aggregator);
+
+#endif // BLE_MIDI_MIDI_PARAMS_H
@@ -0,0 +1,101 @@
+#include "midi_stream.h"
+#include "ble_midi_packet.h"
+
+void midi_stream_init(struct midi_stream *stream)
+{
+	stream->running_status_byte = 0;
+	stream->num_msg_bytes = 0;
+	stream->msg_size = 0;
+	stream->in_sysex_msg = 0;
+}
+
+static void set_msg_event(struct midi_stream_event *event, const uint8_t *msg)
+{
+	event->type = MIDI_STREAM_MSG;
+	event->msg[0] = msg[0];
+	event->msg[1] = msg[1];
+	event->msg[2] = msg[2];
+}
+
+/* Starts receiving a message with the given status byte. Returns non-zero if the message
+   is already complete, i.e consists of the status byte only. */
+static int start_msg(struct midi_stream *stream, uint8_t status_byte)
+{
+	stream->msg[0] = status_byte;
+	stream->msg[1] = 0;
+	stream->msg[2] = 0;
+	stream->num_msg_bytes = 1;
+	stream->msg_size = ble_midi_status_info[status_byte] & BLE_MIDI_STATUS_SIZE_MASK;
+	return stream->msg_size == 1;
+}
+
+uint32_t midi_stream_next(struct midi_stream *stream, const uint8_t *bytes, uint32_t num_bytes,
+			  struct midi_stream_event *event)
+{
+	event->type = MIDI_STREAM_NONE;
+	for (uint32_t i = 0; i < num_bytes; i++) {
+		uint8_t byte = bytes[i];
+		uint8_t info = ble_midi_status_info[byte];
+
+		/* Real time messages may appear anywhere and leave the state untouched. */
+		if (byte >= 0xf8) {
+			if (info & BLE_MIDI_STATUS_REALTIME) {
+				const uint8_t msg[3] = {byte, 0, 0};
+				set_msg_event(event, msg);
+				return i + 1;
+			}
+			continue;
+		}
+
+		if (stream->in_sysex_msg) {
+			if (byte < 0x80) {
+				uint32_t end = i + 1;
+				while (end < num_bytes && bytes[end] < 0x80) {
+					end++;
+				}
+				event->type = MIDI_STREAM_SYSEX_DATA;
+				event->data = &bytes[i];
+				event->num_data_bytes = end - i;
+				return end;
+			}
+			/* Any other status byte ends the sysex message. */
+			stream->in_sysex_msg = 0;
+			event->type = MIDI_STREAM_SYSEX_END;
+			return byte == 0xf7 ? i + 1 : i;
+		}
+
+		if (byte >= 0x80) {
+			stream->num_msg_bytes = 0;
+			stream->running_status_byte = (info & BLE_MIDI_STATUS_CHANNEL) ? byte : 0;
+			if (byte == 0xf0) {
+				stream->in_sysex_msg = 1;
+				event->type = MIDI_STREAM_SYSEX_START;
+				return i + 1;
+			}
+			if ((info & BLE_MIDI_STATUS_SIZE_MASK) == 0) {
+				/* A stray sysex end or an undefined status byte */
+				continue;
+			}
+			if (start_msg(stream, byte)) {
+				stream->num_msg_bytes = 0;
+				set_msg_event(event, stream->msg);
+				return i + 1;
+			}
+			continue;
+		}
+
+		if (stream->num_msg_bytes == 0) {
+			if (!stream->running_status_byte) {
+				continue;
+			}
+			start_msg(stream, stream->running_status_byte);
+		}
+		stream->msg[stream->num_msg_bytes++] = byte;
+		if (stream->num_msg_bytes == stream->msg_size) {
+			stream->num_msg_bytes = 0;
+			set_msg_event(event, stream->msg);
+			return i + 1;
+		}
+	}
+	return num_bytes;
+}
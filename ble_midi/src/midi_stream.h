@@ -0,0 +1,58 @@
+#ifndef BLE_MIDI_MIDI_STREAM_H
+#define BLE_MIDI_MIDI_STREAM_H
+
+#include <stdint.h>
+
+enum midi_stream_event_type {
+	/* The input ended without completing an event. */
+	MIDI_STREAM_NONE = 0,
+	/* A complete non-sysex message in msg. */
+	MIDI_STREAM_MSG,
+	MIDI_STREAM_SYSEX_START,
+	/* A run of sysex data bytes, see data and num_data_bytes. */
+	MIDI_STREAM_SYSEX_DATA,
+	/* The end of a sysex message, either an 0xf7 byte or a status byte that implicitly
+	   ends the message. In the latter case, the status byte is not consumed. */
+	MIDI_STREAM_SYSEX_END
+};
+
+struct midi_stream_event {
+	/* A midi_stream_event_type value. */
+	uint8_t type;
+	/* Status byte followed by zero, one or two data bytes. Unused bytes are zero. */
+	uint8_t msg[3];
+	/* Sysex data bytes. Points into the input passed to midi_stream_next. */
+	const uint8_t *data;
+	uint32_t num_data_bytes;
+};
+
+/**
+ * Splits a MIDI 1.0 byte stream, e.g from a DIN/UART input, into messages and sysex
+ * events. Handles running status, system real time messages interleaved with other
+ * messages, including sysex data, and messages split across calls. Data bytes without
+ * a status byte and undefined status bytes are dropped. The state is small and can be
+ * copied to resume parsing from an earlier point.
+ */
+struct midi_stream {
+	/* The status byte data bytes without a status byte are added to, or 0 if none. */
+	uint8_t running_status_byte;
+	/* The message being received and its number of bytes so far. */
+	uint8_t msg[3];
+	uint8_t num_msg_bytes;
+	/* The number of bytes of the message being received. */
+	uint8_t msg_size;
+	/* Non-zero if a sysex message is being received. */
+	uint8_t in_sysex_msg;
+};
+
+void midi_stream_init(struct midi_stream *stream);
+
+/**
+ * Parses bytes until an event is complete or the input ends, whichever comes first.
+ * Returns the number of bytes consumed. Call again with the rest of the input to get
+ * the next event.
+ */
+uint32_t midi_stream_next(struct midi_stream *stream, const uint8_t *bytes, uint32_t num_bytes,
+			  struct midi_stream_event *event);
+
+#endif // BLE_MIDI_MIDI_STREAM_H
@@ -0,0 +1,145 @@
+#include "rx_clock.h"
+
+/* 13 bit BLE MIDI timestamps wrap every 8192 ms */
+#define TIMESTAMP_PERIOD_MS 0x2000
+
+/* The offset is stored in 1/256 ms */
+#define OFFSET_SCALE 256
+
+/* When the observed offset is above the estimate, e.g due to connection interval
+   jitter, the estimate only moves 1/2^OFFSET_RISE_SHIFT of the way towards it. */
+#define OFFSET_RISE_SHIFT 8
+
+void rx_clock_init(struct rx_clock *clock)
+{
+	rx_clock_reset(clock);
+}
+
+void rx_clock_reset(struct rx_clock *clock)
+{
+	clock->is_synced = 0;
+	clock->sender_time_ms = 0;
+	clock->local_time_ms = 0;
+	clock->offset = 0;
+	clock->drift_ppm = 0;
+	clock->num_drift_windows = 0;
+	clock->drift_window_start_ms = 0;
+	clock->drift_window_min_offset = 0;
+	clock->has_prev_drift_window = 0;
+	clock->prev_drift_window_min_offset = 0;
+}
+
+/* The offset accumulated by drift over a period of local or sender time. */
+static int64_t drift_offset(int32_t drift_ppm, int64_t duration_ms)
+{
+	return duration_ms * OFFSET_SCALE * drift_ppm / 1000000;
+}
+
+static void start_drift_window(struct rx_clock *clock, int64_t observed_offset)
+{
+	clock->drift_window_start_ms = clock->local_time_ms;
+	clock->drift_window_min_offset = observed_offset;
+}
+
+/**
+ * Measures drift as the change of the smallest observed offset between consecutive
+ * windows. The smallest offset is that of the packet with the least latency, which
+ * is much less noisy than the offset of any single packet.
+ */
+static void update_drift(struct rx_clock *clock, int64_t observed_offset, int64_t gap_ms)
+{
+	if (gap_ms >= RX_CLOCK_DRIFT_WINDOW_MS) {
+		/* Too little data to compare windows across the gap. */
+		clock->has_prev_drift_window = 0;
+		start_drift_window(clock, observed_offset);
+		return;
+	}
+
+	if (observed_offset < clock->drift_window_min_offset) {
+		clock->drift_window_min_offset = observed_offset;
+	}
+
+	int64_t window_ms = clock->local_time_ms - clock->drift_window_start_ms;
+	if (window_ms < RX_CLOCK_DRIFT_WINDOW_MS) {
+		return;
+	}
+
+	if (clock->has_prev_drift_window) {
+		int64_t measured_ppm =
+			(clock->drift_window_min_offset - clock->prev_drift_window_min_offset) *
+			1000000 / (window_ms * OFFSET_SCALE);
+		if (measured_ppm >= -RX_CLOCK_MAX_DRIFT_PPM &&
+		    measured_ppm <= RX_CLOCK_MAX_DRIFT_PPM) {
+			if (clock->num_drift_windows == 0) {
+				clock->drift_ppm = measured_ppm;
+			} else {
+				/* Smooth out measurement noise */
+				clock->drift_ppm += (measured_ppm - clock->drift_ppm) / 4;
+			}
+			clock->num_drift_windows++;
+		}
+	}
+
+	clock->has_prev_drift_window = 1;
+	clock->prev_drift_window_min_offset = clock->drift_window_min_offset;
+	start_drift_window(clock, observed_offset);
+}
+
+uint32_t rx_clock_update(struct rx_clock *clock, uint16_t timestamp, int64_t local_time_ms)
+{
+	timestamp &= TIMESTAMP_PERIOD_MS - 1;
+
+	if (!clock->is_synced) {
+		clock->is_synced = 1;
+		clock->sender_time_ms = timestamp;
+		clock->local_time_ms = local_time_ms;
+		clock->offset = (local_time_ms - timestamp) * OFFSET_SCALE;
+		start_drift_window(clock, clock->offset);
+		return timestamp;
+	}
+
+	/* Predict the current sender time from the local time. Anchoring to the local
+	   clock keeps the unwrapping right across gaps longer than the timestamp period. */
+	int64_t offset = clock->offset +
+			 drift_offset(clock->drift_ppm, local_time_ms - clock->local_time_ms);
+	int64_t predicted_sender_time = local_time_ms - offset / OFFSET_SCALE;
+
+	/* Pick the sender time closest to the prediction that matches the timestamp. */
+	int32_t delta = (timestamp - predicted_sender_time) & (TIMESTAMP_PERIOD_MS - 1);
+	if (delta >= TIMESTAMP_PERIOD_MS / 2) {
+		delta -= TIMESTAMP_PERIOD_MS;
+	}
+	int64_t sender_time = predicted_sender_time + delta;
+
+	/* Timestamps from a sender never go backwards. */
+	if (sender_time < clock->sender_time_ms) {
+		sender_time = clock->sender_time_ms;
+	}
+
+	/* Track the lower envelope of local time minus sender time. Packets that
+	   arrive with more latency than the estimate only nudge it upwards. */
+	int64_t observed_offset = (local_time_ms - sender_time) * OFFSET_SCALE;
+	if (observed_offset < offset) {
+		offset = observed_offset;
+	} else {
+		offset += (observed_offset - offset) >> OFFSET_RISE_SHIFT;
+	}
+
+	int64_t gap_ms = local_time_ms - clock->local_time_ms;
+	clock->sender_time_ms = sender_time;
+	clock->local_time_ms = local_time_ms;
+	clock->offset = offset;
+	update_drift(clock, observed_offset, gap_ms);
+
+	return (uint32_t)sender_time;
+}
+
+int64_t rx_clock_local_time_ms(const struct rx_clock *clock, uint32_t sender_time)
+{
+	/* Extend sender_time to 64 bits around the most recent sender time. */
+	int64_t sender_time_ms =
+		clock->sender_time_ms + (int32_t)(sender_time - (uint32_t)clock->sender_time_ms);
+	int64_t offset = clock->offset +
+			 drift_offset(clock->drift_ppm, sender_time_ms - clock->sender_time_ms);
+	return sender_time_ms + offset / OFFSET_SCALE;
+}
@@ -0,0 +1,63 @@
+#ifndef BLE_MIDI_RX_CLOCK_H
+#define BLE_MIDI_RX_CLOCK_H
+
+#include <stdint.h>
+
+/* Measure drift over windows of this many ms of local time. */
+#define RX_CLOCK_DRIFT_WINDOW_MS 10000
+/* Drift measurements larger than this are ignored. */
+#define RX_CLOCK_MAX_DRIFT_PPM 1000
+
+/**
+ * Unwraps the 13 bit ms timestamps of received BLE MIDI packets into monotonic
+ * sender times, anchored to the local clock, and estimates the offset and drift
+ * of the sender clock relative to the local clock. Use one instance per connection.
+ *
+ * The offset is the smallest observed difference between local receive time and
+ * sender time, i.e sender clock offset plus minimum transport latency.
+ */
+struct rx_clock {
+	/* Non-zero once the first timestamp has been received. */
+	int is_synced;
+	/* The most recent unwrapped sender time in ms. */
+	int64_t sender_time_ms;
+	/* The local receive time in ms of the most recent timestamp. */
+	int64_t local_time_ms;
+	/* Estimated local time minus sender time, in 1/256 ms. */
+	int64_t offset;
+	/* Estimated rate of change of the offset in ppm. Positive if the sender
+	   clock runs slower than the local clock. */
+	int32_t drift_ppm;
+	/* The number of drift measurements made. */
+	uint32_t num_drift_windows;
+	/* Local time at the start of the current drift measurement window. */
+	int64_t drift_window_start_ms;
+	/* The smallest offset observed in the current drift measurement window. */
+	int64_t drift_window_min_offset;
+	/* Non-zero if the previous window can be compared to the current one. */
+	int has_prev_drift_window;
+	/* The smallest offset observed in the previous drift measurement window. */
+	int64_t prev_drift_window_min_offset;
+};
+
+void rx_clock_init(struct rx_clock *clock);
+
+/* Forgets all timing state, e.g when a new connection is made. */
+void rx_clock_reset(struct rx_clock *clock);
+
+/**
+ * Unwraps a received 13 bit timestamp and updates the offset and drift estimates.
+ * local_time_ms is the local time at which the timestamp was received. Returns the
+ * unwrapped sender time in ms, which wraps after about 49 days.
+ */
+uint32_t rx_clock_update(struct rx_clock *clock, uint16_t timestamp, int64_t local_time_ms);
+
+/**
+ * Returns the estimated local time in ms corresponding to an unwrapped sender time,
+ * including the minimum transport latency. Add a fixed latency budget to this to
+ * schedule playback with constant latency. sender_time must be within about 24 days
+ * of the most recent sender time.
+ */
+int64_t rx_clock_local_time_ms(const struct rx_clock *clock, uint32_t sender_time);
+
+#endif // BLE_MIDI_RX_CLOCK_H
@@ -0,0 +1,86 @@
+#include "rx_playout.h"
+
+static int entry_idx(int idx)
+{
+	return idx >= RX_PLAYOUT_QUEUE_SIZE ? idx - RX_PLAYOUT_QUEUE_SIZE : idx;
+}
+
+void rx_playout_init(struct rx_playout *playout)
+{
+	rx_playout_reset(playout);
+}
+
+void rx_playout_reset(struct rx_playout *playout)
+{
+	playout->first_entry_idx = 0;
+	playout->num_entries = 0;
+	playout->stats.num_released = 0;
+	playout->stats.num_late = 0;
+	playout->stats.max_late_ms = 0;
+	playout->stats.num_overflows = 0;
+}
+
+enum rx_playout_error rx_playout_add(struct rx_playout *playout,
+				     const struct ble_midi_message_t *msg, int64_t due_ms,
+				     int64_t now_ms)
+{
+	if (playout->num_entries == RX_PLAYOUT_QUEUE_SIZE) {
+		playout->stats.num_overflows++;
+		return RX_PLAYOUT_QUEUE_FULL;
+	}
+
+	/* Shift entries due later than this one towards the end, starting from the
+	   last one. Usually there are none. */
+	int pos = playout->num_entries;
+	while (pos > 0) {
+		struct rx_playout_entry *prev =
+			&playout->entries[entry_idx(playout->first_entry_idx + pos - 1)];
+		if (prev->due_ms <= due_ms) {
+			break;
+		}
+		playout->entries[entry_idx(playout->first_entry_idx + pos)] = *prev;
+		pos--;
+	}
+
+	struct rx_playout_entry *entry = &playout->entries[entry_idx(playout->first_entry_idx + pos)];
+	entry->msg = *msg;
+	entry->due_ms = due_ms;
+	playout->num_entries++;
+
+	if (due_ms < now_ms) {
+		uint32_t late_ms = now_ms - due_ms;
+		playout->stats.num_late++;
+		if (late_ms > playout->stats.max_late_ms) {
+			playout->stats.max_late_ms = late_ms;
+		}
+		return RX_PLAYOUT_LATE;
+	}
+
+	return RX_PLAYOUT_SUCCESS;
+}
+
+int rx_playout_pop_due(struct rx_playout *playout, int64_t now_ms, struct ble_midi_message_t *msg)
+{
+	if (playout->num_entries == 0) {
+		return 0;
+	}
+	struct rx_playout_entry *entry = &playout->entries[playout->first_entry_idx];
+	if (entry->due_ms > now_ms) {
+		return 0;
+	}
+
+	*msg = entry->msg;
+	playout->first_entry_idx = entry_idx(playout->first_entry_idx + 1);
+	playout->num_entries--;
+	playout->stats.num_released++;
+	return 1;
+}
+
+int rx_playout_next_due_ms(const struct rx_playout *playout, int64_t *due_ms)
+{
+	if (playout->num_entries == 0) {
+		return 0;
+	}
+	*due_ms = playout->entries[playout->first_entry_idx].due_ms;
+	return 1;
+}
@@ -0,0 +1,77 @@
+#ifndef BLE_MIDI_RX_PLAYOUT_H
+#define BLE_MIDI_RX_PLAYOUT_H
+
+#include <stdint.h>
+#include "ble_midi_packet.h"
+
+#ifdef CONFIG_BLE_MIDI_RX_PLAYOUT_QUEUE_SIZE
+#define RX_PLAYOUT_QUEUE_SIZE CONFIG_BLE_MIDI_RX_PLAYOUT_QUEUE_SIZE
+#else
+#define RX_PLAYOUT_QUEUE_SIZE 64
+#endif
+
+enum rx_playout_error {
+	RX_PLAYOUT_SUCCESS = 0,
+	/* The message was due before it was added. It is queued anyway, for immediate release. */
+	RX_PLAYOUT_LATE = -1,
+	/* The queue is full. The message was not added. */
+	RX_PLAYOUT_QUEUE_FULL = -2
+};
+
+struct rx_playout_stats {
+	/* The number of messages released. */
+	uint32_t num_released;
+	/* The number of messages that arrived after their playout time. */
+	uint32_t num_late;
+	/* The largest amount of ms a message arrived after its playout time. */
+	uint32_t max_late_ms;
+	/* The number of messages that did not fit in the queue. */
+	uint32_t num_overflows;
+};
+
+struct rx_playout_entry {
+	struct ble_midi_message_t msg;
+	/* Local time in ms at which to release the message */
+	int64_t due_ms;
+};
+
+/**
+ * Holds received messages until their playout time, trading a fixed latency for
+ * removing the jitter caused by BLE connection events. Entries are kept in a ring
+ * ordered by playout time. Messages with the same playout time are released in the
+ * order they were added. Not thread safe.
+ */
+struct rx_playout {
+	struct rx_playout_entry entries[RX_PLAYOUT_QUEUE_SIZE];
+	/* Index of the entry with the earliest playout time. */
+	int first_entry_idx;
+	int num_entries;
+	struct rx_playout_stats stats;
+};
+
+void rx_playout_init(struct rx_playout *playout);
+
+/* Drops all queued messages and clears the stats. */
+void rx_playout_reset(struct rx_playout *playout);
+
+/**
+ * Queues a message for release at local time due_ms. now_ms is the current local time.
+ * Messages arrive roughly in playout order, so this is usually O(1).
+ */
+enum rx_playout_error rx_playout_add(struct rx_playout *playout,
+				     const struct ble_midi_message_t *msg, int64_t due_ms,
+				     int64_t now_ms);
+
+/**
+ * Removes the earliest queued message and copies it to msg if it is due at now_ms.
+ * Returns non-zero if a message was removed.
+ */
+int rx_playout_pop_due(struct rx_playout *playout, int64_t now_ms, struct ble_midi_message_t *msg);
+
+/**
+ * Gets the playout time of the earliest queued message. Returns zero if the queue
+ * is empty, otherwise non-zero.
+ */
+int rx_playout_next_due_ms(const struct rx_playout *playout, int64_t *due_ms);
+
+#endif // BLE_MIDI_RX_PLAYOUT_H
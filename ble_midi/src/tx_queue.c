@@ -1,5 +1,10 @@
+#include <string.h>
 #include "tx_queue.h"
 
+// Messages are stored in the FIFO without padding, taking up as many bytes as their status
+// byte implies, e.g one byte for a timing clock and two for a program change. Sysex start
+// and end take up one byte. Other chunks start with an ID < 128.
+
 #define TX_MAX_PACKET_SIZE_CHUNK_ID 0x0c
 // [0] - max packet size chunk ID 
 // [1] - max packet size, LSB
@@ -21,10 +26,247 @@
 // The maximum size of a chunk of sysex data bytes in the FIFO. 
 #define SYSEX_DATA_CHUNK_MAX_SIZE (SYSEX_DATA_CHUNK_HEADER_SIZE + SYSEX_DATA_CHUNK_MAX_BYTE_COUNT)
 
+// Indicates the start of a complete sysex message in the FIFO. Must be < 128, like the
+// sysex data chunk ID.
+#define SYSEX_MSG_CHUNK_ID 0x0e
+
+// [0] - sysex message chunk ID
+// [1] - message byte count, LSB
+// [2] - message byte count, MSB
+// ... - message bytes, including sysex start and end.
+// Shares the header size and maximum size with sysex data chunks.
+
+// Indicates the start of a group of messages in the FIFO that must not be split over
+// tx packets. Must be < 128, like the sysex data chunk ID.
+#define MSG_GROUP_CHUNK_ID 0x0f
+
+// [0] - message group chunk ID
+// [1] - message count
+// [2] - message byte count
+// ... - message bytes
+#define MSG_GROUP_CHUNK_HEADER_SIZE 3
+
+// Sets the BLE MIDI timestamp of the chunks that follow it in the FIFO, up to the next
+// timestamp chunk. Written by the producers whenever the clock has moved since the
+// previous chunk, so messages are sent with the time they were added rather than the
+// time they were encoded. Must be < 128, like the sysex data chunk ID. Uses the IDs
+// 0x20 to 0x3f, which hold the high bits of the timestamp.
+#define TIMESTAMP_CHUNK_ID 0x20
+#define TIMESTAMP_CHUNK_ID_MASK 0xe0
+
+// [0] - timestamp chunk ID | timestamp bits 8-12
+// [1] - timestamp bits 0-7
+#define TIMESTAMP_CHUNK_SIZE 2
+
+// Never a 13 bit timestamp. Makes the next chunk added get a timestamp chunk.
+#define NO_TIMESTAMP 0xffff
+
 #define SYSEX_START 0xf0
 #define SYSEX_END 0xf7
 
-static uint8_t sysex_chunk_scratch_buf[SYSEX_DATA_CHUNK_MAX_SIZE];
+// FIFO access. Uses the built-in ring if there is one, otherwise the FIFO callbacks.
+// Producers reserve space in the ring by advancing ring->reserved with a compare and swap,
+// copy their chunk into it and commit it by adding its size to ring->committed. Whenever
+// the two are equal, no write is in progress and everything up to them can be read. The
+// consumer owns ring->head and ring->tail and publishes tail with a release store.
+
+static inline uint32_t ring_load(const uint32_t* pos) {
+	return __atomic_load_n(pos, __ATOMIC_ACQUIRE);
+}
+
+static inline void ring_store(uint32_t* pos, uint32_t value) {
+	__atomic_store_n(pos, value, __ATOMIC_RELEASE);
+}
+
+// Space reserved in the FIFO by a producer. Filled in with fifo_append and published with
+// fifo_commit.
+struct fifo_reservation {
+	uint32_t pos;
+	int num_bytes;
+	int write_error;
+};
+
+// Producer
+static inline int fifo_get_free_space(struct tx_queue* queue) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (ring->buf) {
+		return ring->size - (__atomic_load_n(&ring->reserved, __ATOMIC_RELAXED) - ring_load(&ring->tail));
+	}
+	return queue->callbacks.fifo_get_free_space();
+}
+
+// Producer. Reserves num_bytes bytes, or nothing if they don't fit. Returns non-zero on
+// success. Never waits for other producers, so it can be used from interrupts.
+static inline int fifo_reserve(struct tx_queue* queue, int num_bytes, struct fifo_reservation* reservation) {
+	struct tx_queue_ring* ring = &queue->ring;
+	reservation->num_bytes = num_bytes;
+	reservation->write_error = 0;
+	if (!ring->buf) {
+		// The FIFO callbacks only support a single producer
+		reservation->pos = 0;
+		return queue->callbacks.fifo_get_free_space() >= num_bytes;
+	}
+	uint32_t reserved = __atomic_load_n(&ring->reserved, __ATOMIC_RELAXED);
+	if (!queue->multi_producer) {
+		// No other producer to race with, so skip the compare and swap
+		if (ring->size - (reserved - ring_load(&ring->tail)) < (uint32_t)num_bytes) {
+			return 0;
+		}
+		__atomic_store_n(&ring->reserved, reserved + num_bytes, __ATOMIC_RELAXED);
+		reservation->pos = reserved;
+		return 1;
+	}
+	do {
+		if (ring->size - (reserved - ring_load(&ring->tail)) < (uint32_t)num_bytes) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&ring->reserved, &reserved, reserved + num_bytes, 1,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	reservation->pos = reserved;
+	return 1;
+}
+
+// Producer. Copies bytes to the reservation, after the bytes appended so far.
+static inline void fifo_append(struct tx_queue* queue, struct fifo_reservation* reservation, const uint8_t* bytes, int num_bytes) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (!ring->buf) {
+		if (queue->callbacks.fifo_write(bytes, num_bytes) != num_bytes) {
+			reservation->write_error = 1;
+		}
+		return;
+	}
+	uint32_t idx = reservation->pos & (ring->size - 1);
+	int num_bytes_before_wrap = ring->size - idx;
+	if (num_bytes <= num_bytes_before_wrap) {
+		memcpy(&ring->buf[idx], bytes, num_bytes);
+	} else {
+		memcpy(&ring->buf[idx], bytes, num_bytes_before_wrap);
+		memcpy(ring->buf, &bytes[num_bytes_before_wrap], num_bytes - num_bytes_before_wrap);
+	}
+	reservation->pos += num_bytes;
+}
+
+// Producer. The number of bytes needed for a timestamp chunk before the next chunk.
+// Several producers may race here, which can cost a redundant timestamp chunk, or give a
+// chunk the timestamp of another producer's chunk added within the same short window.
+static inline int timestamp_chunk_size(struct tx_queue* queue, uint16_t timestamp) {
+	return timestamp != __atomic_load_n(&queue->fifo_timestamp, __ATOMIC_RELAXED) ? TIMESTAMP_CHUNK_SIZE : 0;
+}
+
+// Producer. Like fifo_reserve, for a chunk of num_bytes bytes preceded by a timestamp
+// chunk if the timestamp differs from the one of the previous chunk. The timestamp chunk
+// is appended here.
+static inline int fifo_reserve_chunk(struct tx_queue* queue, uint16_t timestamp, int num_bytes, struct fifo_reservation* reservation) {
+	int num_timestamp_bytes = timestamp_chunk_size(queue, timestamp);
+	if (!fifo_reserve(queue, num_timestamp_bytes + num_bytes, reservation)) {
+		return 0;
+	}
+	if (num_timestamp_bytes > 0) {
+		uint8_t timestamp_chunk[TIMESTAMP_CHUNK_SIZE] = {
+			TIMESTAMP_CHUNK_ID | ((timestamp >> 8) & 0x1f), timestamp & 0xff
+		};
+		fifo_append(queue, reservation, timestamp_chunk, TIMESTAMP_CHUNK_SIZE);
+		__atomic_store_n(&queue->fifo_timestamp, timestamp, __ATOMIC_RELAXED);
+	}
+	return 1;
+}
+
+// Producer. Publishes a filled in reservation.
+static inline enum tx_queue_error fifo_commit(struct tx_queue* queue, struct fifo_reservation* reservation) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (!ring->buf) {
+		return reservation->write_error ? TX_QUEUE_FIFO_WRITE_ERROR : TX_QUEUE_SUCCESS;
+	}
+	if (queue->multi_producer) {
+		__atomic_fetch_add(&ring->committed, reservation->num_bytes, __ATOMIC_RELEASE);
+	} else {
+		ring_store(&ring->committed, ring->committed + reservation->num_bytes);
+	}
+	return TX_QUEUE_SUCCESS;
+}
+
+// Consumer. Returns the position up to which the ring can be read. Bytes become readable
+// once all reservations before them have been committed.
+static inline uint32_t ring_readable_head(struct tx_queue_ring* ring) {
+	uint32_t committed = ring_load(&ring->committed);
+	// reserved never falls behind committed, so if it's equal now, it was equal when
+	// committed was loaded, and all reservations up to there have been committed.
+	if (__atomic_load_n(&ring->reserved, __ATOMIC_RELAXED) == committed) {
+		ring->head = committed;
+	}
+	return ring->head;
+}
+
+// Consumer
+static inline int fifo_peek(struct tx_queue* queue, uint8_t* bytes, int num_bytes) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (!ring->buf) {
+		return queue->callbacks.fifo_peek(bytes, num_bytes);
+	}
+	int num_available_bytes = ring_readable_head(ring) - ring->tail;
+	if (num_bytes > num_available_bytes) {
+		num_bytes = num_available_bytes;
+	}
+	uint32_t idx = ring->tail & (ring->size - 1);
+	int num_bytes_before_wrap = ring->size - idx;
+	if (num_bytes <= num_bytes_before_wrap) {
+		memcpy(bytes, &ring->buf[idx], num_bytes);
+	} else {
+		memcpy(bytes, &ring->buf[idx], num_bytes_before_wrap);
+		memcpy(&bytes[num_bytes_before_wrap], ring->buf, num_bytes - num_bytes_before_wrap);
+	}
+	return num_bytes;
+}
+
+// Consumer
+static inline int fifo_read(struct tx_queue* queue, int num_bytes) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (!ring->buf) {
+		return queue->callbacks.fifo_read(num_bytes);
+	}
+	int num_available_bytes = ring->head - ring->tail;
+	if (num_bytes > num_available_bytes) {
+		num_bytes = num_available_bytes;
+	}
+	ring_store(&ring->tail, ring->tail + num_bytes);
+	return num_bytes;
+}
+
+// Consumer
+static inline int fifo_is_empty(struct tx_queue* queue) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (!ring->buf) {
+		return queue->callbacks.fifo_is_empty();
+	}
+	return ring_readable_head(ring) == ring->tail;
+}
+
+// Consumer. Claims the longest contiguous run of the num_bytes bytes at offset from the
+// start of the ring without copying them. The run ends early where the ring wraps or
+// where the producers haven't committed yet. Returns the number of bytes in the run, which
+// stay in the ring until they are removed with fifo_read.
+static inline int ring_claim(struct tx_queue_ring* ring, int offset, int num_bytes, const uint8_t** bytes) {
+	int num_available_bytes = (int)(ring_readable_head(ring) - ring->tail) - offset;
+	if (num_bytes > num_available_bytes) {
+		num_bytes = num_available_bytes > 0 ? num_available_bytes : 0;
+	}
+	uint32_t idx = (ring->tail + offset) & (ring->size - 1);
+	if (num_bytes > (int)(ring->size - idx)) {
+		num_bytes = ring->size - idx;
+	}
+	*bytes = &ring->buf[idx];
+	return num_bytes;
+}
+
+// Consumer
+static inline void fifo_clear(struct tx_queue* queue) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (ring->buf) {
+		ring_store(&ring->tail, ring_readable_head(ring));
+	} else if (queue->callbacks.fifo_clear) {
+		queue->callbacks.fifo_clear();
+	}
+}
 
 static void set_has_tx_data(struct tx_queue* queue, int has_data) {
 	queue->has_tx_data = has_data;
@@ -33,16 +275,86 @@ static void set_has_tx_data(struct tx_queue* queue, int has_data) {
 	}
 }
 
-static enum tx_queue_error write_3_byte_chunk_to_fifo(struct tx_queue* queue, const uint8_t* bytes) {
-	if (queue->callbacks.fifo_get_free_space() < 3) {
+// The number of bytes a message with the given status byte takes up in the FIFO, or 0 if
+// the status byte doesn't start a message. Sysex start and end have their own chunks, so
+// they don't start a message either.
+static inline int fifo_msg_size(uint8_t status_byte) {
+	uint8_t info = ble_midi_status_info[status_byte];
+	return (info & BLE_MIDI_STATUS_SYSEX) ? 0 : (info & BLE_MIDI_STATUS_SIZE_MASK);
+}
+
+// Writes a chunk of at most 3 bytes, i.e a message or a packet size chunk.
+static enum tx_queue_error write_small_chunk_to_fifo(struct tx_queue* queue, const uint8_t* bytes, int num_bytes) {
+	struct fifo_reservation reservation;
+	if (!fifo_reserve_chunk(queue, queue->callbacks.ble_timestamp(), num_bytes, &reservation)) {
 		return TX_QUEUE_FIFO_FULL;
 	}
-	int write_result = queue->callbacks.fifo_write(bytes, 3);
-	return write_result == 3 ? TX_QUEUE_SUCCESS : TX_QUEUE_FIFO_WRITE_ERROR;
+	struct tx_queue_ring* ring = &queue->ring;
+	if (ring->buf) {
+		// The most common case, so skip the generic copy
+		uint32_t mask = ring->size - 1;
+		ring->buf[reservation.pos & mask] = bytes[0];
+		if (num_bytes > 1) {
+			ring->buf[(reservation.pos + 1) & mask] = bytes[1];
+		}
+		if (num_bytes > 2) {
+			ring->buf[(reservation.pos + 2) & mask] = bytes[2];
+		}
+	} else {
+		fifo_append(queue, &reservation, bytes, num_bytes);
+	}
+	return fifo_commit(queue, &reservation);
+}
+
+// Packs messages into bytes in the FIFO encoding. Returns the number of bytes, or
+// TX_QUEUE_INVALID_DATA if a status byte doesn't start a message.
+static int pack_msgs(const uint8_t (*msgs)[3], int num_msgs, uint8_t* bytes) {
+	int num_bytes = 0;
+	for (int i = 0; i < num_msgs; i++) {
+		int msg_size = fifo_msg_size(msgs[i][0]);
+		if (msg_size == 0) {
+			return TX_QUEUE_INVALID_DATA;
+		}
+		if (bytes) {
+			memcpy(&bytes[num_bytes], msgs[i], msg_size);
+		}
+		num_bytes += msg_size;
+	}
+	return num_bytes;
+}
+
+static int is_non_sysex_msg(uint8_t first_byte) {
+	return first_byte >= 128 && first_byte != SYSEX_START && first_byte != SYSEX_END;
+}
+
+// Unpacks consecutive non-sysex messages from bytes in the FIFO encoding into zero padded
+// 3 byte messages, stopping at max_msgs, at any other chunk or where bytes end. bytes must
+// be readable 2 bytes past num_bytes. Message i starts at msg_offsets[i], and
+// msg_offsets[num_msgs] is where the last one ends. Returns the number of messages.
+static int unpack_msgs(const uint8_t* bytes, int num_bytes, uint8_t (*msgs)[3], int* msg_offsets, int max_msgs) {
+	int num_msgs = 0;
+	int offset = 0;
+	while (num_msgs < max_msgs && offset < num_bytes) {
+		// Zero for sysex start and end, undefined status bytes and chunk IDs
+		int msg_size = ble_midi_status_info[bytes[offset]] &
+			       (BLE_MIDI_STATUS_CHANNEL | BLE_MIDI_STATUS_SYSTEM_COMMON | BLE_MIDI_STATUS_REALTIME) ?
+			       ble_midi_status_info[bytes[offset]] & BLE_MIDI_STATUS_SIZE_MASK : 0;
+		if (msg_size == 0 || offset + msg_size > num_bytes) {
+			break;
+		}
+		msgs[num_msgs][0] = bytes[offset];
+		msgs[num_msgs][1] = bytes[offset + 1] & -(msg_size > 1);
+		msgs[num_msgs][2] = bytes[offset + 2] & -(msg_size > 2);
+		msg_offsets[num_msgs] = offset;
+		offset += msg_size;
+		num_msgs++;
+	}
+	msg_offsets[num_msgs] = offset;
+	return num_msgs;
 }
 
 /**
- * Attempt to add a 3 byte chunk to a tx packet, i.e one of:
+ * Attempt to add a zero padded 3 byte message to a tx packet, i.e one of:
  * - non-sysex message
  * - sysex start
  * - sysex end
@@ -50,38 +362,31 @@ static enum tx_queue_error write_3_byte_chunk_to_fifo(struct tx_queue* queue, co
  */
 static enum tx_queue_error add_3_byte_chunk_to_tx_packet(struct tx_queue* queue, uint8_t* bytes) {	
 	int first_byte = bytes[0];
-	int timestamp = queue->callbacks.ble_timestamp();
-	enum ble_midi_packet_error_t add_result = BLE_MIDI_PACKET_SUCCESS;
-
-    // Make two attempts to add: 
-	// 1. add to the current tx packet if there is room
-	// 2. if not, add to the next tx packet if there is one
-	for (int attempt = 0; attempt < 2; attempt++) {
-		struct ble_midi_writer_t* tx_packet = tx_queue_last_tx_packet(queue);
+	uint16_t timestamp = queue->curr_timestamp;
 
-		if (first_byte == SYSEX_START) {
-			add_result = ble_midi_writer_start_sysex_msg(tx_packet, timestamp);
-		} else if (first_byte == SYSEX_END) {
-			add_result = ble_midi_writer_end_sysex_msg(tx_packet, timestamp);
-		} else {
-			add_result = ble_midi_writer_add_msg(tx_packet, bytes, timestamp);
-		}
-	
-		if (add_result == BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
-			if (attempt == 0) {
-				// No room in packet on the first attempt, try to add another packet
-				if (tx_queue_tx_packet_add(queue) == TX_QUEUE_NO_TX_PACKETS) {
-					// No free tx packets.
-					break;
-				}
-			}
-		} else if (add_result == BLE_MIDI_PACKET_SUCCESS) {
-			// done
-			break;
-		} else {
-			// failed to add the chunk for some other reason than a full packet
-			return TX_QUEUE_INVALID_DATA;
+	// Pick the tx packet up front: the current one if the chunk fits, otherwise the next one.
+	struct ble_midi_writer_t* tx_packet = tx_queue_last_tx_packet(queue);
+	int num_bytes_needed = ble_midi_writer_bytes_needed(tx_packet, bytes, timestamp);
+	if (num_bytes_needed == BLE_MIDI_PACKET_ERROR_PACKET_FULL ||
+	    num_bytes_needed > tx_packet->tx_buf_max_size - tx_packet->tx_buf_size) {
+		if (tx_queue_tx_packet_add(queue) == TX_QUEUE_NO_TX_PACKETS) {
+			// No free tx packets.
+			return TX_QUEUE_NO_TX_PACKETS;
 		}
+		tx_packet = tx_queue_last_tx_packet(queue);
+	} else if (num_bytes_needed < 0) {
+		// Invalid chunk, shouldn't happen. 
+		// Signal to the caller that it should be removed from the FIFO.
+		return TX_QUEUE_INVALID_DATA;
+	}
+
+	enum ble_midi_packet_error_t add_result = BLE_MIDI_PACKET_SUCCESS;
+	if (first_byte == SYSEX_START) {
+		add_result = ble_midi_writer_start_sysex_msg(tx_packet, timestamp);
+	} else if (first_byte == SYSEX_END) {
+		add_result = ble_midi_writer_end_sysex_msg(tx_packet, timestamp);
+	} else {
+		add_result = ble_midi_writer_add_msg(tx_packet, bytes, timestamp);
 	}
 
 	if (add_result == BLE_MIDI_PACKET_SUCCESS) {
@@ -89,6 +394,7 @@ static enum tx_queue_error add_3_byte_chunk_to_tx_packet(struct tx_queue* queue,
 		set_has_tx_data(queue, 1);
 		return TX_QUEUE_SUCCESS;
 	} else if (add_result == BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
+        // Doesn't fit even in an empty packet
         return TX_QUEUE_NO_TX_PACKETS;
     } 
 
@@ -97,6 +403,183 @@ static enum tx_queue_error add_3_byte_chunk_to_tx_packet(struct tx_queue* queue,
     return TX_QUEUE_INVALID_DATA;
 }
 
+// Adds messages sharing a timestamp to a tx packet like ble_midi_writer_add_msgs,
+// reordering them for running status if enabled.
+static int add_msgs_to_tx_packet(struct tx_queue* queue, struct ble_midi_writer_t* tx_packet, const uint8_t (*msgs)[3], int num_msgs, uint16_t timestamp) {
+	if (!queue->reorder_msgs) {
+		return ble_midi_writer_add_msgs(tx_packet, msgs, num_msgs, timestamp);
+	}
+	uint32_t num_bytes_saved = 0;
+	int add_result = ble_midi_writer_add_msgs_reordered(tx_packet, msgs, num_msgs, timestamp, &num_bytes_saved);
+	if (num_bytes_saved > 0) {
+		queue->num_reordered_msgs += add_result;
+		queue->num_reorder_bytes_saved += num_bytes_saved;
+	}
+	return add_result;
+}
+
+// The maximum number of consecutive non-sysex messages read from the FIFO at once
+#define MSG_RUN_MAX_COUNT 16
+
+/**
+ * Add a run of consecutive non-sysex messages at the start of the FIFO to tx packets,
+ * all with the same timestamp. Messages that were added are removed from the FIFO.
+ */
+static enum tx_queue_error add_msg_run_to_tx_packets(struct tx_queue* queue) {
+	// With room for unpack_msgs to read past the last message
+	uint8_t bytes[3 * MSG_RUN_MAX_COUNT + 2];
+	int num_peeked_bytes = fifo_peek(queue, bytes, 3 * MSG_RUN_MAX_COUNT);
+	uint8_t msgs[MSG_RUN_MAX_COUNT][3];
+	int msg_offsets[MSG_RUN_MAX_COUNT + 1];
+	int num_msgs = unpack_msgs(bytes, num_peeked_bytes, msgs, msg_offsets, MSG_RUN_MAX_COUNT);
+	if (num_msgs == 0) {
+		// The message is still being written to the FIFO. Try again later.
+		return TX_QUEUE_NO_TX_PACKETS;
+	}
+
+	uint16_t timestamp = queue->curr_timestamp;
+	int num_added = 0;
+	while (num_added < num_msgs) {
+		struct ble_midi_writer_t* tx_packet = tx_queue_last_tx_packet(queue);
+		int add_result = add_msgs_to_tx_packet(queue, tx_packet, &msgs[num_added], num_msgs - num_added, timestamp);
+		if (add_result < 0) {
+			// The run contains an invalid message. Add the first message on its own,
+			// which skips it if it's the invalid one.
+			add_result = add_3_byte_chunk_to_tx_packet(queue, msgs[num_added]);
+			if (add_result == TX_QUEUE_NO_TX_PACKETS) {
+				break;
+			}
+			fifo_read(queue, msg_offsets[num_added + 1] - msg_offsets[num_added]);
+			return TX_QUEUE_SUCCESS;
+		}
+		if (add_result > 0) {
+			set_has_tx_data(queue, 1);
+			fifo_read(queue, msg_offsets[num_added + add_result] - msg_offsets[num_added]);
+			num_added += add_result;
+		}
+		if (num_added < num_msgs && tx_queue_tx_packet_add(queue)) {
+			// No free tx packets.
+			break;
+		}
+	}
+
+	return num_added < num_msgs ? TX_QUEUE_NO_TX_PACKETS : TX_QUEUE_SUCCESS;
+}
+
+/**
+ * Add a message group chunk at the start of the FIFO to a single tx packet. If the group
+ * doesn't fit in the rest of the current packet, all of it goes to the next one. A group that
+ * doesn't fit even in an empty packet is split over consecutive packets. If there are not
+ * enough free tx packets, nothing is added and the chunk is left in the FIFO.
+ */
+static enum tx_queue_error add_msg_group_to_tx_packets(struct tx_queue* queue, int num_msgs, int num_msg_bytes) {
+	// With room for unpack_msgs to read past the last message
+	uint8_t chunk[MSG_GROUP_CHUNK_HEADER_SIZE + 3 * TX_QUEUE_MSG_GROUP_MAX_COUNT + 2];
+	int chunk_size = MSG_GROUP_CHUNK_HEADER_SIZE + num_msg_bytes;
+	fifo_peek(queue, chunk, chunk_size);
+	uint8_t msgs[TX_QUEUE_MSG_GROUP_MAX_COUNT][3];
+	int msg_offsets[TX_QUEUE_MSG_GROUP_MAX_COUNT + 1];
+	if (num_msgs > TX_QUEUE_MSG_GROUP_MAX_COUNT ||
+	    unpack_msgs(&chunk[MSG_GROUP_CHUNK_HEADER_SIZE], num_msg_bytes, msgs, msg_offsets, num_msgs) != num_msgs ||
+	    msg_offsets[num_msgs] != num_msg_bytes) {
+		// Shouldn't happen. Skip the group.
+		fifo_read(queue, chunk_size);
+		return TX_QUEUE_INVALID_DATA;
+	}
+	uint16_t timestamp = queue->curr_timestamp;
+
+	// Remember where the group starts, to be able to undo adding it
+	int tx_packet_count = queue->tx_packet_count;
+	struct ble_midi_writer_t* first_tx_packet = tx_queue_last_tx_packet(queue);
+	struct ble_midi_writer_checkpoint_t checkpoint;
+	ble_midi_writer_checkpoint(first_tx_packet, &checkpoint);
+
+	struct ble_midi_writer_t* tx_packet = first_tx_packet;
+	int num_added = 0;
+	while (1) {
+		int add_result = add_msgs_to_tx_packet(queue, tx_packet, &msgs[num_added], num_msgs - num_added, timestamp);
+		if (add_result < 0 || (add_result == 0 && tx_packet->tx_buf_size == 0)) {
+			// Invalid message, or a message that doesn't fit in an empty packet.
+			// Shouldn't happen. Skip the group.
+			queue->tx_packet_count = tx_packet_count;
+			ble_midi_writer_rollback(first_tx_packet, &checkpoint);
+			fifo_read(queue, chunk_size);
+			return TX_QUEUE_INVALID_DATA;
+		}
+		num_added += add_result;
+		if (num_added == num_msgs) {
+			break;
+		}
+		if (tx_packet == first_tx_packet && checkpoint.tx_buf_size > 0) {
+			// The group doesn't fit in the rest of the packet. Move all of it to the next one.
+			ble_midi_writer_rollback(tx_packet, &checkpoint);
+			num_added = 0;
+		}
+		if (tx_queue_tx_packet_add(queue)) {
+			// No free tx packets. Try again when packets have been sent.
+			queue->tx_packet_count = tx_packet_count;
+			ble_midi_writer_rollback(first_tx_packet, &checkpoint);
+			return TX_QUEUE_NO_TX_PACKETS;
+		}
+		tx_packet = tx_queue_last_tx_packet(queue);
+	}
+
+	fifo_read(queue, chunk_size);
+	set_has_tx_data(queue, 1);
+	return TX_QUEUE_SUCCESS;
+}
+
+/**
+ * Add a complete sysex message chunk at the start of the FIFO to a tx packet, sharing the
+ * packet with other messages. chunk holds the chunk bytes. A message that doesn't fit even
+ * in an empty packet is added like a sysex start chunk followed by sysex data and end
+ * chunks, with the data bytes added from the FIFO later on.
+ */
+static enum tx_queue_error add_sysex_msg_to_tx_packets(struct tx_queue* queue, const uint8_t* chunk, int chunk_size) {
+	const uint8_t* msg = &chunk[SYSEX_DATA_CHUNK_HEADER_SIZE];
+	int msg_size = chunk_size - SYSEX_DATA_CHUNK_HEADER_SIZE;
+	uint16_t timestamp = queue->curr_timestamp;
+
+	struct ble_midi_writer_t* tx_packet = tx_queue_last_tx_packet(queue);
+	// An empty packet needs a header byte and timestamp bytes for the start and end bytes
+	int fits_in_empty_packet = msg_size + 3 <= tx_packet->tx_buf_max_size;
+	enum ble_midi_packet_error_t add_result = ble_midi_writer_add_sysex_msg(tx_packet, msg, msg_size, timestamp);
+	if (add_result == BLE_MIDI_PACKET_ERROR_PACKET_FULL && fits_in_empty_packet && tx_packet->tx_buf_size > 0) {
+		if (tx_queue_tx_packet_add(queue)) {
+			// No free tx packets.
+			return TX_QUEUE_NO_TX_PACKETS;
+		}
+		tx_packet = tx_queue_last_tx_packet(queue);
+		add_result = ble_midi_writer_add_sysex_msg(tx_packet, msg, msg_size, timestamp);
+	}
+
+	if (add_result == BLE_MIDI_PACKET_ERROR_PACKET_FULL && !fits_in_empty_packet) {
+		// Too long for one packet. The chunk stays in the FIFO until its data bytes,
+		// which end right before the end byte, have been added.
+		uint8_t start_bytes[3] = { SYSEX_START, 0, 0 };
+		enum tx_queue_error start_result = add_3_byte_chunk_to_tx_packet(queue, start_bytes);
+		if (start_result == TX_QUEUE_NO_TX_PACKETS) {
+			return TX_QUEUE_NO_TX_PACKETS;
+		}
+		if (start_result == TX_QUEUE_SUCCESS) {
+			queue->num_remaining_data_bytes = msg_size - 2;
+			queue->curr_sysex_data_chunk_size = chunk_size;
+			queue->curr_sysex_data_end = chunk_size - 1;
+			queue->sysex_msg_end_pending = 1;
+			set_has_tx_data(queue, 1);
+			return TX_QUEUE_SUCCESS;
+		}
+	}
+
+	fifo_read(queue, chunk_size);
+	if (add_result != BLE_MIDI_PACKET_SUCCESS) {
+		// Invalid message, shouldn't happen. Skip it.
+		return TX_QUEUE_INVALID_DATA;
+	}
+	set_has_tx_data(queue, 1);
+	return TX_QUEUE_SUCCESS;
+}
+
 // Returns one of:
 // - the number of bytes added
 // - a negative error code
@@ -106,7 +589,7 @@ static int add_data_bytes_to_tx_packet(struct tx_queue* queue, const uint8_t* by
 	int num_bytes_added = 0;
 	while (num_bytes_added < byte_count) {
 		struct ble_midi_writer_t* tx_packet = tx_queue_last_tx_packet(queue);
-		int add_result = ble_midi_writer_add_sysex_data(tx_packet, &bytes[num_bytes_added], byte_count - num_bytes_added, queue->callbacks.ble_timestamp());
+		int add_result = ble_midi_writer_add_sysex_data(tx_packet, &bytes[num_bytes_added], byte_count - num_bytes_added, queue->curr_timestamp);
 		if (add_result < 0) {
 			// failed to add data. could be invalid sysex data etc.
 			return TX_QUEUE_INVALID_DATA;
@@ -128,15 +611,224 @@ static int add_data_bytes_to_tx_packet(struct tx_queue* queue, const uint8_t* by
 	return num_bytes_added;
 }
 
+// Like add_fifo_data_bytes_to_tx_packets for the FIFO callbacks, which can only copy bytes
+// out of the FIFO.
+static int add_peeked_data_bytes_to_tx_packets(struct tx_queue* queue, int offset, int byte_count) {
+	uint8_t chunk[SYSEX_DATA_CHUNK_MAX_SIZE];
+	int num_available_bytes = fifo_peek(queue, chunk, offset + byte_count) - offset;
+	if (num_available_bytes <= 0) {
+		return 0;
+	}
+	return add_data_bytes_to_tx_packet(queue, &chunk[offset], num_available_bytes);
+}
+
+// Adds the byte_count sysex data bytes at offset from the start of the FIFO to tx packets,
+// encoding them straight from the ring, without removing them from the FIFO. Returns the
+// number of bytes added, which is less than byte_count if the tx packets filled up or not
+// all bytes have been written to the FIFO yet, or a negative error code.
+static int add_fifo_data_bytes_to_tx_packets(struct tx_queue* queue, int offset, int byte_count) {
+	if (!queue->ring.buf) {
+		return add_peeked_data_bytes_to_tx_packets(queue, offset, byte_count);
+	}
+	int num_bytes_added = 0;
+	while (num_bytes_added < byte_count) {
+		const uint8_t* bytes;
+		int num_claimed_bytes = ring_claim(&queue->ring, offset + num_bytes_added, byte_count - num_bytes_added, &bytes);
+		if (num_claimed_bytes == 0) {
+			break;
+		}
+		int add_result = add_data_bytes_to_tx_packet(queue, bytes, num_claimed_bytes);
+		if (add_result < 0) {
+			return add_result;
+		}
+		num_bytes_added += add_result;
+		if (add_result < num_claimed_bytes) {
+			break;
+		}
+	}
+	return num_bytes_added;
+}
+
+// Adds the complete sysex message chunk at the start of the FIFO. The chunk is used in place
+// unless the ring wraps inside it or the FIFO callbacks are used.
+static enum tx_queue_error add_sysex_msg_chunk_to_tx_packets(struct tx_queue* queue, int chunk_size) {
+	const uint8_t* chunk_bytes;
+	if (queue->ring.buf && ring_claim(&queue->ring, 0, chunk_size, &chunk_bytes) == chunk_size) {
+		return add_sysex_msg_to_tx_packets(queue, chunk_bytes, chunk_size);
+	}
+	uint8_t chunk[SYSEX_DATA_CHUNK_MAX_SIZE];
+	if (fifo_peek(queue, chunk, chunk_size) < chunk_size) {
+		// The message is still being written to the FIFO. Try again later.
+		return TX_QUEUE_NO_TX_PACKETS;
+	}
+	return add_sysex_msg_to_tx_packets(queue, chunk, chunk_size);
+}
+
+// State used when re-encoding pending tx packets at a new max packet size, passed to the
+// parser callbacks. Only used by the consumer.
+struct repack_state {
+	struct tx_queue* queue;
+	// The packet being filled
+	struct ble_midi_writer_t* packet;
+	// Index of the first re-encoded packet and the number of packets filled so far
+	int first_packet_idx;
+	int packet_count;
+	// The number of packets that may be filled, i.e free packets and packets
+	// that have been parsed
+	int num_free_packets;
+	uint16_t max_size;
+	// The most recent timestamp, used for packet headers of sysex continuation packets
+	uint16_t timestamp;
+	// Non-zero if the re-encoded data did not fit in the free packets
+	int overflow;
+};
+
+// Moves on to the next free packet. Returns 0 if there is none.
+static int repack_next_packet(struct repack_state* repack) {
+	if (repack->packet_count >= repack->num_free_packets) {
+		repack->overflow = 1;
+		return 0;
+	}
+	struct ble_midi_writer_t* prev_packet = repack->packet;
+	int idx = (repack->first_packet_idx + repack->packet_count) % TX_QUEUE_PACKET_COUNT;
+	repack->packet = &repack->queue->tx_packets[idx];
+	repack->packet_count++;
+	ble_midi_writer_reset(repack->packet);
+	repack->packet->tx_buf_max_size = repack->max_size;
+	repack->packet->in_sysex_msg = prev_packet ? prev_packet->in_sysex_msg : repack->queue->sent_in_sysex_msg;
+	return 1;
+}
+
+// Called when re-encoded data didn't fit in the packet being filled. Moves on to the next
+// packet, unless the data doesn't even fit in an empty packet. Returns 0 on failure.
+static int repack_retry_in_next_packet(struct repack_state* repack) {
+	if (repack->packet->tx_buf_size == 0) {
+		repack->overflow = 1;
+		return 0;
+	}
+	return repack_next_packet(repack);
+}
+
+static void repack_msg_cb(void* user_data, uint8_t* bytes, uint8_t num_bytes, uint16_t timestamp) {
+	struct repack_state* repack = user_data;
+	// System real time messages are reported as a single byte
+	uint8_t msg[3] = { bytes[0], num_bytes > 1 ? bytes[1] : 0, num_bytes > 2 ? bytes[2] : 0 };
+	repack->timestamp = timestamp;
+	while (!repack->overflow && ble_midi_writer_add_msg(repack->packet, msg, timestamp) == BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
+		repack_retry_in_next_packet(repack);
+	}
+}
+
+static void repack_sysex_start_cb(void* user_data, uint16_t timestamp) {
+	struct repack_state* repack = user_data;
+	repack->timestamp = timestamp;
+	while (!repack->overflow && ble_midi_writer_start_sysex_msg(repack->packet, timestamp) == BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
+		repack_retry_in_next_packet(repack);
+	}
+}
+
+static void repack_sysex_end_cb(void* user_data, uint16_t timestamp) {
+	struct repack_state* repack = user_data;
+	// The sysex message may have been started in a packet that has already been sent
+	repack->packet->in_sysex_msg = 1;
+	repack->timestamp = timestamp;
+	while (!repack->overflow && ble_midi_writer_end_sysex_msg(repack->packet, timestamp) == BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
+		repack_retry_in_next_packet(repack);
+	}
+}
+
+static void repack_sysex_data_span_cb(void* user_data, const uint8_t* data_bytes, uint32_t num_data_bytes) {
+	struct repack_state* repack = user_data;
+	// Same as above
+	repack->packet->in_sysex_msg = 1;
+	uint32_t num_added = 0;
+	while (!repack->overflow && num_added < num_data_bytes) {
+		int add_result = ble_midi_writer_add_sysex_data(repack->packet, &data_bytes[num_added], num_data_bytes - num_added, repack->timestamp);
+		if (add_result < 0) {
+			return;
+		}
+		num_added += add_result;
+		if (num_added < num_data_bytes) {
+			repack_retry_in_next_packet(repack);
+		}
+	}
+}
+
+/**
+ * Set a new max packet size, re-encoding the pending tx packets so that they are
+ * merged into fewer packets if the size grows and split if it shrinks. The re-encoded
+ * packets are written to the free packets following the pending ones, reusing
+ * pending packets as soon as they have been parsed. If the size shrinks so much that
+ * the pending data does not fit in the packet queue, or a message does not fit in an
+ * empty packet, the rest of the data is dropped and TX_QUEUE_NO_TX_PACKETS is returned.
+ */
+static enum tx_queue_error repack_tx_packets(struct tx_queue* queue, uint16_t max_size) {
+	int num_pending_packets = queue->has_tx_data ? queue->tx_packet_count : 0;
+	int first_pending_idx = queue->first_tx_packet_idx;
+
+	struct repack_state repack;
+	repack.queue = queue;
+	repack.packet = 0;
+	repack.first_packet_idx = (first_pending_idx + num_pending_packets) % TX_QUEUE_PACKET_COUNT;
+	repack.packet_count = 0;
+	repack.num_free_packets = TX_QUEUE_PACKET_COUNT - num_pending_packets;
+	repack.max_size = max_size;
+	repack.overflow = 0;
+
+	struct ble_midi_parse_cb_t cb = {
+		.midi_message_cb = repack_msg_cb,
+		.sysex_start_cb = repack_sysex_start_cb,
+		.sysex_end_cb = repack_sysex_end_cb,
+		.sysex_data_span_cb = repack_sysex_data_span_cb,
+		.user_data = &repack,
+	};
+	struct ble_midi_parser_t parser;
+	ble_midi_parser_init(&parser, &cb);
+
+	for (int i = 0; i < num_pending_packets; i++) {
+		// Copy the packet so it can be reused for re-encoded data while parsing it
+		struct ble_midi_writer_t* pending_packet = &queue->tx_packets[(first_pending_idx + i) % TX_QUEUE_PACKET_COUNT];
+		struct ble_midi_writer_t packet = *pending_packet;
+		repack.num_free_packets++;
+		if (i == 0) {
+			repack.timestamp = (packet.tx_buf[0] & 0x3f) << 7;
+			repack_next_packet(&repack);
+		}
+		if (packet.tx_buf_size > 0) {
+			ble_midi_parser_feed(&parser, packet.tx_buf, packet.tx_buf_size);
+		}
+	}
+
+	if (repack.packet_count > 1 && repack.packet->tx_buf_size == 0) {
+		// Data that didn't fit was dropped, leaving the last packet empty
+		repack.packet_count--;
+	}
+	for (int i = 0; i < TX_QUEUE_PACKET_COUNT; i++) {
+		queue->tx_packets[i].tx_buf_max_size = max_size;
+	}
+	if (repack.packet_count > 0) {
+		queue->first_tx_packet_idx = repack.first_packet_idx;
+		queue->tx_packet_count = repack.packet_count;
+	}
+
+	return repack.overflow ? TX_QUEUE_NO_TX_PACKETS : TX_QUEUE_SUCCESS;
+}
+
 // INIT / CLEAR API. 
 void tx_queue_reset(struct tx_queue* queue) {
 	queue->num_remaining_data_bytes = 0;
 	queue->curr_sysex_data_chunk_size = 0;
+	queue->curr_sysex_data_end = 0;
+	queue->sysex_msg_end_pending = 0;
+	queue->sent_in_sysex_msg = 0;
+	queue->curr_timestamp = 0;
+	queue->num_reordered_msgs = 0;
+	queue->num_reorder_bytes_saved = 0;
 	queue->first_tx_packet_idx = 0;
 	queue->tx_packet_count = 1;
-	if (queue->callbacks.fifo_clear) {
-		queue->callbacks.fifo_clear();
-	}
+	fifo_clear(queue);
+	// The timestamp chunks left in the FIFO have been removed too
+	__atomic_store_n(&queue->fifo_timestamp, NO_TIMESTAMP, __ATOMIC_RELAXED);
 
 	set_has_tx_data(queue, 0);
     
@@ -157,11 +849,23 @@ void tx_queue_set_callbacks(struct tx_queue* queue, struct tx_queue_callbacks* c
 		queue->callbacks.fifo_write = callbacks->fifo_write;
 		queue->callbacks.fifo_clear = callbacks->fifo_clear;
 		queue->callbacks.notify_has_data = callbacks->notify_has_data;
+		queue->ring.buf = NULL;
 	}
 }
 
+void tx_queue_set_ring(struct tx_queue* queue, uint8_t* buf, uint32_t size) {
+	queue->ring.buf = buf;
+	queue->ring.size = size;
+	queue->ring.reserved = 0;
+	queue->ring.committed = 0;
+	queue->ring.head = 0;
+	queue->ring.tail = 0;
+}
+
 void tx_queue_init(struct tx_queue* queue, struct tx_queue_callbacks* callbacks, int running_status_enabled, int note_off_as_note_on) {
 	tx_queue_set_callbacks(queue, callbacks);
+	queue->reorder_msgs = 0;
+	queue->multi_producer = 0;
 
 	for (int i = 0; i < TX_QUEUE_PACKET_COUNT; i++) {
         ble_midi_writer_init(&queue->tx_packets[i], running_status_enabled, note_off_as_note_on);
@@ -177,27 +881,73 @@ enum tx_queue_error tx_queue_fifo_add_tx_packet_size(struct tx_queue* queue, uin
 	uint8_t bytes[3] = { 
 		TX_MAX_PACKET_SIZE_CHUNK_ID, size & 0xff, (size >> 8) & 0xff 
 	};
-	return write_3_byte_chunk_to_fifo(queue, bytes);
+	return write_small_chunk_to_fifo(queue, bytes, 3);
 }
 
 enum tx_queue_error tx_queue_fifo_add_msg(struct tx_queue* queue, const uint8_t* bytes) {
-	return write_3_byte_chunk_to_fifo(queue, bytes);
+	int msg_size = fifo_msg_size(bytes[0]);
+	if (msg_size == 0) {
+		return TX_QUEUE_INVALID_DATA;
+	}
+	return write_small_chunk_to_fifo(queue, bytes, msg_size);
+}
+
+enum tx_queue_error tx_queue_fifo_add_msgs(struct tx_queue* queue, const uint8_t (*msgs)[3], int num_msgs) {
+	int num_bytes = pack_msgs(msgs, num_msgs, NULL);
+	if (num_bytes < 0) {
+		return num_bytes;
+	}
+	struct fifo_reservation reservation;
+	if (!fifo_reserve_chunk(queue, queue->callbacks.ble_timestamp(), num_bytes, &reservation)) {
+		return TX_QUEUE_FIFO_FULL;
+	}
+	// Pack and write the messages a run at a time
+	for (int i = 0; i < num_msgs; i += MSG_RUN_MAX_COUNT) {
+		uint8_t bytes[3 * MSG_RUN_MAX_COUNT];
+		int num_run_msgs = num_msgs - i < MSG_RUN_MAX_COUNT ? num_msgs - i : MSG_RUN_MAX_COUNT;
+		int num_run_bytes = pack_msgs(&msgs[i], num_run_msgs, bytes);
+		fifo_append(queue, &reservation, bytes, num_run_bytes);
+	}
+	return fifo_commit(queue, &reservation);
+}
+
+enum tx_queue_error tx_queue_fifo_add_msg_group(struct tx_queue* queue, const uint8_t (*msgs)[3], int num_msgs) {
+	if (num_msgs <= 0 || num_msgs > TX_QUEUE_MSG_GROUP_MAX_COUNT) {
+		return TX_QUEUE_INVALID_DATA;
+	}
+	uint8_t chunk[MSG_GROUP_CHUNK_HEADER_SIZE + 3 * TX_QUEUE_MSG_GROUP_MAX_COUNT];
+	int num_msg_bytes = pack_msgs(msgs, num_msgs, &chunk[MSG_GROUP_CHUNK_HEADER_SIZE]);
+	if (num_msg_bytes < 0) {
+		return num_msg_bytes;
+	}
+	int chunk_size = MSG_GROUP_CHUNK_HEADER_SIZE + num_msg_bytes;
+	struct fifo_reservation reservation;
+	if (!fifo_reserve_chunk(queue, queue->callbacks.ble_timestamp(), chunk_size, &reservation)) {
+		return TX_QUEUE_FIFO_FULL;
+	}
+
+	// Write the chunk at once, so the consumer never sees a partial group
+	chunk[0] = MSG_GROUP_CHUNK_ID;
+	chunk[1] = num_msgs;
+	chunk[2] = num_msg_bytes;
+	fifo_append(queue, &reservation, chunk, chunk_size);
+	return fifo_commit(queue, &reservation);
 }
 
 enum tx_queue_error tx_queue_fifo_add_sysex_start(struct tx_queue* queue) {
-	// Store sysex start as three zero padded bytes for simplicity 
-	uint8_t bytes[3] = { SYSEX_START, 0, 0 };
-	return write_3_byte_chunk_to_fifo(queue, bytes);
+	uint8_t bytes[1] = { SYSEX_START };
+	return write_small_chunk_to_fifo(queue, bytes, 1);
 }
 
 enum tx_queue_error tx_queue_fifo_add_sysex_end(struct tx_queue* queue) {
-	// Store sysex end as three zero padded bytes for simplicity
-	uint8_t bytes[3] = { SYSEX_END, 0, 0 };
-	return write_3_byte_chunk_to_fifo(queue, bytes);
+	uint8_t bytes[1] = { SYSEX_END };
+	return write_small_chunk_to_fifo(queue, bytes, 1);
 }
 
 int tx_queue_fifo_add_sysex_data(struct tx_queue* queue, const uint8_t* bytes, int num_bytes) {
-	int fifo_space_left = queue->callbacks.fifo_get_free_space();
+	uint16_t timestamp = queue->callbacks.ble_timestamp();
+	// Leave room for a timestamp chunk, if one is needed
+	int fifo_space_left = fifo_get_free_space(queue) - timestamp_chunk_size(queue, timestamp);
 	if (fifo_space_left <= SYSEX_DATA_CHUNK_HEADER_SIZE) {
 		// Not enough room in the FIFO to send at least one data byte. 
 		return TX_QUEUE_FIFO_FULL;
@@ -222,66 +972,123 @@ int tx_queue_fifo_add_sysex_data(struct tx_queue* queue, const uint8_t* bytes, i
 		(num_bytes_to_send >> 8) & 0xff, 
 	};
 
-	int header_write_result = queue->callbacks.fifo_write(chunk_header, SYSEX_DATA_CHUNK_HEADER_SIZE);
-	int data_write_result = 0;
-	if (header_write_result == SYSEX_DATA_CHUNK_HEADER_SIZE) {
-		data_write_result = queue->callbacks.fifo_write(bytes, num_bytes_to_send);
+	struct fifo_reservation reservation;
+	if (!fifo_reserve_chunk(queue, timestamp, SYSEX_DATA_CHUNK_HEADER_SIZE + num_bytes_to_send, &reservation)) {
+		// Another producer took the space
+		return TX_QUEUE_FIFO_FULL;
+	}
+	fifo_append(queue, &reservation, chunk_header, SYSEX_DATA_CHUNK_HEADER_SIZE);
+	fifo_append(queue, &reservation, bytes, num_bytes_to_send);
+	enum tx_queue_error commit_result = fifo_commit(queue, &reservation);
+	return commit_result == TX_QUEUE_SUCCESS ? num_bytes_to_send : commit_result;
+}
+
+enum tx_queue_error tx_queue_fifo_add_sysex_msg(struct tx_queue* queue, const uint8_t* bytes, int num_bytes) {
+	if (num_bytes > TX_QUEUE_SYSEX_MSG_MAX_SIZE) {
+		return TX_QUEUE_INVALID_DATA;
+	}
+	struct fifo_reservation reservation;
+	if (!fifo_reserve_chunk(queue, queue->callbacks.ble_timestamp(), SYSEX_DATA_CHUNK_HEADER_SIZE + num_bytes, &reservation)) {
+		return TX_QUEUE_FIFO_FULL;
 	}
 
-	return data_write_result;
+	uint8_t chunk_header[SYSEX_DATA_CHUNK_HEADER_SIZE] = {
+		SYSEX_MSG_CHUNK_ID,
+		num_bytes & 0xff,
+		(num_bytes >> 8) & 0xff,
+	};
+	fifo_append(queue, &reservation, chunk_header, SYSEX_DATA_CHUNK_HEADER_SIZE);
+	fifo_append(queue, &reservation, bytes, num_bytes);
+	return fifo_commit(queue, &reservation);
+}
+
+// READ API.
+
+int tx_queue_fifo_is_empty(struct tx_queue* queue) {
+	struct tx_queue_ring* ring = &queue->ring;
+	if (!ring->buf) {
+		return queue->callbacks.fifo_is_empty();
+	}
+	// May be called from a context other than the producers and the consumer. A write
+	// in progress counts as data.
+	return __atomic_load_n(&ring->reserved, __ATOMIC_RELAXED) == ring_load(&ring->tail);
 }
 
 int tx_queue_read_from_fifo(struct tx_queue* queue) {
 	uint8_t msg_bytes[3] = { 0, 0, 0};
 
-	while (!queue->callbacks.fifo_is_empty()) {
+	// Partially added sysex data and a pending sysex end have already been read from
+	// the FIFO, so keep going until they have been added too.
+	while (queue->num_remaining_data_bytes > 0 || queue->sysex_msg_end_pending ||
+	       !fifo_is_empty(queue)) {
 		if (queue->num_remaining_data_bytes > 0) {
-			int sysex_chunk_read_pos = queue->curr_sysex_data_chunk_size - queue->num_remaining_data_bytes;
-			int add_result = add_data_bytes_to_tx_packet(queue, &sysex_chunk_scratch_buf[sysex_chunk_read_pos], queue->num_remaining_data_bytes);
+			// Continue adding the data bytes of the sysex chunk at the start of the FIFO
+			int offset = queue->curr_sysex_data_end - queue->num_remaining_data_bytes;
+			int add_result = add_fifo_data_bytes_to_tx_packets(queue, offset, queue->num_remaining_data_bytes);
 			if (add_result == 0) {
-				// zero bytes added, no room in any packet
+				// zero bytes added, no room in any packet or the bytes haven't been
+				// written yet
 				return TX_QUEUE_NO_TX_PACKETS;
 			} else if (add_result < 0) {
-				// invalid data, skip bytes
-				// queue->callbacks.fifo_read()
-				// TODO: handle this
+				// invalid data, skip the rest of the chunk
+				queue->num_remaining_data_bytes = 0;
 			} else {
 				queue->num_remaining_data_bytes -= add_result;
 			}
+			if (queue->num_remaining_data_bytes == 0) {
+				fifo_read(queue, queue->curr_sysex_data_chunk_size);
+			}
+		} else if (queue->sysex_msg_end_pending) {
+			uint8_t end_bytes[3] = { SYSEX_END, 0, 0 };
+			if (add_3_byte_chunk_to_tx_packet(queue, end_bytes) == TX_QUEUE_NO_TX_PACKETS) {
+				return TX_QUEUE_NO_TX_PACKETS;
+			}
+			queue->sysex_msg_end_pending = 0;
 		} else {
 			// peek the first bytes of the chunk.
-			queue->callbacks.fifo_peek(msg_bytes, 3);
+			fifo_peek(queue, msg_bytes, 3);
 			int first_byte = msg_bytes[0];
 			int add_result = 0;
 			if (first_byte == SYSEX_DATA_CHUNK_ID) {
-				// this is sysex data chunk, get the total number of data bytes in the chunk
+				// this is sysex data chunk, get the total number of data bytes in the chunk.
+				// The data bytes are added from the FIFO above, and the chunk is removed
+				// from the FIFO once all of them have been added.
 				int sysex_data_byte_count = msg_bytes[1] | (msg_bytes[2] << 8);
 				int sysex_data_chunk_size = SYSEX_DATA_CHUNK_HEADER_SIZE + sysex_data_byte_count;
-				
-				// read the chunk into the scratch buffer (which may be too small to hold all data)
-				int num_peeked_bytes = queue->callbacks.fifo_peek(sysex_chunk_scratch_buf, sysex_data_chunk_size);
-				int num_data_bytes_to_add = num_peeked_bytes - SYSEX_DATA_CHUNK_HEADER_SIZE;
-				// try adding scratch buffer contents to an available tx packet
-				add_result = add_data_bytes_to_tx_packet(queue, &sysex_chunk_scratch_buf[SYSEX_DATA_CHUNK_HEADER_SIZE], num_data_bytes_to_add);
-				if (add_result == 0) {
-					// zero bytes added, no room in any packet. leave the sysex data chunk in the FIFO
+				if (sysex_data_byte_count == 0) {
+					fifo_read(queue, sysex_data_chunk_size);
+				}
+				queue->num_remaining_data_bytes = sysex_data_byte_count;
+				queue->curr_sysex_data_chunk_size = sysex_data_chunk_size;
+				queue->curr_sysex_data_end = sysex_data_chunk_size;
+			}
+			else if ((first_byte & TIMESTAMP_CHUNK_ID_MASK) == TIMESTAMP_CHUNK_ID) {
+				// The chunks that follow were added at this time
+				queue->curr_timestamp = ((first_byte & 0x1f) << 8) | msg_bytes[1];
+				fifo_read(queue, TIMESTAMP_CHUNK_SIZE);
+			}
+			else if (first_byte == MSG_GROUP_CHUNK_ID) {
+				if (add_msg_group_to_tx_packets(queue, msg_bytes[1], msg_bytes[2]) == TX_QUEUE_NO_TX_PACKETS) {
+					return TX_QUEUE_NO_TX_PACKETS;
+				}
+			}
+			else if (first_byte == SYSEX_MSG_CHUNK_ID) {
+				int sysex_msg_chunk_size = SYSEX_DATA_CHUNK_HEADER_SIZE + (msg_bytes[1] | (msg_bytes[2] << 8));
+				if (add_sysex_msg_chunk_to_tx_packets(queue, sysex_msg_chunk_size) == TX_QUEUE_NO_TX_PACKETS) {
+					return TX_QUEUE_NO_TX_PACKETS;
+				}
+			}
+			else if (is_non_sysex_msg(first_byte)) {
+				if (add_msg_run_to_tx_packets(queue) == TX_QUEUE_NO_TX_PACKETS) {
 					return TX_QUEUE_NO_TX_PACKETS;
-				} else if (add_result < 0) {
-					// invalid data. skip this sysex data chunk
-					queue->callbacks.fifo_read(sysex_data_chunk_size);
-				} else {
-					queue->callbacks.fifo_read(sysex_data_chunk_size);
-					int num_added_bytes = add_result;					
-					// compute the number of bytes to process in the chunk.
-					queue->num_remaining_data_bytes = sysex_data_byte_count - num_added_bytes;
-					queue->curr_sysex_data_chunk_size = sysex_data_chunk_size;
 				}
 			}
 			else if (first_byte >= 128) {
-				// sysex start, sysex end or non-sysex msg
-				add_result = add_3_byte_chunk_to_tx_packet(queue, msg_bytes); 
+				// sysex start or sysex end, one byte each
+				uint8_t marker_bytes[3] = { first_byte, 0, 0 };
+				add_result = add_3_byte_chunk_to_tx_packet(queue, marker_bytes);
 				if (add_result == TX_QUEUE_SUCCESS || add_result == TX_QUEUE_INVALID_DATA) {
-					queue->callbacks.fifo_read(3);
+					fifo_read(queue, 1);
 				} else {
 					return TX_QUEUE_NO_TX_PACKETS;
 				}
@@ -289,11 +1096,8 @@ int tx_queue_read_from_fifo(struct tx_queue* queue) {
 			else if (first_byte == TX_MAX_PACKET_SIZE_CHUNK_ID) {
 				uint16_t requested_max_size = msg_bytes[1] | (msg_bytes[2] << 8);
 				uint16_t max_size = requested_max_size > BLE_MIDI_TX_PACKET_MAX_SIZE ? BLE_MIDI_TX_PACKET_MAX_SIZE : requested_max_size;
-				for (int i = 0; i < TX_QUEUE_PACKET_COUNT; i++) {
-					// TODO: need to handle shrinking?
-					queue->tx_packets[i].tx_buf_max_size = max_size;
-				}
-				queue->callbacks.fifo_read(3);
+				repack_tx_packets(queue, max_size);
+				fifo_read(queue, 3);
 			}
 		}
 	}
@@ -306,10 +1110,13 @@ enum tx_queue_error tx_queue_tx_packet_add(struct tx_queue* queue) {
         return TX_QUEUE_NO_TX_PACKETS;
     }
 
+    struct ble_midi_writer_t* prev_packet = tx_queue_last_tx_packet(queue);
     queue->tx_packet_count++;
 
     struct ble_midi_writer_t* packet = tx_queue_last_tx_packet(queue);
     ble_midi_writer_reset(packet);
+    // A sysex message in progress continues in the new packet
+    packet->in_sysex_msg = prev_packet->in_sysex_msg;
 
     return TX_QUEUE_SUCCESS;
 }
@@ -317,6 +1124,7 @@ enum tx_queue_error tx_queue_tx_packet_add(struct tx_queue* queue) {
 enum tx_queue_error tx_queue_on_tx_packet_sent(struct tx_queue* queue) {
 	struct ble_midi_writer_t* packet_to_pop = tx_queue_first_tx_packet(queue);
 	if (packet_to_pop) {
+		queue->sent_in_sysex_msg = packet_to_pop->in_sysex_msg;
 		ble_midi_writer_reset(packet_to_pop);
 
 		if (queue->tx_packet_count <= 1) {
@@ -10,13 +10,20 @@
 #define TX_QUEUE_PACKET_COUNT 4
 #endif
 
+// The maximum size of a complete sysex message in the FIFO, including start and end bytes
+#define TX_QUEUE_SYSEX_MSG_MAX_SIZE 255
+
+// The maximum number of messages in a message group. Matches BLE_MIDI_TX_MSG_GROUP_MAX_COUNT.
+#define TX_QUEUE_MSG_GROUP_MAX_COUNT 16
+
 enum tx_queue_error {
 	TX_QUEUE_SUCCESS = 0,
 	TX_QUEUE_FIFO_FULL = -1,
 	TX_QUEUE_NO_TX_PACKETS = -2,
 	// Error writing to FIFO
 	TX_QUEUE_FIFO_WRITE_ERROR = -3,
-	// Invalid data read from the FIFO, e.g a status byte in a sysex data chunk
+	// Invalid data read from the FIFO, e.g a status byte in a sysex data chunk, or a
+	// sysex message too long for the FIFO
 	TX_QUEUE_INVALID_DATA = -4
 };
 
@@ -32,35 +39,101 @@ struct tx_queue_callbacks {
 	int (*fifo_write)(const uint8_t* bytes, int num_bytes);
 
 	void (*notify_has_data)(int has_data);
+	// The current 13 bit BLE MIDI timestamp. Called by the producers when adding to the
+	// FIFO, and messages are sent with the timestamp they were added at.
 	uint16_t (*ble_timestamp)();
 };
 
+// A multi producer, single consumer ring buffer the tx queue can use as its FIFO instead
+// of the FIFO callbacks. Producers reserve space for a whole chunk, copy it in and commit
+// it, so concurrent producers never interleave partial chunks, and never wait for each
+// other, so they may run in interrupts. See multi_producer in tx_queue. Adding to and
+// reading from the FIFO takes no locks and no function calls.
+struct tx_queue_ring {
+	// NULL if the FIFO callbacks are used
+	uint8_t* buf;
+	// A power of two
+	uint32_t size;
+	// Free running counts of bytes reserved and committed by the producers
+	uint32_t reserved;
+	uint32_t committed;
+	// Free running read positions. The consumer reads up to head, the last position at
+	// which no write was in progress, and removes bytes by advancing tail.
+	uint32_t head;
+	uint32_t tail;
+};
+
 struct tx_queue {
 	struct tx_queue_callbacks callbacks;
+	struct tx_queue_ring ring;
 	struct ble_midi_writer_t tx_packets[TX_QUEUE_PACKET_COUNT];
 	int first_tx_packet_idx;
 	int tx_packet_count;
 	int has_tx_data;
-	// Used to keep track of how many additional sysex data bytes to read from the
-	// FIFO in case the packet queue got filled up with a partial sysex message
+	// Non-zero if the most recently sent packet ended inside a sysex message, i.e the first
+	// pending packet starts inside it
+	int sent_in_sysex_msg;
+	// Used to keep track of how many additional sysex data bytes to add from the sysex
+	// chunk at the start of the FIFO, in case the packet queue got filled up with a
+	// partial sysex message. The chunk is removed from the FIFO once all have been added.
 	int num_remaining_data_bytes;
 	int curr_sysex_data_chunk_size;
+	// The offset in the chunk right after its last data byte
+	int curr_sysex_data_end;
+	// Non-zero if the data bytes above belong to a complete sysex message that was too
+	// long for one packet, whose end byte has not been added yet
+	int sysex_msg_end_pending;
+	// The timestamp of the latest timestamp chunk added to the FIFO, written by the
+	// producers, and of the latest one read from it, used for the chunks being added to
+	// tx packets
+	uint16_t fifo_timestamp;
+	uint16_t curr_timestamp;
+	// Non-zero if messages sharing a timestamp should be reordered to maximize running
+	// status, see ble_midi_writer_add_msgs_reordered. Off after init.
+	int reorder_msgs;
+	// Non-zero if several producers may add to the built-in ring at the same time, e.g
+	// threads and interrupts. Off after init, for a single producer.
+	int multi_producer;
+	// The number of messages written in a reordered order and the number of bytes it saved
+	uint32_t num_reordered_msgs;
+	uint32_t num_reorder_bytes_saved;
 };
 
 // INIT / CLEAR API. 
 void tx_queue_init(struct tx_queue* queue, struct tx_queue_callbacks* callbacks, int running_status_enabled, int note_off_as_note_on);
+// Also makes the queue use the FIFO callbacks instead of a built-in ring
 void tx_queue_set_callbacks(struct tx_queue* queue, struct tx_queue_callbacks* callbacks);
+// Makes the queue use a built-in ring of size bytes in buf as its FIFO. size must be a
+// power of two. The FIFO callbacks are ignored afterwards, the other callbacks are still used.
+void tx_queue_set_ring(struct tx_queue* queue, uint8_t* buf, uint32_t size);
 void tx_queue_reset(struct tx_queue* queue);
 
-// Producer API (writes to the FIFO)
+// Producer API (writes to the FIFO). With the built-in ring and multi_producer set, any
+// number of producers may add to the FIFO concurrently, including from interrupts. Each
+// call adds its chunks as a whole, but a sysex message added with separate start, data and
+// end calls must come from one producer at a time, or other producers' messages end up
+// inside it. With the FIFO callbacks, there must be a single producer.
 enum tx_queue_error tx_queue_fifo_add_tx_packet_size(struct tx_queue* queue, uint16_t size);
+// Messages take up as many FIFO bytes as their status byte implies. Messages with a status
+// byte that doesn't start a message, including sysex start and end, are rejected with
+// TX_QUEUE_INVALID_DATA.
 enum tx_queue_error tx_queue_fifo_add_msg(struct tx_queue* queue, const uint8_t* bytes);
+// Adds all messages or none of them
+enum tx_queue_error tx_queue_fifo_add_msgs(struct tx_queue* queue, const uint8_t (*msgs)[3], int num_msgs);
 enum tx_queue_error tx_queue_fifo_add_sysex_start(struct tx_queue* queue);
 enum tx_queue_error tx_queue_fifo_add_sysex_end(struct tx_queue* queue);
 int tx_queue_fifo_add_sysex_data(struct tx_queue* queue, const uint8_t* bytes, int num_bytes);
+// Adds a group of messages that is placed in a single tx packet, unless it doesn't fit
+// in an empty packet. Adds all messages or none of them.
+enum tx_queue_error tx_queue_fifo_add_msg_group(struct tx_queue* queue, const uint8_t (*msgs)[3], int num_msgs);
+// Adds a complete sysex message, starting with 0xf0 and ending with 0xf7, or nothing.
+// The message may share a tx packet with other messages.
+enum tx_queue_error tx_queue_fifo_add_sysex_msg(struct tx_queue* queue, const uint8_t* bytes, int num_bytes);
 
 // Consumer API
 
+int tx_queue_fifo_is_empty(struct tx_queue* queue);
+
 /**
  * Read pending FIFO messages one by one and append them to a pending BLE MIDI tx packet.
  * If one packet is full, start filling up the next, if there is one available.
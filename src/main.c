@@ -202,10 +202,10 @@ static void ble_midi_sysex_start_cb(uint16_t timestamp)
 	sample_app_state.sysex_rx_start_time_ms = k_uptime_get();
 	// printk("rx sysex start, t %d\n", timestamp);
 }
-/** Called when a sysex data byte has been received */
-static void ble_midi_sysex_data_cb(uint8_t data_byte)
+/** Called when a run of sysex data bytes has been received */
+static void ble_midi_sysex_data_span_cb(const uint8_t *data_bytes, uint32_t num_data_bytes)
 {
-	sample_app_state.sysex_rx_data_byte_count += 1;
+	sample_app_state.sysex_rx_data_byte_count += num_data_bytes;
 }
 /** Called when a sysex message ends */
 static void ble_midi_sysex_end_cb(uint16_t timestamp)
@@ -243,7 +243,7 @@ int main(void)
 						    .tx_done_cb = tx_done_cb,
 						    .midi_message_cb = ble_midi_message_cb,
 						    .sysex_start_cb = ble_midi_sysex_start_cb,
-						    .sysex_data_cb = ble_midi_sysex_data_cb,
+						    .sysex_data_span_cb = ble_midi_sysex_data_span_cb,
 						    .sysex_end_cb = ble_midi_sysex_end_cb};
 	ble_midi_init(&midi_callbacks);
 
@@ -261,21 +261,17 @@ int main(void)
 			if (button_idx == BUTTON_TX_NON_SYSEX) {
 				uint8_t status_byte =
 					button_down ? 0x90 : 0x80; // Note on or note off?
-				uint8_t chord_msgs[][3] = {
+				const uint8_t chord_msgs[][3] = {
 					{status_byte, 0x48, 0x7f},
 					{status_byte, 0x4c, 0x7f},
 					{status_byte, 0x4f, 0x7f},
 				};
-				ble_midi_tx_msg(&(chord_msgs[0][0]));
-				ble_midi_tx_msg(&(chord_msgs[1][0]));
-				ble_midi_tx_msg(&(chord_msgs[2][0]));
+				ble_midi_tx_msg_group(chord_msgs, 3);
 			} else if (button_idx == BUTTON_TX_SYSEX_SHORT && button_down) {
-				uint8_t data_bytes[10] = {
-					0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+				const uint8_t sysex_msg[12] = {
+					0xf0, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xf7,
 				};
-				ble_midi_tx_sysex_start();
-				ble_midi_tx_sysex_data(data_bytes, 10);
-				ble_midi_tx_sysex_end();
+				ble_midi_tx_sysex_msg(sysex_msg, 12);
 			} else if (button_idx == BUTTON_TX_SYSEX_LONG && button_down) {
 				/* Send the first byte of a sysex message that is too large
 					to be sent at once. Use the tx done callback to send the
@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "../ble_midi/src/ble_midi_packet.h"
+
+/* Host benchmark for the BLE MIDI packet codec. Run from the test directory or
+   pass the path of the test_sysex_data directory as the first argument. */
+
+#define MAX_PACKET_COUNT     4096
+
+/* Writer settings for the message mix benchmark */
+#ifndef BENCH_RUNNING_STATUS
+#define BENCH_RUNNING_STATUS 1
+#endif
+#ifndef BENCH_NOTE_OFF_AS_NOTE_ON
+#define BENCH_NOTE_OFF_AS_NOTE_ON 1
+#endif
+#define BENCH_MIN_DURATION_S 0.2
+
+static const int sysex_file_byte_counts[] = {0,	 1,  2,	 3,   4,   5,	6,   7,	   8,
+					     9,	 10, 20, 30,  40,  100, 200, 500, 1000};
+
+struct packet_corpus {
+	uint8_t bytes[MAX_PACKET_COUNT][BLE_MIDI_TX_PACKET_MAX_SIZE];
+	uint16_t sizes[MAX_PACKET_COUNT];
+	int num_packets;
+	/* Total number of packet bytes */
+	long num_bytes;
+};
+
+static struct packet_corpus corpus;
+
+static double now_s()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Returns a cycle count where available, otherwise a ns count. */
+static uint64_t now_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static long num_received_bytes = 0;
+
+static void message_cb(void *user_data, uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
+{
+	num_received_bytes += num_bytes;
+}
+
+static void sysex_start_cb(void *user_data, uint16_t timestamp)
+{
+	num_received_bytes++;
+}
+
+static void sysex_data_span_cb(void *user_data, const uint8_t *data_bytes, uint32_t num_data_bytes)
+{
+	num_received_bytes += num_data_bytes;
+}
+
+static void sysex_end_cb(void *user_data, uint16_t timestamp)
+{
+	num_received_bytes++;
+}
+
+static struct ble_midi_parse_cb_t parse_cb = {.midi_message_cb = message_cb,
+					      .sysex_start_cb = sysex_start_cb,
+					      .sysex_data_span_cb = sysex_data_span_cb,
+					      .sysex_end_cb = sysex_end_cb};
+
+static void corpus_add_packet(struct ble_midi_writer_t *writer)
+{
+	if (writer->tx_buf_size > 0 && corpus.num_packets < MAX_PACKET_COUNT) {
+		memcpy(corpus.bytes[corpus.num_packets], writer->tx_buf, writer->tx_buf_size);
+		corpus.sizes[corpus.num_packets] = writer->tx_buf_size;
+		corpus.num_bytes += writer->tx_buf_size;
+		corpus.num_packets++;
+	}
+	ble_midi_writer_reset(writer);
+}
+
+/* Wraps a sysex message into BLE MIDI packets of the given size. If clock_interval
+   is non-zero, a timing clock message is inserted every clock_interval data bytes. */
+static void corpus_add_sysex(const uint8_t *bytes, int num_bytes, int packet_size,
+			     int clock_interval)
+{
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 1, 0);
+	writer.tx_buf_max_size = packet_size;
+	uint16_t timestamp = 0;
+	uint8_t clock[3] = {0xf8, 0, 0};
+
+	if (ble_midi_writer_start_sysex_msg(&writer, timestamp)) {
+		corpus_add_packet(&writer);
+		ble_midi_writer_start_sysex_msg(&writer, timestamp);
+	}
+
+	int num_data_bytes = num_bytes - 2;
+	int pos = 0;
+	while (pos < num_data_bytes) {
+		int chunk_size = num_data_bytes - pos;
+		if (clock_interval > 0 && chunk_size > clock_interval) {
+			chunk_size = clock_interval;
+		}
+		int num_added =
+			ble_midi_writer_add_sysex_data(&writer, &bytes[1 + pos], chunk_size, timestamp);
+		pos += num_added;
+		if (num_added < chunk_size) {
+			corpus_add_packet(&writer);
+			continue;
+		}
+		if (clock_interval > 0 && pos < num_data_bytes) {
+			timestamp = (timestamp + 1) & 0x1fff;
+			if (ble_midi_writer_add_msg(&writer, clock, timestamp)) {
+				corpus_add_packet(&writer);
+				ble_midi_writer_add_msg(&writer, clock, timestamp);
+			}
+		}
+	}
+
+	if (ble_midi_writer_end_sysex_msg(&writer, timestamp)) {
+		corpus_add_packet(&writer);
+		ble_midi_writer_end_sysex_msg(&writer, timestamp);
+	}
+	corpus_add_packet(&writer);
+}
+
+#define NUM_SYSEX_FILES (sizeof(sysex_file_byte_counts) / sizeof(sysex_file_byte_counts[0]))
+
+static uint8_t sysex_files[NUM_SYSEX_FILES][2048];
+static int sysex_file_sizes[NUM_SYSEX_FILES];
+
+static int load_sysex_files(const char *dir)
+{
+	for (int i = 0; i < NUM_SYSEX_FILES; i++) {
+		char path[512];
+		snprintf(path, sizeof(path), "%s/sysex_test_%04d_data_bytes.syx", dir,
+			 sysex_file_byte_counts[i]);
+		FILE *file = fopen(path, "rb");
+		if (!file) {
+			printf("Failed to open %s\n", path);
+			return -1;
+		}
+		sysex_file_sizes[i] = fread(sysex_files[i], 1, sizeof(sysex_files[i]), file);
+		fclose(file);
+	}
+	return 0;
+}
+
+static void load_sysex_corpus(int packet_size, int clock_interval)
+{
+	corpus.num_packets = 0;
+	corpus.num_bytes = 0;
+	for (int i = 0; i < NUM_SYSEX_FILES; i++) {
+		corpus_add_sysex(sysex_files[i], sysex_file_sizes[i], packet_size, clock_interval);
+	}
+}
+
+/* Returns the shortest time in seconds it took to parse the entire corpus. */
+static double time_parser()
+{
+	struct ble_midi_parser_t parser;
+	ble_midi_parser_init(&parser, &parse_cb);
+	double best = 1e9;
+	double bench_start = now_s();
+	while (now_s() - bench_start < BENCH_MIN_DURATION_S) {
+		double start = now_s();
+		for (int i = 0; i < corpus.num_packets; i++) {
+			ble_midi_parser_feed(&parser, corpus.bytes[i], corpus.sizes[i]);
+		}
+		double elapsed = now_s() - start;
+		best = elapsed < best ? elapsed : best;
+	}
+	return best;
+}
+
+static void bench_parser(const char *desc)
+{
+	double elapsed = time_parser();
+	double packets_per_s = corpus.num_packets / elapsed;
+	double bytes_per_s = corpus.num_bytes / elapsed;
+	printf("    %-44s %5d packets %7.0f kpackets/s %8.1f MB/s\n", desc, corpus.num_packets,
+	       packets_per_s / 1e3, bytes_per_s / 1e6);
+}
+
+/* Fills the corpus with note on/off pairs on one channel, eight messages per ms, written
+   with running status and note off as note on. */
+static void encode_note_storm()
+{
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 1, 1);
+	corpus.num_packets = 0;
+	corpus.num_bytes = 0;
+	for (int i = 0; i < MAX_PACKET_COUNT * 32 && corpus.num_packets < MAX_PACKET_COUNT - 1; i++) {
+		uint8_t msg[3] = {i & 1 ? 0x80 : 0x90, 0x30 + (i / 2) % 24, 0x40};
+		uint16_t timestamp = (i / 8) & 0x1fff;
+		if (ble_midi_writer_add_msg(&writer, msg, timestamp) ==
+		    BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
+			corpus_add_packet(&writer);
+			ble_midi_writer_add_msg(&writer, msg, timestamp);
+		}
+	}
+	corpus_add_packet(&writer);
+}
+
+/* Fills the corpus with timing clock messages at 120 bpm, one per packet as they would be
+   sent at typical connection intervals. */
+static void encode_clock_stream()
+{
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 1, 1);
+	corpus.num_packets = 0;
+	corpus.num_bytes = 0;
+	uint8_t clock[3] = {0xf8, 0, 0};
+	for (int i = 0; i < MAX_PACKET_COUNT; i++) {
+		ble_midi_writer_add_msg(&writer, clock, (i * 125 / 6) & 0x1fff);
+		corpus_add_packet(&writer);
+	}
+}
+
+static int sysex_packet_size;
+
+static void encode_sysex_files()
+{
+	load_sysex_corpus(sysex_packet_size, 0);
+}
+
+/* Reports writer and parser throughput for the traffic produced by encode. */
+static void bench_throughput(const char *desc, void (*encode)())
+{
+	double best = 1e9;
+	double bench_start = now_s();
+	while (now_s() - bench_start < BENCH_MIN_DURATION_S) {
+		double start = now_s();
+		encode();
+		double elapsed = now_s() - start;
+		best = elapsed < best ? elapsed : best;
+	}
+	double parser_elapsed = time_parser();
+	printf("    %-30s %5d packets, writer %6.0f kpackets/s %6.1f MB/s, parser %6.0f "
+	       "kpackets/s %6.1f MB/s\n",
+	       desc, corpus.num_packets, corpus.num_packets / best / 1e3,
+	       corpus.num_bytes / best / 1e6, corpus.num_packets / parser_elapsed / 1e3,
+	       corpus.num_bytes / parser_elapsed / 1e6);
+}
+
+#define SYSEX_WRITER_NUM_DATA_BYTES 4096
+
+/* Times wrapping a large sysex message into packets of the given size. */
+static void bench_sysex_writer(int packet_size)
+{
+	static uint8_t data_bytes[SYSEX_WRITER_NUM_DATA_BYTES];
+	for (int i = 0; i < SYSEX_WRITER_NUM_DATA_BYTES; i++) {
+		data_bytes[i] = (i * 7) & 0x7f;
+	}
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 1, 0);
+	writer.tx_buf_max_size = packet_size;
+
+	double best = 1e9;
+	double bench_start = now_s();
+	while (now_s() - bench_start < BENCH_MIN_DURATION_S) {
+		double start = now_s();
+		for (int rep = 0; rep < 16; rep++) {
+			ble_midi_writer_reset(&writer);
+			ble_midi_writer_start_sysex_msg(&writer, 0);
+			int pos = 0;
+			while (pos < SYSEX_WRITER_NUM_DATA_BYTES) {
+				int num_added = ble_midi_writer_add_sysex_data(
+					&writer, &data_bytes[pos], SYSEX_WRITER_NUM_DATA_BYTES - pos, 0);
+				pos += num_added;
+				if (pos < SYSEX_WRITER_NUM_DATA_BYTES) {
+					ble_midi_writer_reset(&writer);
+				}
+			}
+		}
+		double elapsed = (now_s() - start) / 16;
+		best = elapsed < best ? elapsed : best;
+	}
+	char desc[64];
+	snprintf(desc, sizeof(desc), "sysex data, %d byte packets", packet_size);
+	printf("    %-44s %7.1f MB/s\n", desc, SYSEX_WRITER_NUM_DATA_BYTES / best / 1e6);
+}
+
+#define NUM_MIX_MSGS 4096
+
+/* Non-sysex messages used for the writer and parser per message benchmarks. */
+static uint8_t mix_msgs[NUM_MIX_MSGS][3];
+
+/* Fills mix_msgs with a pseudo random mix of message types. note_pct, cc_pct and
+   clock_pct are the percentages of note on/off, control change and clock messages. */
+static void generate_msg_mix(int note_pct, int cc_pct, int clock_pct)
+{
+	uint32_t seed = 1;
+	for (int i = 0; i < NUM_MIX_MSGS; i++) {
+		seed = seed * 1103515245 + 12345;
+		int r = (seed >> 16) % 100;
+		uint8_t channel = (seed >> 8) & 0x1;
+		uint8_t *msg = mix_msgs[i];
+		if (r < note_pct) {
+			msg[0] = ((seed >> 4) & 1 ? 0x90 : 0x80) | channel;
+			msg[1] = 0x30 + (seed >> 24) % 24;
+			msg[2] = 0x40;
+		} else if (r < note_pct + cc_pct) {
+			msg[0] = 0xb0 | channel;
+			msg[1] = 0x01;
+			msg[2] = (seed >> 20) & 0x7f;
+		} else if (r < note_pct + cc_pct + clock_pct) {
+			msg[0] = 0xf8;
+			msg[1] = 0;
+			msg[2] = 0;
+		} else {
+			msg[0] = 0xe0 | channel;
+			msg[1] = (seed >> 12) & 0x7f;
+			msg[2] = (seed >> 20) & 0x7f;
+		}
+	}
+}
+
+/* Encodes mix_msgs into the corpus, advancing the timestamp every 4 messages. */
+static void encode_msg_mix(struct ble_midi_writer_t *writer)
+{
+	corpus.num_packets = 0;
+	corpus.num_bytes = 0;
+	ble_midi_writer_reset(writer);
+	for (int i = 0; i < NUM_MIX_MSGS; i++) {
+		uint16_t timestamp = (i / 4) & 0x1fff;
+		if (ble_midi_writer_add_msg(writer, mix_msgs[i], timestamp) ==
+		    BLE_MIDI_PACKET_ERROR_PACKET_FULL) {
+			corpus_add_packet(writer);
+			ble_midi_writer_add_msg(writer, mix_msgs[i], timestamp);
+		}
+	}
+	corpus_add_packet(writer);
+}
+
+/* Same as encode_msg_mix, but adds each run of 4 messages sharing a timestamp at once. */
+static void encode_msg_mix_runs(struct ble_midi_writer_t *writer)
+{
+	corpus.num_packets = 0;
+	corpus.num_bytes = 0;
+	ble_midi_writer_reset(writer);
+	for (int i = 0; i < NUM_MIX_MSGS; i += 4) {
+		uint16_t timestamp = (i / 4) & 0x1fff;
+		int num_added = 0;
+		while (num_added < 4) {
+			num_added += ble_midi_writer_add_msgs(writer, &mix_msgs[i + num_added],
+							      4 - num_added, timestamp);
+			if (num_added < 4) {
+				corpus_add_packet(writer);
+			}
+		}
+	}
+	corpus_add_packet(writer);
+}
+
+static void bench_msg_mix(const char *desc, int note_pct, int cc_pct, int clock_pct)
+{
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, BENCH_RUNNING_STATUS, BENCH_NOTE_OFF_AS_NOTE_ON);
+	generate_msg_mix(note_pct, cc_pct, clock_pct);
+
+	uint64_t best_writer_cycles = UINT64_MAX;
+	uint64_t best_run_writer_cycles = UINT64_MAX;
+	uint64_t best_parser_cycles = UINT64_MAX;
+	double bench_start = now_s();
+	while (now_s() - bench_start < BENCH_MIN_DURATION_S) {
+		uint64_t start = now_cycles();
+		encode_msg_mix_runs(&writer);
+		uint64_t run_writer_cycles = now_cycles() - start;
+		best_run_writer_cycles = run_writer_cycles < best_run_writer_cycles
+						 ? run_writer_cycles
+						 : best_run_writer_cycles;
+
+		start = now_cycles();
+		encode_msg_mix(&writer);
+		uint64_t writer_cycles = now_cycles() - start;
+		best_writer_cycles =
+			writer_cycles < best_writer_cycles ? writer_cycles : best_writer_cycles;
+
+		struct ble_midi_parser_t parser;
+		ble_midi_parser_init(&parser, &parse_cb);
+		start = now_cycles();
+		for (int i = 0; i < corpus.num_packets; i++) {
+			ble_midi_parser_feed(&parser, corpus.bytes[i], corpus.sizes[i]);
+		}
+		uint64_t parser_cycles = now_cycles() - start;
+		best_parser_cycles =
+			parser_cycles < best_parser_cycles ? parser_cycles : best_parser_cycles;
+	}
+
+	printf("    %-36s writer %5.1f (runs of 4 %5.1f) parser %5.1f cycles/msg, %4.2f bytes/msg\n",
+	       desc, (double)best_writer_cycles / NUM_MIX_MSGS,
+	       (double)best_run_writer_cycles / NUM_MIX_MSGS,
+	       (double)best_parser_cycles / NUM_MIX_MSGS, (double)corpus.num_bytes / NUM_MIX_MSGS);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *sysex_dir = argc > 1 ? argv[1] : "../test_sysex_data";
+	int packet_sizes[] = {20, BLE_MIDI_TX_PACKET_MAX_SIZE};
+
+	if (load_sysex_files(sysex_dir)) {
+		return 1;
+	}
+
+	printf("Writer and parser throughput\n");
+	bench_throughput("running status note storm", encode_note_storm);
+	bench_throughput("clock stream", encode_clock_stream);
+	for (int i = 0; i < 2; i++) {
+		char desc[64];
+		sysex_packet_size = packet_sizes[i];
+		snprintf(desc, sizeof(desc), "sysex files, %d byte packets", packet_sizes[i]);
+		bench_throughput(desc, encode_sysex_files);
+	}
+
+	printf("Parser, test_sysex_data corpus\n");
+	for (int i = 0; i < 2; i++) {
+		char desc[64];
+		load_sysex_corpus(packet_sizes[i], 0);
+		snprintf(desc, sizeof(desc), "sysex, %d byte packets", packet_sizes[i]);
+		bench_parser(desc);
+
+		load_sysex_corpus(packet_sizes[i], 16);
+		snprintf(desc, sizeof(desc), "sysex + clock, %d byte packets", packet_sizes[i]);
+		bench_parser(desc);
+	}
+
+	printf("Writer, %d byte sysex message\n", SYSEX_WRITER_NUM_DATA_BYTES);
+	for (int i = 0; i < 2; i++) {
+		bench_sysex_writer(packet_sizes[i]);
+	}
+
+	printf("Writer and parser, %d byte packets, running status %d, note off as note on %d\n",
+	       BLE_MIDI_TX_PACKET_MAX_SIZE, BENCH_RUNNING_STATUS, BENCH_NOTE_OFF_AS_NOTE_ON);
+	bench_msg_mix("notes", 100, 0, 0);
+	bench_msg_mix("notes + CC", 50, 50, 0);
+	bench_msg_mix("notes + CC + clock", 40, 30, 30);
+	bench_msg_mix("notes + CC + clock + pitch bend", 30, 20, 20);
+
+	return 0;
+}
@@ -113,7 +113,7 @@ void assert_equals(int actual, int expected)
 static int num_parsed_messages = 0;
 static midi_msg_t parsed_messages[100];
 
-void midi_message_cb(uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
+void midi_message_cb(void *user_data, uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
 {
 	for (int i = 0; i < 3; i++) {
 		parsed_messages[num_parsed_messages].bytes[i] = i < num_bytes ? bytes[i] : 0;
@@ -123,7 +123,7 @@ void midi_message_cb(uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
 	assert(num_parsed_messages < 100);
 }
 
-void sysex_start_cb(uint16_t timestamp)
+void sysex_start_cb(void *user_data, uint16_t timestamp)
 {
 	midi_msg_t *msg = &parsed_messages[num_parsed_messages];
 	msg->bytes[0] = SYSEX_START;
@@ -134,7 +134,7 @@ void sysex_start_cb(uint16_t timestamp)
 	assert(num_parsed_messages < 100);
 }
 
-void sysex_data_cb(uint8_t data_byte)
+void sysex_data_cb(void *user_data, uint8_t data_byte)
 {
 	parsed_messages[num_parsed_messages].bytes[0] = data_byte;
 	parsed_messages[num_parsed_messages].bytes[1] = 0;
@@ -143,7 +143,7 @@ void sysex_data_cb(uint8_t data_byte)
 	assert(num_parsed_messages < 100);
 }
 
-void sysex_end_cb(uint16_t timestamp)
+void sysex_end_cb(void *user_data, uint16_t timestamp)
 {
 	midi_msg_t *msg = &parsed_messages[num_parsed_messages];
 	msg->bytes[0] = SYSEX_END;
@@ -530,6 +530,61 @@ void test_null_parse_callbacks()
 	ble_midi_parse_packet(payload, sizeof(payload), &cb);
 }
 
+static void test_sysex_end_first_in_packet()
+{
+	printf("A packet starting with sysex end should end a sysex message from a previous packet\n\n");
+	uint8_t payload[] = {
+		0x80,			// packet header
+		0x8a, 0xf8,		// timing clock
+		0x8b, SYSEX_END,	// sysex end
+		0x8c, 0x90, 0x69, 0x7f, // note on
+	};
+	num_parsed_messages = 0;
+	assert_success(ble_midi_parse_packet(payload, sizeof(payload), &ble_midi_parse_cb));
+	assert_equals(num_parsed_messages, 3);
+	assert_equals(parsed_messages[0].bytes[0], 0xf8);
+	assert_equals(parsed_messages[1].bytes[0], SYSEX_END);
+	assert_equals(parsed_messages[1].timestamp, 11);
+	assert_equals(parsed_messages[2].bytes[0], 0x90);
+}
+
+static void test_persistent_parser()
+{
+	printf("A persistent parser should carry sysex state between packets\n\n");
+	struct ble_midi_parser_t parser;
+	ble_midi_parser_init(&parser, &ble_midi_parse_cb);
+
+	uint8_t payload_1[] = {0x80, 0x8a, SYSEX_START, 0x01, 0x02};
+	uint8_t payload_2[] = {0x80, 0x8b, 0xf8, 0x03, 0x04};
+	uint8_t payload_3[] = {0x80, 0x8c, SYSEX_END, 0x8c, 0x90, 0x69, 0x7f};
+	num_parsed_messages = 0;
+	assert_success(ble_midi_parser_feed(&parser, payload_1, sizeof(payload_1)));
+	assert_equals(parser.in_sysex_msg, 1);
+	assert_success(ble_midi_parser_feed(&parser, payload_2, sizeof(payload_2)));
+	assert_equals(parser.in_sysex_msg, 1);
+	assert_success(ble_midi_parser_feed(&parser, payload_3, sizeof(payload_3)));
+	assert_equals(parser.in_sysex_msg, 0);
+	assert_equals(num_parsed_messages, 8);
+	assert_equals(parsed_messages[3].bytes[0], 0xf8);
+	assert_equals(parsed_messages[6].bytes[0], SYSEX_END);
+
+	printf("Data bytes outside of a sysex message should be rejected by a synchronized parser\n\n");
+	uint8_t stray_data[] = {0x80, 0x01, 0x02};
+	assert_error_code(ble_midi_parser_feed(&parser, stray_data, sizeof(stray_data)),
+			  BLE_MIDI_PACKET_ERROR_UNEXPECTED_DATA_BYTE);
+	assert_equals(parser.num_errors, 1);
+
+	printf("The parser should resynchronize after an error\n\n");
+	num_parsed_messages = 0;
+	assert_success(ble_midi_parser_feed(&parser, payload_2, sizeof(payload_2)));
+	assert_equals(parser.in_sysex_msg, 1);
+	assert_equals(num_parsed_messages, 3);
+
+	ble_midi_parser_reset(&parser);
+	assert_equals(parser.in_sysex_msg, 0);
+	assert_equals(parser.num_errors, 0);
+}
+
 static void test_parse_malformed_sysex_message()
 {
 	printf("Parsing malformed sysex message should not segfault \n\n");
@@ -561,6 +616,390 @@ static void test_parse_invalid_status_in_sysex_message()
 	assert_error_code(ble_midi_parse_packet(payload, sizeof(payload), &ble_midi_parse_cb), BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE);
 }
 
+static void midi_message_batch_cb(void *user_data, const struct ble_midi_message_t *msgs, uint32_t num_msgs)
+{
+	for (int i = 0; i < num_msgs; i++) {
+		midi_message_cb(user_data, (uint8_t *)msgs[i].bytes, msgs[i].num_bytes, msgs[i].timestamp);
+	}
+}
+
+static void test_batch_parse()
+{
+	printf("Batched messages should be delivered in order, interleaved with sysex\n\n");
+	uint8_t payload[] = {
+		0x80,			// packet header
+		0x8a, 0x90, 0x69, 0x7f, // note on
+		0x69, 0x00,		// note off, running status
+		0x8b, 0xc0, 0x05,	// program change
+		0x8c, SYSEX_START,	// sysex start
+		0x01,			// sysex data
+		0x8c, SYSEX_END,	// sysex end
+		0x8d, 0xf8,		// timing clock
+	};
+	midi_msg_t expected[] = {
+		{.bytes = {0x90, 0x69, 0x7f}, .timestamp = 10},
+		{.bytes = {0x90, 0x69, 0x00}, .timestamp = 10},
+		{.bytes = {0xc0, 0x05, 0x00}, .timestamp = 11},
+		{.bytes = {SYSEX_START, 0, 0}, .timestamp = 12},
+		{.bytes = {0x01, 0, 0}, .timestamp = 0},
+		{.bytes = {SYSEX_END, 0, 0}, .timestamp = 12},
+		{.bytes = {0xf8, 0, 0}, .timestamp = 13},
+	};
+
+	/* Use a small batch buffer to also test handing over full batches. */
+	struct ble_midi_message_t batch_buf[2];
+	struct ble_midi_parse_cb_t cb = {.sysex_data_cb = sysex_data_cb,
+					 .sysex_start_cb = sysex_start_cb,
+					 .sysex_end_cb = sysex_end_cb,
+					 .midi_message_batch_cb = midi_message_batch_cb,
+					 .batch_buf = batch_buf,
+					 .batch_buf_size = 2};
+	num_parsed_messages = 0;
+	assert_success(ble_midi_parse_packet(payload, sizeof(payload), &cb));
+	assert_equals(num_parsed_messages, sizeof(expected) / sizeof(midi_msg_t));
+	for (int i = 0; i < num_parsed_messages; i++) {
+		assert_midi_msg_equals(&parsed_messages[i], &expected[i]);
+	}
+	printf("\n");
+}
+
+static int num_sysex_spans = 0;
+
+static void sysex_data_span_cb(void *user_data, const uint8_t *data_bytes, uint32_t num_data_bytes)
+{
+	num_sysex_spans++;
+	for (int i = 0; i < num_data_bytes; i++) {
+		sysex_data_cb(user_data, data_bytes[i]);
+	}
+}
+
+static void test_sysex_data_spans()
+{
+	printf("Sysex data bytes should be reported in spans between real time messages\n\n");
+	uint8_t payload[] = {
+		0x80,			// packet header
+		0x8a, SYSEX_START,	// sysex start
+		0x01, 0x02, 0x03,	// sysex data
+		0x8b, 0xf8,		// timing clock
+		0x04, 0x05,		// sysex data
+		0x8c, SYSEX_END,	// sysex end
+	};
+	struct ble_midi_parse_cb_t cb = {.midi_message_cb = midi_message_cb,
+					 .sysex_data_cb = sysex_data_cb,
+					 .sysex_start_cb = sysex_start_cb,
+					 .sysex_end_cb = sysex_end_cb,
+					 .sysex_data_span_cb = sysex_data_span_cb};
+	num_parsed_messages = 0;
+	num_sysex_spans = 0;
+	assert_success(ble_midi_parse_packet(payload, sizeof(payload), &cb));
+	assert_equals(num_sysex_spans, 2);
+	assert_equals(num_parsed_messages, 8);
+	assert_equals(parsed_messages[3].bytes[0], 0x03);
+	assert_equals(parsed_messages[4].bytes[0], 0xf8);
+	assert_equals(parsed_messages[6].bytes[0], 0x05);
+}
+
+static uint32_t batch_sender_times[8];
+static uint32_t num_batch_sender_times = 0;
+
+static void sender_time_batch_cb(void *user_data, const struct ble_midi_message_t *msgs, uint32_t num_msgs)
+{
+	for (int i = 0; i < num_msgs; i++) {
+		batch_sender_times[num_batch_sender_times++] = msgs[i].sender_time;
+	}
+}
+
+static void test_sender_time()
+{
+	printf("Timestamps should be unwrapped into sender times across packets and gaps\n\n");
+	struct ble_midi_message_t batch_buf[4];
+	struct ble_midi_parse_cb_t cb = {.midi_message_batch_cb = sender_time_batch_cb,
+					 .batch_buf = batch_buf,
+					 .batch_buf_size = 4};
+	struct rx_clock clock;
+	rx_clock_init(&clock);
+	struct ble_midi_parser_t parser;
+	ble_midi_parser_init(&parser, &cb);
+	ble_midi_parser_set_clock(&parser, &clock);
+
+	/* Timestamp 8190, then 8191 and a wrap to 1 within the same packet. */
+	uint8_t payload_1[] = {0xbf, 0xfe, 0xf8, 0xff, 0xf8, 0x81, 0xf8};
+	/* Timestamp 10 after 20 s of silence, i.e 8192 * 3 + 10 - 1 ms later. */
+	uint8_t payload_2[] = {0x80, 0x8a, 0xf8};
+	num_batch_sender_times = 0;
+	assert_success(ble_midi_parser_feed_at(&parser, payload_1, sizeof(payload_1), 1000));
+	assert_success(ble_midi_parser_feed_at(&parser, payload_2, sizeof(payload_2),
+					       1000 + 8192 * 3 + 10 - 1));
+	assert_equals(num_batch_sender_times, 4);
+	assert_equals(batch_sender_times[0], 8190);
+	assert_equals(batch_sender_times[1], 8191);
+	assert_equals(batch_sender_times[2], 8192 + 1);
+	assert_equals(batch_sender_times[3], 8192 * 4 + 10);
+	assert_equals(parser.sender_time, 8192 * 4 + 10);
+
+	ble_midi_parser_reset(&parser);
+	assert_equals(clock.is_synced, 0);
+}
+
+static void test_sysex_status_byte_at_any_offset()
+{
+	printf("Status bytes in sysex data should be found at any offset\n\n");
+	uint8_t data_bytes[40];
+	for (int pos = 0; pos < sizeof(data_bytes); pos++) {
+		for (int i = 0; i < sizeof(data_bytes); i++) {
+			data_bytes[i] = i == pos ? 0xf8 : i;
+		}
+		struct ble_midi_writer_t writer;
+		ble_midi_writer_init(&writer, 0, 0);
+		ble_midi_writer_start_sysex_msg(&writer, 0);
+		assert_error_code(ble_midi_writer_add_sysex_data(&writer, data_bytes, sizeof(data_bytes), 0),
+				  BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE);
+
+		/* A timestamped real time message splits the data span in the parser. */
+		uint8_t payload[3 + sizeof(data_bytes)];
+		int payload_size = 0;
+		payload[payload_size++] = 0x80;
+		for (int i = 0; i < sizeof(data_bytes); i++) {
+			if (i == pos) {
+				payload[payload_size++] = 0x80;
+			}
+			payload[payload_size++] = data_bytes[i];
+		}
+		struct ble_midi_parse_cb_t cb = {.midi_message_cb = midi_message_cb,
+						 .sysex_data_span_cb = sysex_data_span_cb};
+		struct ble_midi_parser_t parser;
+		ble_midi_parser_init(&parser, &cb);
+		parser.in_sysex_msg = 1;
+		parser.sysex_state_known = 1;
+		num_parsed_messages = 0;
+		num_sysex_spans = 0;
+		assert_success(ble_midi_parser_feed(&parser, payload, payload_size));
+		assert_equals(num_sysex_spans, pos == 0 || pos == sizeof(data_bytes) - 1 ? 1 : 2);
+		assert_equals(num_parsed_messages, sizeof(data_bytes));
+	}
+}
+
+static void test_timestamp_gap_needs_new_packet()
+{
+	printf("Timestamps 128 ms or more after the latest one in the packet should need a new packet\n");
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 0, 0);
+	uint8_t note_on[3] = {0x90, 0x69, 0x7f};
+	uint8_t clock[3] = {0xf8, 0, 0};
+	uint8_t sysex_data[2] = {0x01, 0x02};
+
+	/* The header only holds the high bits of the timestamp, so the packet can reach up
+	   to 127 ms past the start of the header's 128 ms range. */
+	assert_success(ble_midi_writer_start_sysex_msg(&writer, 0));
+	assert_equals(ble_midi_writer_add_sysex_data(&writer, sysex_data, sizeof(sysex_data), 100),
+		      sizeof(sysex_data));
+	assert_success(ble_midi_writer_end_sysex_msg(&writer, 127));
+	assert_success(ble_midi_writer_add_msg(&writer, note_on, 254));
+	assert_error_code(ble_midi_writer_add_msg(&writer, note_on, 382),
+			  BLE_MIDI_PACKET_ERROR_PACKET_FULL);
+
+	/* A new packet starting with sysex data has no timestamp byte */
+	ble_midi_writer_reset(&writer);
+	assert_success(ble_midi_writer_start_sysex_msg(&writer, 1000));
+	ble_midi_writer_reset(&writer);
+	assert_equals(ble_midi_writer_add_sysex_data(&writer, sysex_data, sizeof(sysex_data), 1000),
+		      sizeof(sysex_data));
+	assert_error_code(ble_midi_writer_add_msg(&writer, clock, 1027),
+			  BLE_MIDI_PACKET_ERROR_PACKET_FULL);
+	assert_error_code(ble_midi_writer_end_sysex_msg(&writer, 1027),
+			  BLE_MIDI_PACKET_ERROR_PACKET_FULL);
+	assert_success(ble_midi_writer_end_sysex_msg(&writer, 1023));
+	printf("\n");
+}
+
+static void test_rt_first_in_sysex_continuation_packet()
+{
+	printf("A real time message starting a sysex continuation packet should get a header\n");
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 0, 0);
+	assert_success(ble_midi_writer_start_sysex_msg(&writer, 0));
+	ble_midi_writer_reset(&writer);
+	uint8_t clock[3] = {0xf8, 0, 0};
+	assert_success(ble_midi_writer_add_msg(&writer, clock, 130));
+	uint8_t expected_payload[] = {0x81, 0x82, 0xf8};
+	assert_payload_equals(&writer, expected_payload, sizeof(expected_payload));
+	printf("\n");
+}
+
+static void test_add_msgs()
+{
+	printf("Adding several messages at once should give the same packet as adding them one by one\n");
+	const uint8_t msgs[][3] = {{0x90, 0x3c, 0x7f}, {0x90, 0x40, 0x7f}, {0xf8, 0x00, 0x00},
+				   {0x80, 0x43, 0x00}, {0xb0, 0x01, 0x12}, {0xc0, 0x05, 0x00}};
+	int num_msgs = sizeof(msgs) / sizeof(msgs[0]);
+	for (int config = 0; config < 4; config++) {
+		struct ble_midi_writer_t expected;
+		ble_midi_writer_init(&expected, config & 1, config >> 1);
+		struct ble_midi_writer_t writer;
+		ble_midi_writer_init(&writer, config & 1, config >> 1);
+		for (int rep = 0; rep < 2; rep++) {
+			for (int i = 0; i < num_msgs; i++) {
+				uint8_t bytes[3] = {msgs[i][0], msgs[i][1], msgs[i][2]};
+				assert_success(ble_midi_writer_add_msg(&expected, bytes, 10 + rep));
+			}
+			assert_equals(ble_midi_writer_add_msgs(&writer, msgs, num_msgs, 10 + rep),
+				      num_msgs);
+		}
+		assert_payload_equals(&writer, expected.tx_buf, expected.tx_buf_size);
+	}
+
+	/* Messages that do not fit are left out */
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 0, 0);
+	writer.tx_buf_max_size = 10;
+	assert_equals(ble_midi_writer_add_msgs(&writer, msgs, num_msgs, 0), 2);
+	uint8_t expected_payload[] = {0x80, 0x80, 0x90, 0x3c, 0x7f, 0x80, 0x90, 0x40, 0x7f};
+	assert_payload_equals(&writer, expected_payload, sizeof(expected_payload));
+
+	/* An invalid message fails the whole run */
+	const uint8_t invalid_msgs[][3] = {{0x90, 0x3c, 0x7f}, {0x90, 0x80, 0x7f}};
+	ble_midi_writer_reset(&writer);
+	assert_error_code(ble_midi_writer_add_msgs(&writer, invalid_msgs, 2, 0),
+			  BLE_MIDI_PACKET_ERROR_INVALID_DATA_BYTE);
+	assert_equals(writer.tx_buf_size, 0);
+	printf("\n");
+}
+
+static void test_add_sysex_msg()
+{
+	printf("A complete sysex message should share the packet with other messages\n");
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 1, 0);
+	writer.tx_buf_max_size = 20;
+	uint8_t note_on[3] = {0x90, 0x3c, 0x7f};
+	const uint8_t sysex_msg[] = {0xf0, 0x7e, 0x7f, 0x06, 0x01, 0xf7};
+	assert_success(ble_midi_writer_add_msg(&writer, note_on, 1));
+	assert_success(ble_midi_writer_add_sysex_msg(&writer, sysex_msg, sizeof(sysex_msg), 2));
+	/* The sysex message cancels running status */
+	assert_success(ble_midi_writer_add_msg(&writer, note_on, 2));
+	uint8_t expected_payload[] = {0x80, 0x81, 0x90, 0x3c, 0x7f, 0x82, 0xf0, 0x7e,
+				      0x7f, 0x06, 0x01, 0x82, 0xf7, 0x82, 0x90, 0x3c, 0x7f};
+	assert_payload_equals(&writer, expected_payload, sizeof(expected_payload));
+
+	/* Out of room */
+	assert_error_code(ble_midi_writer_add_sysex_msg(&writer, sysex_msg, sizeof(sysex_msg), 2),
+			  BLE_MIDI_PACKET_ERROR_PACKET_FULL);
+
+	/* Not allowed inside another sysex message */
+	ble_midi_writer_reset(&writer);
+	assert_success(ble_midi_writer_start_sysex_msg(&writer, 3));
+	assert_error_code(ble_midi_writer_add_sysex_msg(&writer, sysex_msg, sizeof(sysex_msg), 3),
+			  BLE_MIDI_PACKET_ERROR_ALREADY_IN_SYSEX_SEQUENCE);
+	printf("\n");
+}
+
+static void test_checkpoint_rollback()
+{
+	printf("Rolling back to a checkpoint should undo everything added after it\n");
+	for (int config = 0; config < 4; config++) {
+		struct ble_midi_writer_t expected;
+		ble_midi_writer_init(&expected, config & 1, config >> 1);
+		struct ble_midi_writer_t writer;
+		ble_midi_writer_init(&writer, config & 1, config >> 1);
+		uint8_t note_on[3] = {0x90, 0x3c, 0x7f};
+		uint8_t note_off[3] = {0x80, 0x3c, 0x00};
+		uint8_t clock[3] = {0xf8, 0x00, 0x00};
+		struct ble_midi_writer_checkpoint_t checkpoint;
+
+		assert_success(ble_midi_writer_add_msg(&writer, note_on, 10));
+		ble_midi_writer_checkpoint(&writer, &checkpoint);
+		assert_success(ble_midi_writer_add_msg(&writer, note_off, 20));
+		assert_success(ble_midi_writer_start_sysex_msg(&writer, 30));
+		assert_success(ble_midi_writer_add_msg(&writer, clock, 140));
+		ble_midi_writer_rollback(&writer, &checkpoint);
+		assert_success(ble_midi_writer_add_msg(&writer, note_on, 11));
+
+		assert_success(ble_midi_writer_add_msg(&expected, note_on, 10));
+		assert_success(ble_midi_writer_add_msg(&expected, note_on, 11));
+		assert_payload_equals(&writer, expected.tx_buf, expected.tx_buf_size);
+		assert_equals(writer.in_sysex_msg, 0);
+	}
+	printf("\n");
+}
+
+static void test_add_msgs_reordered()
+{
+	printf("Reordering simultaneous messages should maximize running status\n");
+	/* Two chords on two channels, interleaved, with a control change on channel 1 that must
+	   stay after the note on channel 1 that precedes it */
+	const uint8_t msgs[][3] = {{0x90, 0x3c, 0x7f}, {0x91, 0x40, 0x7f}, {0x90, 0x43, 0x7f},
+				   {0xb1, 0x01, 0x12}, {0x91, 0x47, 0x7f}, {0x90, 0x48, 0x7f}};
+	int num_msgs = sizeof(msgs) / sizeof(msgs[0]);
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 1, 0);
+	uint32_t num_bytes_saved = 0;
+	assert_equals(ble_midi_writer_add_msgs_reordered(&writer, msgs, num_msgs, 0, &num_bytes_saved),
+		      num_msgs);
+	/* 90 3c, 90 43, 90 48, 91 40, b1 01, 91 47: the channel 1 note after the control change
+	   can't be moved ahead of it */
+	uint8_t expected_payload[] = {0x80, 0x80, 0x90, 0x3c, 0x7f, 0x43, 0x7f, 0x48, 0x7f,
+				      0x80, 0x91, 0x40, 0x7f, 0x80, 0xb1, 0x01, 0x12,
+				      0x80, 0x91, 0x47, 0x7f};
+	assert_payload_equals(&writer, expected_payload, sizeof(expected_payload));
+	/* In the original order, every message needs a timestamp and a status byte */
+	assert_equals(num_bytes_saved, 1 + 4 * num_msgs - sizeof(expected_payload));
+
+	/* If not all reordered messages fit, the added ones should be the first ones */
+	ble_midi_writer_reset(&writer);
+	writer.tx_buf_max_size = 12;
+	assert_equals(ble_midi_writer_add_msgs_reordered(&writer, msgs, num_msgs, 0, &num_bytes_saved),
+		      3);
+	uint8_t expected_partial_payload[] = {0x80, 0x80, 0x90, 0x3c, 0x7f, 0x43, 0x7f,
+					      0x80, 0x91, 0x40, 0x7f};
+	assert_payload_equals(&writer, expected_partial_payload, sizeof(expected_partial_payload));
+
+	/* System messages stay in place */
+	const uint8_t msgs_with_clock[][3] = {{0x90, 0x3c, 0x7f}, {0x91, 0x40, 0x7f},
+					      {0xf8, 0x00, 0x00}, {0x90, 0x43, 0x7f}};
+	ble_midi_writer_init(&writer, 1, 0);
+	assert_equals(ble_midi_writer_add_msgs_reordered(&writer, msgs_with_clock, 4, 0,
+							 &num_bytes_saved),
+		      4);
+	assert_equals(num_bytes_saved, 0);
+	assert_equals(writer.tx_buf[writer.tx_buf_size - 5], 0xf8);
+	printf("\n");
+}
+
+static void test_bytes_needed()
+{
+	printf("The number of bytes needed for a message should follow the packet encoding rules\n");
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, 1, 1);
+	uint8_t note_on[3] = {0x90, 0x3c, 0x7f};
+	uint8_t note_off[3] = {0x80, 0x3c, 0x00};
+	uint8_t clock[3] = {0xf8, 0, 0};
+	uint8_t sysex_start[3] = {0xf0, 0, 0};
+	uint8_t sysex_end[3] = {0xf7, 0, 0};
+
+	/* Header, timestamp, status and two data bytes */
+	assert_equals(ble_midi_writer_bytes_needed(&writer, note_on, 0), 5);
+	assert_success(ble_midi_writer_add_msg(&writer, note_on, 0));
+	/* Running status, same timestamp. A note off is sent as a note on. */
+	assert_equals(ble_midi_writer_bytes_needed(&writer, note_off, 0), 2);
+	/* Running status, new timestamp */
+	assert_equals(ble_midi_writer_bytes_needed(&writer, note_on, 1), 3);
+	assert_equals(ble_midi_writer_bytes_needed(&writer, clock, 1), 2);
+	assert_equals(ble_midi_writer_bytes_needed(&writer, sysex_start, 1), 2);
+	assert_error_code(ble_midi_writer_bytes_needed(&writer, sysex_end, 1),
+			  BLE_MIDI_PACKET_ERROR_NOT_IN_SYSEX_SEQUENCE);
+	assert_error_code(ble_midi_writer_bytes_needed(&writer, note_on, 128),
+			  BLE_MIDI_PACKET_ERROR_PACKET_FULL);
+
+	assert_success(ble_midi_writer_start_sysex_msg(&writer, 1));
+	assert_equals(ble_midi_writer_bytes_needed(&writer, clock, 1), 2);
+	assert_equals(ble_midi_writer_bytes_needed(&writer, sysex_end, 1), 2);
+	assert_error_code(ble_midi_writer_bytes_needed(&writer, note_on, 1),
+			  BLE_MIDI_PACKET_ERROR_INVALID_STATUS_BYTE);
+	ble_midi_writer_reset(&writer);
+	assert_equals(ble_midi_writer_bytes_needed(&writer, sysex_end, 1), 3);
+	printf("\n");
+}
+
 int main(int argc, char *argv[])
 {
 	test_timestamp_byte_wrapping();
@@ -576,9 +1015,22 @@ int main(int argc, char *argv[])
 	test_multi_packet_sysex();
 	test_disable_note_off_as_note_on();
 	test_sysex_continuation();
+	test_sysex_end_first_in_packet();
+	test_persistent_parser();
 	test_parse_malformed_sysex_message();
 	test_parse_invalid_status_in_sysex_message();
 	test_null_parse_callbacks();
+	test_batch_parse();
+	test_sysex_data_spans();
+	test_sysex_status_byte_at_any_offset();
+	test_sender_time();
+	test_timestamp_gap_needs_new_packet();
+	test_rt_first_in_sysex_continuation_packet();
+	test_add_msgs();
+	test_add_sysex_msg();
+	test_checkpoint_rollback();
+	test_add_msgs_reordered();
+	test_bytes_needed();
 
 	printf("");
 	if (num_failed_assertions == 0) {
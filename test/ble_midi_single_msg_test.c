@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <ble_midi/ble_midi.h>
+#include "../ble_midi/src/ble_midi_packet.h"
+
+// Tests ble_midi.c with CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG against the host stand-ins for
+// the Zephyr APIs in zephyr_stubs. Notifications are recorded instead of sent.
+
+void assert_true(int condition, const char* message) {
+    assert(condition && message);
+}
+
+void assert_eq(int a, int b, const char* message) {
+    assert(a == b && message);
+}
+
+// Zephyr stand-ins
+
+#define MAX_NOTIFIED_PACKETS 32
+#define MAX_NOTIFIED_PACKET_SIZE 256
+
+static uint8_t notified_packets[MAX_NOTIFIED_PACKETS][MAX_NOTIFIED_PACKET_SIZE];
+static int notified_packet_sizes[MAX_NOTIFIED_PACKETS];
+static int num_notified_packets = 0;
+static uint16_t mtu = 23;
+// Returned by bt_gatt_notify_cb once notify_rc_from_packet packets have been notified
+static int notify_rc = 0;
+static int notify_rc_from_packet = 0;
+
+int bt_gatt_notify_cb(struct bt_conn* conn, struct bt_gatt_notify_params* params) {
+    if (notify_rc && num_notified_packets >= notify_rc_from_packet) {
+        return notify_rc;
+    }
+    assert_true(num_notified_packets < MAX_NOTIFIED_PACKETS, "too many notifications");
+    assert_true(params->len <= MAX_NOTIFIED_PACKET_SIZE, "notification too long");
+    memcpy(notified_packets[num_notified_packets], params->data, params->len);
+    notified_packet_sizes[num_notified_packets] = params->len;
+    num_notified_packets++;
+    return 0;
+}
+
+uint16_t bt_gatt_get_mtu(struct bt_conn* conn) {
+    return mtu;
+}
+
+void bt_gatt_cb_register(struct bt_gatt_cb* cb) {
+}
+
+int bt_conn_get_info(const struct bt_conn* conn, struct bt_conn_info* info) {
+    info->le.interval = 6;
+    return 0;
+}
+
+int bt_conn_le_param_update(struct bt_conn* conn, const struct bt_le_conn_param* param) {
+    return 0;
+}
+
+int64_t k_uptime_get(void) {
+    return 0;
+}
+
+int64_t k_uptime_ticks(void) {
+    return 0;
+}
+
+uint64_t k_ticks_to_ms_near64(uint64_t ticks) {
+    return ticks;
+}
+
+extern const struct bt_conn_cb ble_midi_conn_callbacks;
+
+// Sysex data parsed from the notified packets
+static uint8_t parsed_sysex_data[256];
+static int num_parsed_sysex_data_bytes = 0;
+static int num_parsed_sysex_starts = 0;
+static int num_parsed_sysex_ends = 0;
+
+static void sysex_start_cb(void* user_data, uint16_t timestamp) {
+    num_parsed_sysex_starts++;
+}
+
+static void sysex_data_span_cb(void* user_data, const uint8_t* data_bytes, uint32_t num_data_bytes) {
+    memcpy(&parsed_sysex_data[num_parsed_sysex_data_bytes], data_bytes, num_data_bytes);
+    num_parsed_sysex_data_bytes += num_data_bytes;
+}
+
+static void sysex_end_cb(void* user_data, uint16_t timestamp) {
+    num_parsed_sysex_ends++;
+}
+
+static void parse_notified_packets() {
+    struct ble_midi_parse_cb_t cb = {
+        .sysex_start_cb = sysex_start_cb,
+        .sysex_data_span_cb = sysex_data_span_cb,
+        .sysex_end_cb = sysex_end_cb,
+    };
+    struct ble_midi_parser_t parser;
+    ble_midi_parser_init(&parser, &cb);
+    for (int i = 0; i < num_notified_packets; i++) {
+        ble_midi_parser_feed(&parser, notified_packets[i], notified_packet_sizes[i]);
+    }
+}
+
+static void test_tx_stream_sysex() {
+    // 20 byte packets
+    mtu = 23;
+    ble_midi_conn_callbacks.connected(NULL, 0);
+    num_notified_packets = 0;
+
+    uint8_t stream[42];
+    stream[0] = 0xf0;
+    for (int i = 1; i < sizeof(stream) - 1; i++) {
+        stream[i] = i;
+    }
+    stream[sizeof(stream) - 1] = 0xf7;
+    assert_eq(ble_midi_tx_stream(stream, sizeof(stream)), sizeof(stream), "the whole stream should be sent");
+
+    // Sysex start, two full packets of 19 data bytes, the last 2 data bytes and sysex end
+    assert_eq(num_notified_packets, 5, "every part of the sysex message should be notified");
+    assert_eq(notified_packet_sizes[0], 3, "sysex start should be notified with its timestamp");
+    assert_eq(notified_packet_sizes[1], 20, "a full sysex data packet should be notified as a whole");
+    assert_eq(notified_packet_sizes[2], 20, "a full sysex data packet should be notified as a whole");
+    assert_eq(notified_packet_sizes[3], 3, "the remaining sysex data should be notified with its header");
+    assert_eq(notified_packet_sizes[4], 3, "sysex end should be notified with its timestamp");
+
+    parse_notified_packets();
+    assert_eq(num_parsed_sysex_starts, 1, "one sysex message should be parsed");
+    assert_eq(num_parsed_sysex_ends, 1, "one sysex message should be parsed");
+    assert_eq(num_parsed_sysex_data_bytes, sizeof(stream) - 2, "all sysex data should be parsed");
+    assert_true(memcmp(parsed_sysex_data, &stream[1], sizeof(stream) - 2) == 0, "sysex data should be preserved");
+}
+
+static void test_tx_sysex_msg_send_errors() {
+    mtu = 23;
+    ble_midi_conn_callbacks.connected(NULL, 0);
+    num_notified_packets = 0;
+
+    const uint8_t short_sysex_msg[] = {0xf0, 0x01, 0x02, 0xf7};
+    uint8_t long_sysex_msg[64];
+    long_sysex_msg[0] = 0xf0;
+    for (int i = 1; i < sizeof(long_sysex_msg) - 1; i++) {
+        long_sysex_msg[i] = i;
+    }
+    long_sysex_msg[sizeof(long_sysex_msg) - 1] = 0xf7;
+
+    assert_eq(ble_midi_tx_sysex_msg(short_sysex_msg, sizeof(short_sysex_msg)), BLE_MIDI_SUCCESS, "a short sysex message should be sent");
+    assert_eq(num_notified_packets, 1, "a short sysex message should be sent in one packet");
+    assert_eq(ble_midi_tx_sysex_msg(long_sysex_msg, sizeof(long_sysex_msg)), BLE_MIDI_SUCCESS, "a long sysex message should be sent");
+    assert_true(num_notified_packets > 2, "a long sysex message should be sent in several packets");
+
+    // Send errors are reported as ble_midi_error_t, whether the message fits in a packet or not
+    notify_rc = -ENOMEM;
+    assert_eq(ble_midi_tx_sysex_msg(short_sysex_msg, sizeof(short_sysex_msg)), BLE_MIDI_TX_FIFO_FULL, "out of buffers should be reported");
+    notify_rc = -ENOTCONN;
+    assert_eq(ble_midi_tx_sysex_msg(short_sysex_msg, sizeof(short_sysex_msg)), BLE_MIDI_NOT_CONNECTED, "not connected should be reported");
+    // Fail after the sysex start of a long message has been sent
+    num_notified_packets = 0;
+    notify_rc_from_packet = 1;
+    assert_eq(ble_midi_tx_sysex_msg(long_sysex_msg, sizeof(long_sysex_msg)), BLE_MIDI_NOT_CONNECTED, "not connected should be reported");
+    assert_eq(num_notified_packets, 1, "only the sysex start should be notified");
+    notify_rc = 0;
+    notify_rc_from_packet = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct ble_midi_callbacks callbacks = { 0 };
+    assert_eq(ble_midi_init(&callbacks), BLE_MIDI_SUCCESS, "init should succeed");
+
+    test_tx_stream_sysex();
+    test_tx_sysex_msg_send_errors();
+
+    printf("✅ No failed assertions\n");
+    return 0;
+}
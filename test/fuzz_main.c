@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Standalone driver for the fuzz targets, for compilers without libFuzzer. Runs the
+   target on each file given on the command line, or on pseudo random inputs if no
+   files are given. */
+
+#define NUM_RANDOM_INPUTS   200000
+#define MAX_RANDOM_INPUT_SIZE 512
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int run_file(const char *path)
+{
+	static uint8_t data[1 << 16];
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		printf("Failed to open %s\n", path);
+		return 1;
+	}
+	size_t size = fread(data, 1, sizeof(data), file);
+	fclose(file);
+	LLVMFuzzerTestOneInput(data, size);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			if (run_file(argv[i])) {
+				return 1;
+			}
+		}
+		printf("Ran %d inputs\n", argc - 1);
+		return 0;
+	}
+
+	static uint8_t data[MAX_RANDOM_INPUT_SIZE];
+	uint32_t seed = 1;
+	for (int i = 0; i < NUM_RANDOM_INPUTS; i++) {
+		seed = seed * 1103515245 + 12345;
+		size_t size = (seed >> 8) % MAX_RANDOM_INPUT_SIZE;
+		/* Bias some inputs towards status bytes and some towards data bytes */
+		uint8_t high_bit_mask = (seed >> 4) & 1 ? 0xff : 0x7f;
+		for (size_t j = 0; j < size; j++) {
+			seed = seed * 1103515245 + 12345;
+			data[j] = (seed >> 16) & high_bit_mask;
+		}
+		if (size > 0 && (seed >> 3) & 1) {
+			/* Make the first byte a valid packet header */
+			data[0] |= 0x80;
+		}
+		LLVMFuzzerTestOneInput(data, size);
+	}
+	printf("Ran %d random inputs\n", NUM_RANDOM_INPUTS);
+	return 0;
+}
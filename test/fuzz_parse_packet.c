@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ble_midi/src/ble_midi_packet.h"
+
+/* Fuzz target for the packet parser. The input is parsed as a single packet with
+   ble_midi_parse_packet and then split into packets for a persistent parser, each
+   packet preceded by a length byte. Parsing may fail, but callbacks must only ever
+   see well formed data. */
+
+#define FUZZ_ASSERT(condition)                                                                     \
+	if (!(condition)) {                                                                        \
+		fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition);            \
+		abort();                                                                           \
+	}
+
+static void check_message(const uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
+{
+	FUZZ_ASSERT(num_bytes >= 1 && num_bytes <= 3);
+	FUZZ_ASSERT((ble_midi_status_info[bytes[0]] & BLE_MIDI_STATUS_SIZE_MASK) == num_bytes);
+	for (int i = 1; i < num_bytes; i++) {
+		FUZZ_ASSERT(bytes[i] < 0x80);
+	}
+	FUZZ_ASSERT(timestamp < 0x2000);
+}
+
+static void message_cb(void *user_data, uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
+{
+	check_message(bytes, num_bytes, timestamp);
+}
+
+static void message_batch_cb(void *user_data, const struct ble_midi_message_t *msgs, uint32_t num_msgs)
+{
+	FUZZ_ASSERT(num_msgs > 0);
+	for (uint32_t i = 0; i < num_msgs; i++) {
+		check_message(msgs[i].bytes, msgs[i].num_bytes, msgs[i].timestamp);
+	}
+}
+
+static void sysex_start_cb(void *user_data, uint16_t timestamp)
+{
+	FUZZ_ASSERT(timestamp < 0x2000);
+}
+
+static void sysex_data_cb(void *user_data, uint8_t data_byte)
+{
+	FUZZ_ASSERT(data_byte < 0x80);
+}
+
+static void sysex_data_span_cb(void *user_data, const uint8_t *data_bytes, uint32_t num_data_bytes)
+{
+	FUZZ_ASSERT(num_data_bytes > 0);
+	for (uint32_t i = 0; i < num_data_bytes; i++) {
+		FUZZ_ASSERT(data_bytes[i] < 0x80);
+	}
+}
+
+static void sysex_end_cb(void *user_data, uint16_t timestamp)
+{
+	FUZZ_ASSERT(timestamp < 0x2000);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	/* Copy the input so reads past the end are caught by sanitizers. */
+	uint8_t *packet = malloc(size);
+	if (size > 0) {
+		memcpy(packet, data, size);
+	}
+	struct ble_midi_parse_cb_t cb = {.midi_message_cb = message_cb,
+					 .sysex_start_cb = sysex_start_cb,
+					 .sysex_data_cb = sysex_data_cb,
+					 .sysex_end_cb = sysex_end_cb};
+	ble_midi_parse_packet(packet, size, &cb);
+	free(packet);
+
+	struct ble_midi_message_t batch_buf[4];
+	struct ble_midi_parse_cb_t batch_cb = {.sysex_start_cb = sysex_start_cb,
+					       .sysex_data_span_cb = sysex_data_span_cb,
+					       .sysex_end_cb = sysex_end_cb,
+					       .midi_message_batch_cb = message_batch_cb,
+					       .batch_buf = batch_buf,
+					       .batch_buf_size = 4};
+	struct rx_clock clock;
+	rx_clock_init(&clock);
+	struct ble_midi_parser_t parser;
+	ble_midi_parser_init(&parser, &batch_cb);
+	ble_midi_parser_set_clock(&parser, &clock);
+
+	size_t pos = 0;
+	int64_t rx_time_ms = 0;
+	while (pos < size) {
+		size_t packet_size = data[pos++];
+		if (packet_size > size - pos) {
+			packet_size = size - pos;
+		}
+		packet = malloc(packet_size);
+		if (packet_size > 0) {
+			memcpy(packet, &data[pos], packet_size);
+		}
+		uint32_t num_errors = parser.num_errors;
+		enum ble_midi_packet_error_t result =
+			ble_midi_parser_feed_at(&parser, packet, packet_size, rx_time_ms);
+		FUZZ_ASSERT((result == BLE_MIDI_PACKET_SUCCESS) == (parser.num_errors == num_errors));
+		free(packet);
+		pos += packet_size;
+		rx_time_ms += packet_size;
+	}
+
+	return 0;
+}
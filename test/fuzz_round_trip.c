@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ble_midi/src/ble_midi_packet.h"
+
+/* Fuzz target for writer -> parser round trips. The input is decoded into a sequence
+   of MIDI events that are written to packets and parsed back. The parsed events must
+   match the written ones. */
+
+#define FUZZ_ASSERT(condition)                                                                     \
+	if (!(condition)) {                                                                        \
+		fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #condition);            \
+		abort();                                                                           \
+	}
+
+#define MAX_EVENTS	  4096
+#define MAX_PACKETS	  1024
+#define MAX_SYSEX_CHUNK	  64
+
+enum event_type {
+	EVENT_MSG,
+	EVENT_SYSEX_START,
+	EVENT_SYSEX_DATA,
+	EVENT_SYSEX_END
+};
+
+struct event {
+	enum event_type type;
+	uint8_t bytes[3];
+	uint16_t timestamp;
+};
+
+struct event_log {
+	struct event events[MAX_EVENTS];
+	int num_events;
+};
+
+static struct event_log sent;
+static struct event_log received;
+
+static uint8_t packets[MAX_PACKETS][BLE_MIDI_TX_PACKET_MAX_SIZE];
+static uint16_t packet_sizes[MAX_PACKETS];
+static int num_packets;
+
+static void log_event(struct event_log *log, enum event_type type, const uint8_t *bytes,
+		      uint8_t num_bytes, uint16_t timestamp)
+{
+	FUZZ_ASSERT(log->num_events < MAX_EVENTS);
+	struct event *event = &log->events[log->num_events++];
+	event->type = type;
+	memset(event->bytes, 0, sizeof(event->bytes));
+	if (num_bytes > 0) {
+		memcpy(event->bytes, bytes, num_bytes);
+	}
+	event->timestamp = type == EVENT_SYSEX_DATA ? 0 : timestamp;
+}
+
+static void message_cb(void *user_data, uint8_t *bytes, uint8_t num_bytes, uint16_t timestamp)
+{
+	log_event(&received, EVENT_MSG, bytes, num_bytes, timestamp);
+}
+
+static void sysex_start_cb(void *user_data, uint16_t timestamp)
+{
+	log_event(&received, EVENT_SYSEX_START, 0, 0, timestamp);
+}
+
+static void sysex_data_span_cb(void *user_data, const uint8_t *data_bytes, uint32_t num_data_bytes)
+{
+	for (uint32_t i = 0; i < num_data_bytes; i++) {
+		log_event(&received, EVENT_SYSEX_DATA, &data_bytes[i], 1, 0);
+	}
+}
+
+static void sysex_end_cb(void *user_data, uint16_t timestamp)
+{
+	log_event(&received, EVENT_SYSEX_END, 0, 0, timestamp);
+}
+
+static void finish_packet(struct ble_midi_writer_t *writer)
+{
+	if (writer->tx_buf_size > 0) {
+		FUZZ_ASSERT(num_packets < MAX_PACKETS);
+		memcpy(packets[num_packets], writer->tx_buf, writer->tx_buf_size);
+		packet_sizes[num_packets++] = writer->tx_buf_size;
+	}
+	ble_midi_writer_reset(writer);
+}
+
+/* Adds a non-sysex message or sysex start/end, starting a new packet if the current one is
+   full. Checks that ble_midi_writer_bytes_needed predicts the outcome. */
+static void write_msg(struct ble_midi_writer_t *writer, uint8_t *bytes, uint16_t timestamp)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		int num_bytes_needed = ble_midi_writer_bytes_needed(writer, bytes, timestamp);
+		uint16_t tx_buf_size = writer->tx_buf_size;
+		enum ble_midi_packet_error_t result;
+		if (bytes[0] == 0xf0) {
+			result = ble_midi_writer_start_sysex_msg(writer, timestamp);
+		} else if (bytes[0] == 0xf7) {
+			result = ble_midi_writer_end_sysex_msg(writer, timestamp);
+		} else {
+			result = ble_midi_writer_add_msg(writer, bytes, timestamp);
+		}
+		if (result == BLE_MIDI_PACKET_SUCCESS) {
+			FUZZ_ASSERT(num_bytes_needed == writer->tx_buf_size - tx_buf_size);
+			return;
+		}
+		FUZZ_ASSERT(result == BLE_MIDI_PACKET_ERROR_PACKET_FULL && attempt == 0);
+		FUZZ_ASSERT(num_bytes_needed == BLE_MIDI_PACKET_ERROR_PACKET_FULL ||
+			    num_bytes_needed > writer->tx_buf_max_size - writer->tx_buf_size);
+		finish_packet(writer);
+	}
+}
+
+struct input {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+};
+
+static uint8_t next_byte(struct input *input)
+{
+	return input->pos < input->size ? input->data[input->pos++] : 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct input input = {.data = data, .size = size, .pos = 0};
+	sent.num_events = 0;
+	received.num_events = 0;
+	num_packets = 0;
+
+	uint8_t config = next_byte(&input);
+	int running_status = config & 1;
+	int note_off_as_note_on = (config >> 1) & 1;
+	struct ble_midi_writer_t writer;
+	ble_midi_writer_init(&writer, running_status, note_off_as_note_on);
+	writer.tx_buf_max_size = 8 + next_byte(&input) % (BLE_MIDI_TX_PACKET_MAX_SIZE - 7);
+
+	static const uint8_t system_common[] = {0xf1, 0xf2, 0xf3, 0xf6};
+	static const uint8_t realtime[] = {0xf8, 0xfa, 0xfb, 0xfc, 0xfe, 0xff};
+	uint16_t timestamp = 0;
+	int in_sysex = 0;
+
+	while (input.pos < input.size && sent.num_events < MAX_EVENTS - MAX_SYSEX_CHUNK) {
+		uint8_t op = next_byte(&input);
+		/* Steps of 128 ms or more make the writer start a new packet */
+		timestamp = (timestamp + next_byte(&input)) & 0x1fff;
+		uint8_t bytes[3] = {0, 0, 0};
+
+		switch (op % 7) {
+		case 0:
+			/* Channel message */
+			if (in_sysex) {
+				break;
+			}
+			bytes[0] = 0x80 + next_byte(&input) % 0x70;
+			bytes[1] = next_byte(&input) & 0x7f;
+			bytes[2] = next_byte(&input) & 0x7f;
+			if ((ble_midi_status_info[bytes[0]] & BLE_MIDI_STATUS_SIZE_MASK) == 2) {
+				bytes[2] = 0;
+			}
+			write_msg(&writer, bytes, timestamp);
+			if (running_status && note_off_as_note_on && (bytes[0] >> 4) == 0x8) {
+				bytes[0] |= 0x10;
+				bytes[2] = 0;
+			}
+			log_event(&sent, EVENT_MSG, bytes, 3, timestamp);
+			break;
+		case 1:
+			/* System common message */
+			if (in_sysex) {
+				break;
+			}
+			bytes[0] = system_common[next_byte(&input) % sizeof(system_common)];
+			int num_bytes = ble_midi_status_info[bytes[0]] & BLE_MIDI_STATUS_SIZE_MASK;
+			for (int i = 1; i < num_bytes; i++) {
+				bytes[i] = next_byte(&input) & 0x7f;
+			}
+			write_msg(&writer, bytes, timestamp);
+			log_event(&sent, EVENT_MSG, bytes, 3, timestamp);
+			break;
+		case 2:
+			/* System real time message, also allowed in sysex messages */
+			bytes[0] = realtime[next_byte(&input) % sizeof(realtime)];
+			write_msg(&writer, bytes, timestamp);
+			log_event(&sent, EVENT_MSG, bytes, 3, timestamp);
+			break;
+		case 3:
+			/* Sysex start or end */
+			bytes[0] = in_sysex ? 0xf7 : 0xf0;
+			write_msg(&writer, bytes, timestamp);
+			log_event(&sent, in_sysex ? EVENT_SYSEX_END : EVENT_SYSEX_START, 0, 0, timestamp);
+			in_sysex = !in_sysex;
+			break;
+		case 4: {
+			/* Sysex data, possibly split across packets */
+			if (!in_sysex) {
+				break;
+			}
+			uint8_t chunk[MAX_SYSEX_CHUNK];
+			int chunk_size = 1 + next_byte(&input) % MAX_SYSEX_CHUNK;
+			for (int i = 0; i < chunk_size; i++) {
+				chunk[i] = next_byte(&input) & 0x7f;
+				log_event(&sent, EVENT_SYSEX_DATA, &chunk[i], 1, 0);
+			}
+			int num_added = 0;
+			while (num_added < chunk_size) {
+				int result = ble_midi_writer_add_sysex_data(
+					&writer, &chunk[num_added], chunk_size - num_added, timestamp);
+				FUZZ_ASSERT(result >= 0);
+				num_added += result;
+				if (num_added < chunk_size) {
+					finish_packet(&writer);
+				}
+			}
+			break;
+		}
+		case 5: {
+			/* A run of channel messages sharing a timestamp */
+			if (in_sysex) {
+				break;
+			}
+			uint8_t msgs[8][3];
+			int num_msgs = 1 + next_byte(&input) % 8;
+			for (int i = 0; i < num_msgs; i++) {
+				msgs[i][0] = 0x80 + next_byte(&input) % 0x70;
+				msgs[i][1] = next_byte(&input) & 0x7f;
+				msgs[i][2] = next_byte(&input) & 0x7f;
+				if ((ble_midi_status_info[msgs[i][0]] & BLE_MIDI_STATUS_SIZE_MASK) == 2) {
+					msgs[i][2] = 0;
+				}
+			}
+			int num_added = 0;
+			while (num_added < num_msgs) {
+				int result = ble_midi_writer_add_msgs(&writer, &msgs[num_added],
+								      num_msgs - num_added, timestamp);
+				FUZZ_ASSERT(result >= 0);
+				FUZZ_ASSERT(result > 0 || writer.tx_buf_size > 0);
+				num_added += result;
+				if (num_added < num_msgs) {
+					finish_packet(&writer);
+				}
+			}
+			for (int i = 0; i < num_msgs; i++) {
+				memcpy(bytes, msgs[i], 3);
+				if (running_status && note_off_as_note_on && (bytes[0] >> 4) == 0x8) {
+					bytes[0] |= 0x10;
+					bytes[2] = 0;
+				}
+				log_event(&sent, EVENT_MSG, bytes, 3, timestamp);
+			}
+			break;
+		}
+		default:
+			/* Send the current packet */
+			finish_packet(&writer);
+			break;
+		}
+	}
+	finish_packet(&writer);
+
+	struct ble_midi_parse_cb_t cb = {.midi_message_cb = message_cb,
+					 .sysex_start_cb = sysex_start_cb,
+					 .sysex_data_span_cb = sysex_data_span_cb,
+					 .sysex_end_cb = sysex_end_cb};
+	struct ble_midi_parser_t parser;
+	ble_midi_parser_init(&parser, &cb);
+	for (int i = 0; i < num_packets; i++) {
+		FUZZ_ASSERT(packet_sizes[i] <= writer.tx_buf_max_size);
+		FUZZ_ASSERT(ble_midi_parser_feed(&parser, packets[i], packet_sizes[i]) ==
+			    BLE_MIDI_PACKET_SUCCESS);
+	}
+
+	FUZZ_ASSERT(received.num_events == sent.num_events);
+	for (int i = 0; i < sent.num_events; i++) {
+		FUZZ_ASSERT(received.events[i].type == sent.events[i].type);
+		FUZZ_ASSERT(memcmp(received.events[i].bytes, sent.events[i].bytes, 3) == 0);
+		FUZZ_ASSERT(received.events[i].timestamp == sent.events[i].timestamp);
+	}
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "../ble_midi/src/midi_params.h"
+
+void assert_true(int condition, const char* message) {
+    assert(condition && message);
+}
+
+void assert_eq(int a, int b, const char* message) {
+    assert(a == b && message);
+}
+
+static struct ble_midi_param_t params[16];
+static int num_params = 0;
+
+static void param_cb(const struct ble_midi_param_t *param) {
+    assert_true(num_params < 16, "too many params");
+    params[num_params++] = *param;
+}
+
+static struct midi_params_aggregator aggregator;
+static struct ble_midi_message_t passed_msgs[16];
+static int num_passed_msgs = 0;
+
+static void batch_cb(void *user_data, const struct ble_midi_message_t *msgs, uint32_t num_msgs) {
+    for (uint32_t i = 0; i < num_msgs; i++) {
+        if (!midi_params_aggregator_add(&aggregator, &msgs[i])) {
+            passed_msgs[num_passed_msgs++] = msgs[i];
+        }
+    }
+}
+
+static struct ble_midi_message_t cc(uint8_t channel, uint8_t controller, uint8_t value) {
+    struct ble_midi_message_t msg = {.bytes = {0xb0 | channel, controller, value}, .num_bytes = 3};
+    return msg;
+}
+
+static void add_msgs(const uint8_t (*msgs)[3], int num_msgs) {
+    for (int i = 0; i < num_msgs; i++) {
+        struct ble_midi_message_t msg = cc(msgs[i][0] & 0x0f, msgs[i][1], msgs[i][2]);
+        assert_true(midi_params_aggregator_add(&aggregator, &msg), "param message should be consumed");
+    }
+}
+
+static void init(int cc14) {
+    midi_params_aggregator_init(&aggregator, param_cb, cc14);
+    num_params = 0;
+    num_passed_msgs = 0;
+}
+
+static void assert_param(const struct ble_midi_param_t *param, uint8_t type, uint8_t channel, uint16_t number, uint16_t value) {
+    assert_eq(param->type, type, "unexpected param type");
+    assert_eq(param->channel, channel, "unexpected param channel");
+    assert_eq(param->number, number, "unexpected param number");
+    assert_eq(param->value, value, "unexpected param value");
+}
+
+void test_encode() {
+    uint8_t msgs[MIDI_PARAMS_MAX_MSGS][3];
+    assert_eq(midi_params_encode(BLE_MIDI_PARAM_NRPN, 2, 0x1234, 0x2345, msgs), 4, "NRPN should be 4 messages");
+    const uint8_t expected_nrpn[][3] = {{0xb2, 99, 0x24}, {0xb2, 98, 0x34}, {0xb2, 6, 0x46}, {0xb2, 38, 0x45}};
+    assert_true(memcmp(msgs, expected_nrpn, sizeof(expected_nrpn)) == 0, "unexpected NRPN messages");
+
+    assert_eq(midi_params_encode(BLE_MIDI_PARAM_RPN, 0, 0, 0x3fff, msgs), 4, "RPN should be 4 messages");
+    assert_eq(msgs[0][1], 101, "RPN should use controller 101");
+    assert_eq(msgs[1][1], 100, "RPN should use controller 100");
+
+    assert_eq(midi_params_encode(BLE_MIDI_PARAM_CC14, 15, 7, 0x3fff, msgs), 2, "14 bit CC should be 2 messages");
+    const uint8_t expected_cc14[][3] = {{0xbf, 7, 0x7f}, {0xbf, 39, 0x7f}};
+    assert_true(memcmp(msgs, expected_cc14, sizeof(expected_cc14)) == 0, "unexpected 14 bit CC messages");
+
+    assert_eq(midi_params_encode(BLE_MIDI_PARAM_CC14, 0, 32, 0, msgs), 0, "controller should be < 32");
+    assert_eq(midi_params_encode(BLE_MIDI_PARAM_NRPN, 16, 0, 0, msgs), 0, "channel should be < 16");
+    assert_eq(midi_params_encode(BLE_MIDI_PARAM_NRPN, 0, 0, 0x4000, msgs), 0, "value should be 14 bit");
+    assert_eq(midi_params_encode(BLE_MIDI_PARAM_RPN, 0, 0x3fff, 0, msgs), 0, "null RPN should be rejected");
+}
+
+void test_round_trip() {
+    // With running status, an NRPN is one status byte followed by data byte pairs
+    struct ble_midi_writer_t writer;
+    ble_midi_writer_init(&writer, 1, 0);
+    uint8_t msgs[MIDI_PARAMS_MAX_MSGS][3];
+    int num_msgs = midi_params_encode(BLE_MIDI_PARAM_NRPN, 3, 1000, 9000, msgs);
+    assert_eq(ble_midi_writer_add_msgs(&writer, msgs, num_msgs, 0), num_msgs, "messages should fit");
+    assert_eq(writer.tx_buf_size, 2 + 1 + 2 * num_msgs, "expected header, timestamp, status and data bytes");
+
+    init(1);
+    struct ble_midi_parse_cb_t cb = {0};
+    struct ble_midi_message_t batch_buf[8];
+    cb.midi_message_batch_cb = batch_cb;
+    cb.batch_buf = batch_buf;
+    cb.batch_buf_size = 8;
+    assert_eq(ble_midi_parse_packet(writer.tx_buf, writer.tx_buf_size, &cb), BLE_MIDI_PACKET_SUCCESS, "packet should parse");
+    midi_params_aggregator_flush(&aggregator);
+    assert_eq(num_params, 1, "NRPN should be reported once");
+    assert_eq(num_passed_msgs, 0, "NRPN messages should be consumed");
+    assert_param(&params[0], BLE_MIDI_PARAM_NRPN, 3, 1000, 9000);
+}
+
+void test_aggregation() {
+    init(0);
+    uint8_t msgs[MIDI_PARAMS_MAX_MSGS][3];
+    add_msgs(msgs, midi_params_encode(BLE_MIDI_PARAM_RPN, 1, 2, 0x2000, msgs));
+    assert_eq(num_params, 1, "RPN should be reported on its LSB");
+    assert_param(&params[0], BLE_MIDI_PARAM_RPN, 1, 2, 0x2000);
+
+    // The selected parameter stays selected
+    struct ble_midi_message_t msg = cc(1, 6, 0x10);
+    assert_true(midi_params_aggregator_add(&aggregator, &msg), "data entry should be consumed");
+    assert_eq(num_params, 1, "data entry MSB should be held");
+    midi_params_aggregator_flush(&aggregator);
+    assert_eq(num_params, 2, "lone MSB should be reported on flush");
+    assert_param(&params[1], BLE_MIDI_PARAM_RPN, 1, 2, 0x10 << 7);
+    msg = cc(1, 38, 0x01);
+    midi_params_aggregator_add(&aggregator, &msg);
+    assert_eq(num_params, 3, "lone LSB should be reported");
+    assert_param(&params[2], BLE_MIDI_PARAM_RPN, 1, 2, (0x10 << 7) | 0x01);
+
+    // A pending MSB is reported before the next message
+    msg = cc(1, 6, 0x11);
+    midi_params_aggregator_add(&aggregator, &msg);
+    struct ble_midi_message_t note_on = {.bytes = {0x91, 0x3c, 0x7f}, .num_bytes = 3};
+    assert_true(!midi_params_aggregator_add(&aggregator, &note_on), "note on should not be consumed");
+    assert_eq(num_params, 4, "pending MSB should be reported before the note on");
+
+    // Null RPN deselects the parameter
+    msg = cc(1, 101, 0x7f);
+    midi_params_aggregator_add(&aggregator, &msg);
+    msg = cc(1, 100, 0x7f);
+    midi_params_aggregator_add(&aggregator, &msg);
+    msg = cc(1, 6, 0x11);
+    assert_true(!midi_params_aggregator_add(&aggregator, &msg), "data entry without a parameter should not be consumed");
+
+    // Controllers 0-31 are not paired unless enabled
+    msg = cc(0, 7, 0x40);
+    assert_true(!midi_params_aggregator_add(&aggregator, &msg), "7 bit controller should not be consumed");
+    assert_eq(num_params, 4, "no params should be reported");
+}
+
+void test_cc14_aggregation() {
+    init(1);
+    uint8_t msgs[MIDI_PARAMS_MAX_MSGS][3];
+    add_msgs(msgs, midi_params_encode(BLE_MIDI_PARAM_CC14, 5, 1, 0x1fff, msgs));
+    assert_eq(num_params, 1, "14 bit controller should be reported on its LSB");
+    assert_param(&params[0], BLE_MIDI_PARAM_CC14, 5, 1, 0x1fff);
+
+    // An MSB without an LSB is reported on its own
+    struct ble_midi_message_t msg = cc(5, 7, 0x40);
+    midi_params_aggregator_add(&aggregator, &msg);
+    msg = cc(5, 8, 0x41);
+    midi_params_aggregator_add(&aggregator, &msg);
+    assert_eq(num_params, 2, "previous MSB should be reported");
+    assert_param(&params[1], BLE_MIDI_PARAM_CC14, 5, 7, 0x40 << 7);
+    midi_params_aggregator_flush(&aggregator);
+    assert_param(&params[2], BLE_MIDI_PARAM_CC14, 5, 8, 0x41 << 7);
+
+    // An LSB without an MSB is passed on
+    msg = cc(5, 39, 0x01);
+    assert_true(!midi_params_aggregator_add(&aggregator, &msg), "lone LSB should not be consumed");
+    msg = cc(5, 64, 0x7f);
+    assert_true(!midi_params_aggregator_add(&aggregator, &msg), "other controllers should not be consumed");
+    assert_eq(num_params, 3, "no more params should be reported");
+
+    midi_params_aggregator_reset(&aggregator);
+    assert_eq(aggregator.has_pending, 0, "reset should drop pending MSB");
+}
+
+int main(int argc, char *argv[])
+{
+    test_encode();
+    test_round_trip();
+    test_aggregation();
+    test_cc14_aggregation();
+
+    return 0;
+}
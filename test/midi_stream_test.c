@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "../ble_midi/src/midi_stream.h"
+
+void assert_true(int condition, const char* message) {
+    assert(condition && message);
+}
+
+void assert_eq(int a, int b, const char* message) {
+    assert(a == b && message);
+}
+
+// Parsed events, flattened into bytes: messages as 3 zero padded bytes, sysex start and
+// end as 0xf0 and 0xf7 and sysex data as is.
+static uint8_t parsed[256];
+static int num_parsed = 0;
+
+static void parse(struct midi_stream *stream, const uint8_t *bytes, uint32_t num_bytes) {
+    uint32_t pos = 0;
+    while (pos < num_bytes) {
+        struct midi_stream_event event;
+        uint32_t num_consumed = midi_stream_next(stream, &bytes[pos], num_bytes - pos, &event);
+        switch (event.type) {
+        case MIDI_STREAM_MSG:
+            memcpy(&parsed[num_parsed], event.msg, 3);
+            num_parsed += 3;
+            break;
+        case MIDI_STREAM_SYSEX_START:
+            parsed[num_parsed++] = 0xf0;
+            break;
+        case MIDI_STREAM_SYSEX_DATA:
+            assert_true(event.data >= &bytes[pos] && event.data + event.num_data_bytes <= &bytes[pos + num_consumed], "data should point into the consumed input");
+            memcpy(&parsed[num_parsed], event.data, event.num_data_bytes);
+            num_parsed += event.num_data_bytes;
+            break;
+        case MIDI_STREAM_SYSEX_END:
+            parsed[num_parsed++] = 0xf7;
+            break;
+        case MIDI_STREAM_NONE:
+            assert_eq(num_consumed, num_bytes - pos, "all input should be consumed if no event completed");
+            break;
+        }
+        pos += num_consumed;
+    }
+}
+
+// Parses the stream in two calls, split at every possible position, and checks the events.
+static void assert_parsed(const uint8_t *bytes, uint32_t num_bytes, const uint8_t *expected, int num_expected, const char *message) {
+    for (uint32_t split = 0; split <= num_bytes; split++) {
+        struct midi_stream stream;
+        midi_stream_init(&stream);
+        num_parsed = 0;
+        parse(&stream, bytes, split);
+        parse(&stream, &bytes[split], num_bytes - split);
+        assert_eq(num_parsed, num_expected, message);
+        assert_true(memcmp(parsed, expected, num_expected) == 0, message);
+    }
+}
+
+void test_channel_msgs() {
+    const uint8_t stream[] = {0x90, 0x3c, 0x7f, 0x40, 0x7f, 0xc1, 0x05, 0x06, 0xb2, 0x07};
+    const uint8_t expected[] = {
+        0x90, 0x3c, 0x7f,
+        0x90, 0x40, 0x7f,
+        0xc1, 0x05, 0x00,
+        0xc1, 0x06, 0x00,
+    };
+    assert_parsed(stream, sizeof(stream), expected, sizeof(expected), "running status should be expanded");
+}
+
+void test_system_msgs() {
+    const uint8_t stream[] = {
+        0x90, 0x3c, 0xf8, 0x7f, // real time message inside a message
+        0xf2, 0x01, 0x02, 0x03, // system common message cancels running status
+        0xf6, 0xf4, 0x10, 0xf9, 0xf7, // undefined status bytes and stray sysex end
+        0xf1, 0x11,
+    };
+    const uint8_t expected[] = {
+        0xf8, 0x00, 0x00,
+        0x90, 0x3c, 0x7f,
+        0xf2, 0x01, 0x02,
+        0xf6, 0x00, 0x00,
+        0xf1, 0x11, 0x00,
+    };
+    assert_parsed(stream, sizeof(stream), expected, sizeof(expected), "system messages should be handled");
+}
+
+void test_sysex() {
+    const uint8_t stream[] = {
+        0xb0, 0x07, 0x10,
+        0xf0, 0x01, 0x02, 0xfe, 0x03, 0xf7,
+        0x20, // running status was cancelled by the sysex message
+        0xf0, 0x04, 0x90, 0x3c, 0x7f, // a status byte ends the sysex message
+    };
+    const uint8_t expected[] = {
+        0xb0, 0x07, 0x10,
+        0xf0, 0x01, 0x02, 0xfe, 0x00, 0x00, 0x03, 0xf7,
+        0xf0, 0x04, 0xf7,
+        0x90, 0x3c, 0x7f,
+    };
+    assert_parsed(stream, sizeof(stream), expected, sizeof(expected), "sysex should be handled");
+
+    // Data bytes are passed on in runs
+    struct midi_stream midi_stream;
+    midi_stream_init(&midi_stream);
+    const uint8_t data[] = {0xf0, 0x01, 0x02, 0x03, 0x04};
+    struct midi_stream_event event;
+    assert_eq(midi_stream_next(&midi_stream, data, sizeof(data), &event), 1, "sysex start should be one byte");
+    assert_eq(event.type, MIDI_STREAM_SYSEX_START, "sysex should start");
+    assert_eq(midi_stream_next(&midi_stream, &data[1], sizeof(data) - 1, &event), 4, "data bytes should be consumed at once");
+    assert_eq(event.type, MIDI_STREAM_SYSEX_DATA, "data bytes should be passed on");
+    assert_eq(event.num_data_bytes, 4, "data bytes should be passed on in one run");
+}
+
+int main(int argc, char *argv[])
+{
+    test_channel_msgs();
+    test_system_msgs();
+    test_sysex();
+
+    return 0;
+}
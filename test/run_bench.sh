@@ -0,0 +1,2 @@
+gcc -O2 -DCONFIG_BLE_MIDI_TX_PACKET_MAX_SIZE=244 ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c ble_midi_packet_bench.c -o ble_midi_packet_bench; ./ble_midi_packet_bench
+gcc -O2 ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c ../ble_midi/src/tx_queue.c tx_queue_bench.c -o tx_queue_bench; ./tx_queue_bench
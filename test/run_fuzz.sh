@@ -0,0 +1,13 @@
+# Builds and runs the fuzz targets. Uses libFuzzer if clang is available, otherwise
+# gcc with the standalone driver in fuzz_main.c. Extra arguments are passed to the
+# fuzzer, e.g. a corpus directory or -max_total_time=60.
+SOURCES="../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c"
+for TARGET in fuzz_parse_packet fuzz_round_trip; do
+	if command -v clang > /dev/null; then
+		clang -g -O1 -fsanitize=fuzzer,address,undefined $SOURCES $TARGET.c -o $TARGET || exit 1
+		./$TARGET -max_total_time=30 "$@" || exit 1
+	else
+		gcc -g -O1 -fsanitize=address,undefined $SOURCES $TARGET.c fuzz_main.c -o $TARGET || exit 1
+		./$TARGET "$@" || exit 1
+	fi
+done
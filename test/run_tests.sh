@@ -1 +1,11 @@
-gcc ../ble_midi/src/ble_midi_packet.c ble_midi_packet_test.c; ./a.out
+gcc ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c ble_midi_packet_test.c; ./a.out
+gcc ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c ../ble_midi/src/tx_queue.c tx_queue_test.c -o tx_queue_test; ./tx_queue_test
+gcc -O2 -pthread ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c ../ble_midi/src/tx_queue.c tx_queue_stress_test.c -o tx_queue_stress_test; ./tx_queue_stress_test
+gcc ../ble_midi/src/rx_clock.c rx_clock_test.c -o rx_clock_test; ./rx_clock_test
+gcc ../ble_midi/src/rx_playout.c rx_playout_test.c -o rx_playout_test; ./rx_playout_test
+# midi_params.c uses the status byte table in ble_midi_packet.c, which needs rx_clock.c
+gcc ../ble_midi/src/midi_params.c ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c midi_params_test.c -o midi_params_test; ./midi_params_test
+# Same for midi_stream.c
+gcc ../ble_midi/src/midi_stream.c ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c midi_stream_test.c -o midi_stream_test; ./midi_stream_test
+# ble_midi.c in single message tx mode, built against the Zephyr stand-ins in zephyr_stubs
+gcc -Izephyr_stubs -I../ble_midi/include -DCONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG -DCONFIG_BLE_MIDI_RX_BATCH_SIZE=32 -DCONFIG_BLE_MIDI_LOG_LEVEL=3 ../ble_midi/src/ble_midi.c ../ble_midi/src/ble_midi_context.c ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c ../ble_midi/src/midi_params.c ../ble_midi/src/midi_stream.c ble_midi_single_msg_test.c -o ble_midi_single_msg_test; ./ble_midi_single_msg_test
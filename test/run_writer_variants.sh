@@ -0,0 +1,22 @@
+# Compares the runtime configured writer with writers specialized at build time for each
+# combination of running status and note off as note on. Prints the code size of the packet
+# codec and the writer/parser cycles per message from the message mix benchmark.
+CFLAGS="-O2 -DCONFIG_BLE_MIDI_TX_PACKET_MAX_SIZE=244"
+for RS in 0 1; do
+	for NO in 0 1; do
+		BENCH="-DBENCH_RUNNING_STATUS=$RS -DBENCH_NOTE_OFF_AS_NOTE_ON=$NO"
+		SPECIALIZED="-DBLE_MIDI_WRITER_RUNNING_STATUS=$RS -DBLE_MIDI_WRITER_NOTE_OFF_AS_NOTE_ON=$NO"
+		for VARIANT in runtime specialized; do
+			DEFINES="$BENCH"
+			if [ $VARIANT = specialized ]; then
+				DEFINES="$BENCH $SPECIALIZED"
+			fi
+			gcc -Os -c $DEFINES ../ble_midi/src/ble_midi_packet.c -o ble_midi_packet.o || exit 1
+			TEXT_SIZE=$(size ble_midi_packet.o | tail -1 | cut -f1 | tr -d ' ')
+			gcc $CFLAGS $DEFINES ../ble_midi/src/ble_midi_packet.c ../ble_midi/src/rx_clock.c ble_midi_packet_bench.c -o ble_midi_packet_bench_variant || exit 1
+			echo "running status $RS, note off as note on $NO, $VARIANT: $TEXT_SIZE bytes of code (-Os)"
+			./ble_midi_packet_bench_variant | grep -A4 "^Writer and parser" | tail -4
+		done
+	done
+done
+rm -f ble_midi_packet.o ble_midi_packet_bench_variant
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "../ble_midi/src/rx_clock.h"
+
+void assert_true(int condition, const char* message) {
+    assert(condition && message);
+}
+
+// Simulated sender clock running drift_ppm slower than the local clock, with a
+// constant offset.
+struct sender {
+    double drift_ppm;
+    double offset_ms;
+    // Transport latency is min_latency_ms plus a random part below jitter_ms
+    double min_latency_ms;
+    double jitter_ms;
+    // Unwrapped minus actual sender time. The first timestamp is taken as is, so
+    // this is constant but not necessarily zero.
+    int has_unwrap_base;
+    uint32_t unwrap_base;
+};
+
+static double sender_time_ms(struct sender* sender, double local_time_ms) {
+    return local_time_ms * (1 - 1e-6 * sender->drift_ppm) + sender->offset_ms;
+}
+
+// Sends timestamps every interval_ms for duration_ms, starting at *local_time_ms.
+// Checks that every received timestamp is unwrapped consistently with the actual
+// sender time.
+static void send_timestamps(struct rx_clock* clock, struct sender* sender, double* local_time_ms,
+                            double duration_ms, double interval_ms) {
+    double end_ms = *local_time_ms + duration_ms;
+    while (*local_time_ms < end_ms) {
+        int64_t sender_ms = (int64_t)sender_time_ms(sender, *local_time_ms);
+        double latency_ms = sender->min_latency_ms + sender->jitter_ms * (rand() / (double)RAND_MAX);
+        int64_t rx_time_ms = (int64_t)(*local_time_ms + latency_ms);
+        uint32_t unwrapped = rx_clock_update(clock, sender_ms & 0x1fff, rx_time_ms);
+        if (!sender->has_unwrap_base) {
+            sender->has_unwrap_base = 1;
+            sender->unwrap_base = unwrapped - (uint32_t)sender_ms;
+        }
+        assert_true(unwrapped - (uint32_t)sender_ms == sender->unwrap_base,
+                    "unwrapped timestamp should follow sender time");
+        *local_time_ms += interval_ms;
+    }
+}
+
+void test_unwrap_without_gaps() {
+    struct rx_clock clock;
+    rx_clock_init(&clock);
+    struct sender sender = {.drift_ppm = 0, .offset_ms = 1234, .min_latency_ms = 7.5, .jitter_ms = 15};
+    double local_time_ms = 100;
+    send_timestamps(&clock, &sender, &local_time_ms, 60000, 5);
+}
+
+void test_unwrap_across_long_gaps() {
+    struct rx_clock clock;
+    rx_clock_init(&clock);
+    struct sender sender = {.drift_ppm = 50, .offset_ms = 100000, .min_latency_ms = 7.5, .jitter_ms = 15};
+    double local_time_ms = 0;
+    for (int i = 0; i < 5; i++) {
+        send_timestamps(&clock, &sender, &local_time_ms, 20000, 10);
+        // Silence for several timestamp periods
+        local_time_ms += 30000 + 1000 * i;
+    }
+}
+
+void test_offset_estimate() {
+    struct rx_clock clock;
+    rx_clock_init(&clock);
+    struct sender sender = {.drift_ppm = 0, .offset_ms = -5000, .min_latency_ms = 7.5, .jitter_ms = 15};
+    double local_time_ms = 10000;
+    send_timestamps(&clock, &sender, &local_time_ms, 10000, 5);
+
+    // The local time of a sender time should be estimated as sender time plus
+    // offset plus minimum latency, give or take rounding.
+    double expected_local_ms = local_time_ms + sender.min_latency_ms;
+    int64_t estimated_local_ms =
+        rx_clock_local_time_ms(&clock, (uint32_t)sender_time_ms(&sender, local_time_ms) + sender.unwrap_base);
+    assert_true(estimated_local_ms >= expected_local_ms - 2 && estimated_local_ms <= expected_local_ms + 2,
+                "local time estimate should include the minimum latency");
+}
+
+void test_drift_estimate() {
+    double drift_ppms[] = {-200, -40, 0, 40, 200};
+    for (int i = 0; i < sizeof(drift_ppms) / sizeof(drift_ppms[0]); i++) {
+        struct rx_clock clock;
+        rx_clock_init(&clock);
+        struct sender sender = {.drift_ppm = drift_ppms[i], .offset_ms = 0, .min_latency_ms = 7.5, .jitter_ms = 15};
+        double local_time_ms = 0;
+        send_timestamps(&clock, &sender, &local_time_ms, 120000, 5);
+        assert_true(clock.num_drift_windows > 0, "drift should have been measured");
+        assert_true(clock.drift_ppm >= drift_ppms[i] - 20 && clock.drift_ppm <= drift_ppms[i] + 20,
+                    "drift estimate should be close to the actual drift");
+
+        // Drift is taken into account when converting sender times far from the
+        // most recent one.
+        double future_local_ms = local_time_ms + 60000;
+        int64_t estimated_local_ms =
+            rx_clock_local_time_ms(&clock, (uint32_t)sender_time_ms(&sender, future_local_ms) + sender.unwrap_base);
+        double expected_local_ms = future_local_ms + sender.min_latency_ms;
+        assert_true(estimated_local_ms >= expected_local_ms - 3 && estimated_local_ms <= expected_local_ms + 3,
+                    "local time estimate should account for drift");
+    }
+}
+
+void test_reset() {
+    struct rx_clock clock;
+    rx_clock_init(&clock);
+    rx_clock_update(&clock, 100, 5000);
+    rx_clock_reset(&clock);
+    assert_true(!clock.is_synced, "clock should not be synced after reset");
+    assert_true(rx_clock_update(&clock, 8000, 100) == 8000, "first timestamp should be taken as is");
+}
+
+int main(int argc, char *argv[])
+{
+    srand(1);
+    test_unwrap_without_gaps();
+    test_unwrap_across_long_gaps();
+    test_offset_estimate();
+    test_drift_estimate();
+    test_reset();
+
+    return 0;
+}
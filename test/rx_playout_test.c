@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "../ble_midi/src/rx_playout.h"
+
+void assert_true(int condition, const char* message) {
+    assert(condition && message);
+}
+
+void assert_eq(int a, int b, const char* message) {
+    assert(a == b && message);
+}
+
+static struct ble_midi_message_t note_on(uint8_t note) {
+    struct ble_midi_message_t msg = {.bytes = {0x90, note, 0x7f}, .num_bytes = 3};
+    return msg;
+}
+
+void test_release_in_playout_order() {
+    struct rx_playout playout;
+    rx_playout_init(&playout);
+
+    // Messages arriving out of order, two of them with the same playout time
+    int64_t due_times[] = {30, 10, 20, 20, 40};
+    for (int i = 0; i < 5; i++) {
+        struct ble_midi_message_t msg = note_on(i);
+        assert_eq(rx_playout_add(&playout, &msg, due_times[i], 0), RX_PLAYOUT_SUCCESS, "add should succeed");
+    }
+
+    int64_t due_ms = 0;
+    assert_true(rx_playout_next_due_ms(&playout, &due_ms), "queue should not be empty");
+    assert_true(due_ms == 10, "earliest message should be due first");
+
+    struct ble_midi_message_t msg;
+    assert_true(!rx_playout_pop_due(&playout, 9, &msg), "nothing should be due yet");
+    assert_true(rx_playout_pop_due(&playout, 20, &msg), "message should be due");
+    assert_eq(msg.bytes[1], 1, "message due at 10 should be released first");
+    assert_true(rx_playout_pop_due(&playout, 20, &msg), "message should be due");
+    assert_eq(msg.bytes[1], 2, "messages with the same playout time should keep their order");
+    assert_true(rx_playout_pop_due(&playout, 20, &msg), "message should be due");
+    assert_eq(msg.bytes[1], 3, "messages with the same playout time should keep their order");
+    assert_true(!rx_playout_pop_due(&playout, 20, &msg), "nothing more should be due");
+    assert_true(rx_playout_pop_due(&playout, 100, &msg), "message should be due");
+    assert_eq(msg.bytes[1], 0, "message due at 30 should be released");
+    assert_true(rx_playout_pop_due(&playout, 100, &msg), "message should be due");
+    assert_eq(msg.bytes[1], 4, "message due at 40 should be released last");
+    assert_true(!rx_playout_next_due_ms(&playout, &due_ms), "queue should be empty");
+    assert_eq(playout.stats.num_released, 5, "all messages should have been released");
+}
+
+void test_late_arrivals() {
+    struct rx_playout playout;
+    rx_playout_init(&playout);
+
+    struct ble_midi_message_t msg = note_on(1);
+    assert_eq(rx_playout_add(&playout, &msg, 100, 105), RX_PLAYOUT_LATE, "message should be late");
+    assert_eq(rx_playout_add(&playout, &msg, 100, 102), RX_PLAYOUT_LATE, "message should be late");
+    assert_eq(rx_playout_add(&playout, &msg, 110, 105), RX_PLAYOUT_SUCCESS, "message should be on time");
+    assert_eq(playout.stats.num_late, 2, "late messages should be counted");
+    assert_eq(playout.stats.max_late_ms, 5, "max lateness should be tracked");
+
+    // Late messages are still released, right away
+    assert_true(rx_playout_pop_due(&playout, 105, &msg), "late message should be due");
+    assert_true(rx_playout_pop_due(&playout, 105, &msg), "late message should be due");
+    assert_true(!rx_playout_pop_due(&playout, 105, &msg), "on time message should not be due");
+}
+
+void test_full_queue() {
+    struct rx_playout playout;
+    rx_playout_init(&playout);
+
+    struct ble_midi_message_t msg = note_on(1);
+    // Wrap around the ring a few times
+    for (int i = 0; i < RX_PLAYOUT_QUEUE_SIZE * 3; i++) {
+        assert_eq(rx_playout_add(&playout, &msg, i, 0), RX_PLAYOUT_SUCCESS, "add should succeed");
+        if (playout.num_entries > RX_PLAYOUT_QUEUE_SIZE / 2) {
+            assert_true(rx_playout_pop_due(&playout, i, &msg), "message should be due");
+        }
+    }
+    while (playout.num_entries < RX_PLAYOUT_QUEUE_SIZE) {
+        assert_eq(rx_playout_add(&playout, &msg, 1000, 0), RX_PLAYOUT_SUCCESS, "add should succeed");
+    }
+    assert_eq(rx_playout_add(&playout, &msg, 1000, 0), RX_PLAYOUT_QUEUE_FULL, "queue should be full");
+    assert_eq(playout.stats.num_overflows, 1, "overflow should be counted");
+
+    int64_t prev_due_ms = 0;
+    int64_t due_ms = 0;
+    while (rx_playout_next_due_ms(&playout, &due_ms)) {
+        assert_true(due_ms >= prev_due_ms, "messages should be released in playout order");
+        prev_due_ms = due_ms;
+        rx_playout_pop_due(&playout, due_ms, &msg);
+    }
+
+    rx_playout_reset(&playout);
+    assert_eq(playout.stats.num_overflows, 0, "reset should clear stats");
+}
+
+int main(int argc, char *argv[])
+{
+    test_release_in_playout_order();
+    test_late_arrivals();
+    test_full_queue();
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "../ble_midi/src/tx_queue.h"
+
+/* Host benchmark for messages passing through the tx queue, from the producer API to
+   sent tx packets, with the FIFO callbacks and with the built-in ring for one or several
+   producers, and for the number of messages the FIFO holds. */
+
+#define FIFO_SIZE	     512
+#define BENCH_MIN_DURATION_S 0.2
+/* The number of messages added before the consumer runs, like a burst of messages
+   between two connection events. */
+#define BURST_SIZE	     32
+#define BURSTS_PER_BLOCK     100
+
+/* A ring buffer behind the FIFO callbacks, similar to a Zephyr ring_buf. */
+static struct {
+	uint8_t bytes[FIFO_SIZE];
+	uint32_t head;
+	uint32_t tail;
+} fifo;
+
+static int fifo_peek(uint8_t *bytes, int num_bytes)
+{
+	int num_available = fifo.head - fifo.tail;
+	num_bytes = num_bytes < num_available ? num_bytes : num_available;
+	for (int i = 0; i < num_bytes; i++) {
+		bytes[i] = fifo.bytes[(fifo.tail + i) % FIFO_SIZE];
+	}
+	return num_bytes;
+}
+
+static int fifo_read(int num_bytes)
+{
+	int num_available = fifo.head - fifo.tail;
+	num_bytes = num_bytes < num_available ? num_bytes : num_available;
+	fifo.tail += num_bytes;
+	return num_bytes;
+}
+
+static int fifo_get_free_space()
+{
+	return FIFO_SIZE - (fifo.head - fifo.tail);
+}
+
+static int fifo_is_empty()
+{
+	return fifo.head == fifo.tail;
+}
+
+static int fifo_clear()
+{
+	fifo.tail = fifo.head;
+	return 0;
+}
+
+static int fifo_write(const uint8_t *bytes, int num_bytes)
+{
+	int num_free = fifo_get_free_space();
+	num_bytes = num_bytes < num_free ? num_bytes : num_free;
+	for (int i = 0; i < num_bytes; i++) {
+		fifo.bytes[(fifo.head + i) % FIFO_SIZE] = bytes[i];
+	}
+	fifo.head += num_bytes;
+	return num_bytes;
+}
+
+static uint16_t ble_timestamp()
+{
+	return 123;
+}
+
+static struct tx_queue_callbacks callbacks = {.fifo_peek = fifo_peek,
+					      .fifo_read = fifo_read,
+					      .fifo_get_free_space = fifo_get_free_space,
+					      .fifo_is_empty = fifo_is_empty,
+					      .fifo_clear = fifo_clear,
+					      .fifo_write = fifo_write,
+					      .ble_timestamp = ble_timestamp};
+
+static struct tx_queue queue;
+static uint8_t ring_buf[FIFO_SIZE];
+
+static double now_s()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Returns a cycle count where available, otherwise a ns count. */
+static uint64_t now_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+struct bench_result {
+	/* Messages per second through the queue */
+	double msgs_per_s;
+	/* Cycles spent adding messages to the FIFO and reading and sending them, per message */
+	double producer_cycles_per_msg;
+	double consumer_cycles_per_msg;
+};
+
+static struct bench_result bench_queue(int use_ring, int multi_producer, int running_status)
+{
+	tx_queue_init(&queue, &callbacks, running_status, 0);
+	if (use_ring) {
+		tx_queue_set_ring(&queue, ring_buf, sizeof(ring_buf));
+	}
+	queue.multi_producer = multi_producer;
+	tx_queue_fifo_add_tx_packet_size(&queue, 244);
+	tx_queue_read_from_fifo(&queue);
+
+	/* The best of a number of blocks of bursts, to filter out noise */
+	struct bench_result best = {0};
+	uint8_t note = 0;
+	double bench_start = now_s();
+	while (now_s() - bench_start < BENCH_MIN_DURATION_S) {
+		uint64_t producer_cycles = 0;
+		uint64_t consumer_cycles = 0;
+		double start = now_s();
+		for (int j = 0; j < BURSTS_PER_BLOCK; j++) {
+			uint64_t burst_start = now_cycles();
+			for (int i = 0; i < BURST_SIZE; i++) {
+				uint8_t msg[3] = {0x90, note++ & 0x7f, 0x7f};
+				tx_queue_fifo_add_msg(&queue, msg);
+			}
+			uint64_t read_start = now_cycles();
+			tx_queue_read_from_fifo(&queue);
+			while (queue.has_tx_data) {
+				tx_queue_on_tx_packet_sent(&queue);
+			}
+			uint64_t read_end = now_cycles();
+			producer_cycles += read_start - burst_start;
+			consumer_cycles += read_end - read_start;
+		}
+		double msgs_per_s = BURSTS_PER_BLOCK * BURST_SIZE / (now_s() - start);
+		double producer_cycles_per_msg =
+			(double)producer_cycles / (BURSTS_PER_BLOCK * BURST_SIZE);
+		double consumer_cycles_per_msg =
+			(double)consumer_cycles / (BURSTS_PER_BLOCK * BURST_SIZE);
+		if (msgs_per_s > best.msgs_per_s) {
+			best.msgs_per_s = msgs_per_s;
+		}
+		if (best.producer_cycles_per_msg == 0 ||
+		    producer_cycles_per_msg < best.producer_cycles_per_msg) {
+			best.producer_cycles_per_msg = producer_cycles_per_msg;
+		}
+		if (best.consumer_cycles_per_msg == 0 ||
+		    consumer_cycles_per_msg < best.consumer_cycles_per_msg) {
+			best.consumer_cycles_per_msg = consumer_cycles_per_msg;
+		}
+	}
+	return best;
+}
+
+static void print_result(const char *desc, struct bench_result result)
+{
+	printf("    %-32s %6.2f Mmsgs/s, add %5.1f, read and send %5.1f cycles/msg\n", desc,
+	       result.msgs_per_s / 1e6, result.producer_cycles_per_msg,
+	       result.consumer_cycles_per_msg);
+}
+
+/* Traffic patterns for the FIFO capacity benchmark, repeated until the FIFO is full. */
+static const uint8_t clock_heavy_traffic[][3] = {
+	/* 16th notes at 24 PPQN, i.e 6 timing clocks per note on/off pair */
+	{0xf8, 0, 0}, {0xf8, 0, 0}, {0xf8, 0, 0}, {0x90, 0x3c, 0x7f},
+	{0xf8, 0, 0}, {0xf8, 0, 0}, {0xf8, 0, 0}, {0x80, 0x3c, 0x40},
+};
+
+static const uint8_t mixed_traffic[][3] = {
+	{0x90, 0x3c, 0x7f}, {0xd0, 0x40, 0},	{0xe0, 0x00, 0x40}, {0xf8, 0, 0},
+	{0xb0, 0x01, 0x20}, {0xc0, 0x05, 0},	{0x80, 0x3c, 0x40}, {0xf8, 0, 0},
+};
+
+/* Returns the number of messages that fit in an empty FIFO. */
+static int fifo_capacity(const uint8_t (*traffic)[3], int num_traffic_msgs)
+{
+	tx_queue_init(&queue, &callbacks, 0, 0);
+	tx_queue_set_ring(&queue, ring_buf, sizeof(ring_buf));
+	int num_msgs = 0;
+	while (tx_queue_fifo_add_msg(&queue, traffic[num_msgs % num_traffic_msgs]) ==
+	       TX_QUEUE_SUCCESS) {
+		num_msgs++;
+	}
+	return num_msgs;
+}
+
+static void print_capacity(const char *desc, const uint8_t (*traffic)[3], int num_traffic_msgs)
+{
+	int num_msgs = fifo_capacity(traffic, num_traffic_msgs);
+	/* Before the length-implied encoding, every message took up 3 bytes */
+	int num_padded_msgs = FIFO_SIZE / 3;
+	printf("    %-32s %4d msgs, %.2f bytes/msg, %.2fx the 3 byte padded encoding\n", desc,
+	       num_msgs, (double)FIFO_SIZE / num_msgs, (double)num_msgs / num_padded_msgs);
+}
+
+int main(int argc, char *argv[])
+{
+	printf("tx queue FIFO capacity, %d byte FIFO\n", FIFO_SIZE);
+	print_capacity("clock heavy traffic", clock_heavy_traffic,
+		       sizeof(clock_heavy_traffic) / sizeof(clock_heavy_traffic[0]));
+	print_capacity("mixed traffic", mixed_traffic,
+		       sizeof(mixed_traffic) / sizeof(mixed_traffic[0]));
+
+	printf("tx queue, bursts of %d note on messages, %d byte FIFO\n", BURST_SIZE, FIFO_SIZE);
+	for (int running_status = 0; running_status < 2; running_status++) {
+		char desc[64];
+		snprintf(desc, sizeof(desc), "FIFO callbacks, running status %d", running_status);
+		print_result(desc, bench_queue(0, 0, running_status));
+		snprintf(desc, sizeof(desc), "built-in ring, running status %d", running_status);
+		print_result(desc, bench_queue(1, 0, running_status));
+		snprintf(desc, sizeof(desc), "multi producer, running status %d", running_status);
+		print_result(desc, bench_queue(1, 1, running_status));
+	}
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../ble_midi/src/tx_queue.h"
+
+// Producer threads adding to the built-in ring concurrently, with the main thread as the
+// consumer. Each producer numbers its messages, and the consumer checks that every
+// producer's messages arrive complete and in order.
+
+void assert_true(int condition, const char* message) {
+    assert(condition && message);
+}
+
+void assert_eq(int a, int b, const char* message) {
+    assert(a == b && message);
+}
+
+#define NUM_PRODUCERS 4
+#define MSGS_PER_PRODUCER 200000
+#define RING_SIZE 256
+#define TX_PACKET_SIZE 244
+
+static struct tx_queue queue;
+static uint8_t ring_buf[RING_SIZE];
+static int num_finished_producers = 0;
+// The number of messages each producer added, at least MSGS_PER_PRODUCER
+static int num_added_msgs[NUM_PRODUCERS];
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// A ms clock, so that producers race to add timestamp chunks
+static uint16_t ble_timestamp() {
+    return (uint16_t)(now_s() * 1000) & 0x1fff;
+}
+
+static struct tx_queue_callbacks callbacks = {
+    .ble_timestamp = ble_timestamp
+};
+
+// Retries until the consumer has made room
+static void add_until_success(enum tx_queue_error (*add)(int producer, int seq), int producer, int seq) {
+    while (add(producer, seq) == TX_QUEUE_FIFO_FULL) {
+        sched_yield();
+    }
+}
+
+// Message seq of a producer is a note on on the producer's channel with the 14 bit sequence
+// number in its data bytes, except every 4th, which is a channel pressure with the low 7
+// bits of the sequence number to mix in messages of another size.
+static void producer_msg(int producer, int seq, uint8_t* msg) {
+    if (seq % 4 == 3) {
+        msg[0] = 0xd0 | producer;
+        msg[1] = seq & 0x7f;
+        msg[2] = 0;
+    } else {
+        msg[0] = 0x90 | producer;
+        msg[1] = seq & 0x7f;
+        msg[2] = (seq >> 7) & 0x7f;
+    }
+}
+
+static enum tx_queue_error add_msg(int producer, int seq) {
+    uint8_t msg[3];
+    producer_msg(producer, seq, msg);
+    return tx_queue_fifo_add_msg(&queue, msg);
+}
+
+static enum tx_queue_error add_msgs(int producer, int seq) {
+    uint8_t msgs[2][3];
+    producer_msg(producer, seq, msgs[0]);
+    producer_msg(producer, seq + 1, msgs[1]);
+    return tx_queue_fifo_add_msgs(&queue, msgs, 2);
+}
+
+static enum tx_queue_error add_msg_group(int producer, int seq) {
+    uint8_t msgs[3][3];
+    for (int i = 0; i < 3; i++) {
+        producer_msg(producer, seq + i, msgs[i]);
+    }
+    return tx_queue_fifo_add_msg_group(&queue, msgs, 3);
+}
+
+// A sysex message with the producer and the sequence number in place of a message
+static enum tx_queue_error add_sysex_msg(int producer, int seq) {
+    uint8_t msg[5] = {0xf0, producer, seq & 0x7f, (seq >> 7) & 0x7f, 0xf7};
+    return tx_queue_fifo_add_sysex_msg(&queue, msg, sizeof(msg));
+}
+
+static void* producer_thread(void* arg) {
+    int producer = (int)(intptr_t)arg;
+    int seq = 0;
+    while (seq < MSGS_PER_PRODUCER) {
+        // Cycle through the producer API, using each call for as many messages as it adds
+        switch ((seq / 8 + producer) % 4) {
+        case 0:
+            add_until_success(add_msg, producer, seq);
+            seq += 1;
+            break;
+        case 1:
+            add_until_success(add_msgs, producer, seq);
+            seq += 2;
+            break;
+        case 2:
+            add_until_success(add_msg_group, producer, seq);
+            seq += 3;
+            break;
+        case 3:
+            add_until_success(add_sysex_msg, producer, seq);
+            seq += 1;
+            break;
+        }
+    }
+    num_added_msgs[producer] = seq;
+    __atomic_fetch_add(&num_finished_producers, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// The next expected sequence number of each producer
+static int expected_seqs[NUM_PRODUCERS];
+static int num_received_msgs = 0;
+
+static void check_seq(int producer, int seq, int num_seq_bits) {
+    assert_true(producer < NUM_PRODUCERS, "unexpected producer");
+    int mask = (1 << num_seq_bits) - 1;
+    assert_eq(seq, expected_seqs[producer] & mask, "messages of a producer should arrive in order");
+    expected_seqs[producer]++;
+    num_received_msgs++;
+}
+
+static void parsed_msg_cb(void* user_data, uint8_t* bytes, uint8_t num_bytes, uint16_t timestamp) {
+    int producer = bytes[0] & 0x0f;
+    if ((bytes[0] & 0xf0) == 0xd0) {
+        assert_eq(num_bytes, 2, "channel pressure should have one data byte");
+        check_seq(producer, bytes[1], 7);
+    } else {
+        assert_eq(bytes[0] & 0xf0, 0x90, "unexpected message");
+        check_seq(producer, bytes[1] | (bytes[2] << 7), 14);
+    }
+}
+
+static uint8_t sysex_bytes[8];
+static int num_sysex_bytes = 0;
+
+static void parsed_sysex_start_cb(void* user_data, uint16_t timestamp) {
+    num_sysex_bytes = 0;
+}
+
+static void parsed_sysex_data_cb(void* user_data, uint8_t data_byte) {
+    assert_true(num_sysex_bytes < sizeof(sysex_bytes), "sysex message should not be interleaved");
+    sysex_bytes[num_sysex_bytes++] = data_byte;
+}
+
+static void parsed_sysex_end_cb(void* user_data, uint16_t timestamp) {
+    assert_eq(num_sysex_bytes, 3, "sysex message should not be interleaved");
+    check_seq(sysex_bytes[0], sysex_bytes[1] | (sysex_bytes[2] << 7), 14);
+}
+
+int main(int argc, char *argv[])
+{
+    tx_queue_init(&queue, &callbacks, 1, 0);
+    tx_queue_set_ring(&queue, ring_buf, sizeof(ring_buf));
+    queue.multi_producer = 1;
+    tx_queue_fifo_add_tx_packet_size(&queue, TX_PACKET_SIZE);
+    tx_queue_read_from_fifo(&queue);
+
+    struct ble_midi_parse_cb_t cb = {
+        .midi_message_cb = parsed_msg_cb,
+        .sysex_start_cb = parsed_sysex_start_cb,
+        .sysex_data_cb = parsed_sysex_data_cb,
+        .sysex_end_cb = parsed_sysex_end_cb,
+    };
+    struct ble_midi_parser_t parser;
+    ble_midi_parser_init(&parser, &cb);
+
+    double start = now_s();
+    pthread_t threads[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        assert_eq(pthread_create(&threads[i], NULL, producer_thread, (void*)(intptr_t)i), 0, "thread should start");
+    }
+
+    // Read and "send" until the producers are done and everything has been sent
+    int num_sent_packets = 0;
+    while (1) {
+        int producers_done = __atomic_load_n(&num_finished_producers, __ATOMIC_ACQUIRE) == NUM_PRODUCERS;
+        tx_queue_read_from_fifo(&queue);
+        if (!queue.has_tx_data) {
+            // Let the producers run if there's a single CPU
+            sched_yield();
+        }
+        while (queue.has_tx_data) {
+            struct ble_midi_writer_t* packet = tx_queue_first_tx_packet(&queue);
+            assert_true(packet->tx_buf_size <= TX_PACKET_SIZE, "Packet should not exceed the max packet size");
+            assert_eq(ble_midi_parser_feed(&parser, packet->tx_buf, packet->tx_buf_size), BLE_MIDI_PACKET_SUCCESS, "Packet should be valid");
+            tx_queue_on_tx_packet_sent(&queue);
+            num_sent_packets++;
+        }
+        if (producers_done && tx_queue_fifo_is_empty(&queue)) {
+            break;
+        }
+    }
+    double duration = now_s() - start;
+
+    int num_msgs = 0;
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+        assert_eq(expected_seqs[i], num_added_msgs[i], "all messages of a producer should arrive");
+        num_msgs += num_added_msgs[i];
+    }
+    assert_eq(num_received_msgs, num_msgs, "all messages should arrive");
+    printf("%d producers, %d byte ring: %d messages in %d packets, %.2f Mmsgs/s\n", NUM_PRODUCERS, RING_SIZE,
+           num_received_msgs, num_sent_packets, num_received_msgs / duration / 1e6);
+
+    return 0;
+}
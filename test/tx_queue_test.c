@@ -72,10 +72,13 @@ void notify_has_data(int has_data) {
 
 }
 
+// The timestamp returned by the ble_timestamp callback
+static uint16_t current_timestamp = 123;
+
 uint16_t ble_timestamp()
 {
     // printf("ble_timestamp\n");
-	return 123;
+	return current_timestamp;
 }
 
 static struct tx_queue_callbacks callbacks = {
@@ -252,7 +255,7 @@ static void test_multi_packet_sysex() {
 
     assert_eq(queue.tx_packets[0].tx_buf_size, queue.tx_packets[0].tx_buf_max_size, "First sysex packet should be full");
     assert_eq(queue.tx_packets[1].tx_buf_size, queue.tx_packets[1].tx_buf_max_size, "Second sysex packet should be full");
-    assert_true(queue.tx_packets[2].tx_buf_size < queue.tx_packets[2].tx_buf_max_size, "Second sysex packet should be partially filled");
+    assert_eq(queue.tx_packets[2].tx_buf[queue.tx_packets[2].tx_buf_size - 1], 0xf7, "Third sysex packet should end the sysex message");
     assert_eq(queue.tx_packet_count, 3, "Sysex message should span 3 tx packets");
 
     assert_eq(tx_queue_on_tx_packet_sent(&queue), TX_QUEUE_SUCCESS, "popping first packet should succeed");
@@ -329,6 +332,566 @@ static void test_invalid_sysex_data() {
 
 }
 
+static void test_msg_runs() {
+    int tx_packet_size = 10; // one packet can hold 2 note on messages
+    struct tx_queue queue;
+    init_test_queue(&queue, tx_packet_size, 16);
+
+    const uint8_t chord[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x90, 0x40, 0x7f},
+        {0x90, 0x43, 0x7f},
+    };
+    assert_eq(tx_queue_fifo_add_msgs(&queue, chord, 3), TX_QUEUE_SUCCESS, "chord should fit in FIFO");
+    assert_eq(fifo.num_bytes, 9, "FIFO should hold the chord");
+    assert_eq(tx_queue_fifo_add_msgs(&queue, chord, 3), TX_QUEUE_FIFO_FULL, "chord should not fit in FIFO");
+    assert_eq(fifo.num_bytes, 9, "Failed add should not write a partial chord");
+
+    // A sysex start ends the run of messages
+    tx_queue_fifo_add_sysex_start(&queue);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    assert_eq(queue.tx_packet_count, 2, "Chord should be split over two packets");
+    assert_eq(tx_queue_first_tx_packet(&queue)->tx_buf_size, 9, "First packet should hold two notes");
+    struct ble_midi_writer_t* last_packet = tx_queue_last_tx_packet(&queue);
+    assert_eq(last_packet->tx_buf_size, 7, "Last packet should hold a note and sysex start");
+    assert_eq(last_packet->tx_buf[6], 0xf0, "Sysex start should follow the chord");
+}
+
+// The MIDI bytes of the pending tx packets, as seen by a receiver
+static uint8_t parsed_bytes[256];
+static int num_parsed_bytes = 0;
+// The timestamps of parsed messages and sysex starts
+static uint16_t parsed_timestamps[64];
+static int num_parsed_timestamps = 0;
+
+static void parsed_msg_cb(void* user_data, uint8_t* bytes, uint8_t num_bytes, uint16_t timestamp) {
+    memcpy(&parsed_bytes[num_parsed_bytes], bytes, num_bytes);
+    num_parsed_bytes += num_bytes;
+    parsed_timestamps[num_parsed_timestamps++] = timestamp;
+}
+
+static void parsed_sysex_start_cb(void* user_data, uint16_t timestamp) {
+    parsed_bytes[num_parsed_bytes++] = 0xf0;
+    parsed_timestamps[num_parsed_timestamps++] = timestamp;
+}
+
+static void parsed_sysex_data_cb(void* user_data, uint8_t data_byte) {
+    parsed_bytes[num_parsed_bytes++] = data_byte;
+}
+
+static void parsed_sysex_end_cb(void* user_data, uint16_t timestamp) {
+    parsed_bytes[num_parsed_bytes++] = 0xf7;
+}
+
+static void parse_pending_tx_packets(struct tx_queue* queue, int max_packet_size) {
+    struct ble_midi_parse_cb_t cb = {
+        .midi_message_cb = parsed_msg_cb,
+        .sysex_start_cb = parsed_sysex_start_cb,
+        .sysex_data_cb = parsed_sysex_data_cb,
+        .sysex_end_cb = parsed_sysex_end_cb,
+    };
+    struct ble_midi_parser_t parser;
+    ble_midi_parser_init(&parser, &cb);
+    num_parsed_bytes = 0;
+    num_parsed_timestamps = 0;
+    for (int i = 0; i < queue->tx_packet_count; i++) {
+        struct ble_midi_writer_t* packet = &queue->tx_packets[(queue->first_tx_packet_idx + i) % TX_QUEUE_PACKET_COUNT];
+        assert_true(packet->tx_buf_size <= max_packet_size, "Packet should not exceed the max packet size");
+        assert_eq(ble_midi_parser_feed(&parser, packet->tx_buf, packet->tx_buf_size), BLE_MIDI_PACKET_SUCCESS, "Packet should be valid");
+    }
+}
+
+static void test_packet_size_change() {
+    int tx_packet_size = 10; // one packet can hold 2 note on messages
+    struct tx_queue queue;
+    init_test_queue(&queue, tx_packet_size, 256);
+
+    // Fill all tx packets with messages and a sysex message spanning packets
+    uint8_t sysex_data_bytes[12];
+    for (int i = 0; i < sizeof(sysex_data_bytes); i++) {
+        sysex_data_bytes[i] = i;
+    }
+    for (int i = 0; i < 3; i++) {
+        add_note_on_to_fifo(&queue);
+    }
+    tx_queue_fifo_add_sysex_start(&queue);
+    tx_queue_fifo_add_sysex_data(&queue, sysex_data_bytes, sizeof(sysex_data_bytes));
+    tx_queue_fifo_add_sysex_end(&queue);
+    add_note_on_to_fifo(&queue);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    assert_eq(queue.tx_packet_count, TX_QUEUE_PACKET_COUNT, "All tx packets should be used");
+
+    uint8_t expected_bytes[256];
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    int num_expected_bytes = num_parsed_bytes;
+    memcpy(expected_bytes, parsed_bytes, num_parsed_bytes);
+
+    // Growing the packet size should merge the pending packets
+    tx_queue_fifo_add_tx_packet_size(&queue, 64);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 1, "Pending packets should be merged into one");
+    parse_pending_tx_packets(&queue, 64);
+    assert_eq(num_parsed_bytes, num_expected_bytes, "Merging should preserve the MIDI data");
+    assert_true(memcmp(parsed_bytes, expected_bytes, num_expected_bytes) == 0, "Merging should preserve the MIDI data");
+
+    // New messages should be added to the merged packet
+    add_note_on_to_fifo(&queue);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 1, "New message should be added to the merged packet");
+    expected_bytes[num_expected_bytes++] = 0x90;
+    expected_bytes[num_expected_bytes++] = 0x60;
+    expected_bytes[num_expected_bytes++] = 0x7f;
+
+    // Shrinking the packet size should split the pending packets
+    tx_queue_fifo_add_tx_packet_size(&queue, 12);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 4, "Pending packet should be split");
+    parse_pending_tx_packets(&queue, 12);
+    assert_eq(num_parsed_bytes, num_expected_bytes, "Splitting should preserve the MIDI data");
+    assert_true(memcmp(parsed_bytes, expected_bytes, num_expected_bytes) == 0, "Splitting should preserve the MIDI data");
+
+    // Sending the packets up to the middle of the sysex message and growing again
+    // should merge the rest, continuing the sysex message
+    tx_queue_on_tx_packet_sent(&queue);
+    tx_queue_on_tx_packet_sent(&queue);
+    tx_queue_fifo_add_tx_packet_size(&queue, 64);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 1, "Remaining packets should be merged into one");
+    assert_true(queue.tx_packets[queue.first_tx_packet_idx].tx_buf[1] < 0x80, "Merged packet should continue the sysex message");
+
+    // Shrinking so much that a note on message doesn't fit in a packet should drop the
+    // messages, keeping the sysex data
+    tx_queue_fifo_add_tx_packet_size(&queue, 4);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 3, "Sysex data should be split");
+    parse_pending_tx_packets(&queue, 4);
+    assert_eq(parsed_bytes[num_parsed_bytes - 1], 0xf7, "Sysex data should be kept");
+}
+
+static void test_packet_size_change_in_sysex() {
+    int tx_packet_size = 10;
+    struct tx_queue queue;
+    init_test_queue(&queue, tx_packet_size, 256);
+
+    // Fill the first packet with the sysex start and data, and put a timing clock in the
+    // middle of the sysex message in the second one
+    uint8_t sysex_data_bytes[12];
+    for (int i = 0; i < sizeof(sysex_data_bytes); i++) {
+        sysex_data_bytes[i] = i;
+    }
+    const uint8_t clock[3] = {0xf8, 0, 0};
+    tx_queue_fifo_add_sysex_start(&queue);
+    tx_queue_fifo_add_sysex_data(&queue, sysex_data_bytes, 7);
+    tx_queue_fifo_add_msg(&queue, clock);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 2, "The clock should be in a second packet");
+
+    // Send the first packet and shrink the packet size. The pending packet starts in the
+    // middle of the sysex message, so the rest of it should still be accepted.
+    tx_queue_on_tx_packet_sent(&queue);
+    tx_queue_fifo_add_tx_packet_size(&queue, 8);
+    tx_queue_read_from_fifo(&queue);
+    tx_queue_fifo_add_sysex_data(&queue, &sysex_data_bytes[7], 5);
+    tx_queue_fifo_add_sysex_end(&queue);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading the sysex message");
+
+    parse_pending_tx_packets(&queue, 8);
+    uint8_t expected_bytes[] = { 0xf8, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0xf7 };
+    assert_eq(num_parsed_bytes, sizeof(expected_bytes), "The rest of the sysex message should be kept");
+    assert_true(memcmp(parsed_bytes, expected_bytes, sizeof(expected_bytes)) == 0, "The rest of the sysex message should be kept");
+}
+
+static void test_sysex_msgs() {
+    int tx_packet_size = 20;
+    struct tx_queue queue;
+    init_test_queue(&queue, tx_packet_size, 256);
+
+    // A short sysex message should share a packet with other messages
+    const uint8_t sysex_msg[] = { 0xf0, 0x7e, 0x7f, 0x06, 0x01, 0xf7 };
+    add_note_on_to_fifo(&queue);
+    assert_eq(tx_queue_fifo_add_sysex_msg(&queue, sysex_msg, sizeof(sysex_msg)), TX_QUEUE_SUCCESS, "sysex message should fit in FIFO");
+    add_note_on_to_fifo(&queue);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    assert_eq(queue.tx_packet_count, 1, "Messages should share one packet");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    uint8_t expected_bytes[] = { 0x90, 0x60, 0x7f, 0xf0, 0x7e, 0x7f, 0x06, 0x01, 0xf7, 0x90, 0x60, 0x7f };
+    assert_eq(num_parsed_bytes, sizeof(expected_bytes), "Messages should be preserved");
+    assert_true(memcmp(parsed_bytes, expected_bytes, sizeof(expected_bytes)) == 0, "Messages should be preserved");
+
+    // A sysex message that doesn't fit in the rest of the packet should go to the next one
+    tx_queue_fifo_add_sysex_msg(&queue, sysex_msg, sizeof(sysex_msg));
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 2, "Sysex message should be added to a new packet");
+    assert_eq(tx_queue_last_tx_packet(&queue)->tx_buf_size, 9, "Sysex message should be whole");
+
+    // A sysex message too long for one packet should be split
+    while (queue.has_tx_data) {
+        tx_queue_on_tx_packet_sent(&queue);
+    }
+    uint8_t long_sysex_msg[40];
+    long_sysex_msg[0] = 0xf0;
+    for (int i = 1; i < sizeof(long_sysex_msg) - 1; i++) {
+        long_sysex_msg[i] = i;
+    }
+    long_sysex_msg[sizeof(long_sysex_msg) - 1] = 0xf7;
+    add_note_on_to_fifo(&queue);
+    tx_queue_fifo_add_sysex_msg(&queue, long_sysex_msg, sizeof(long_sysex_msg));
+    add_note_on_to_fifo(&queue);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    assert_eq(queue.tx_packet_count, 3, "Long sysex message should be split");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_bytes, 3 + sizeof(long_sysex_msg) + 3, "Messages should be preserved");
+    assert_true(memcmp(&parsed_bytes[3], long_sysex_msg, sizeof(long_sysex_msg)) == 0, "Long sysex message should be preserved");
+
+    // Messages longer than the FIFO can hold in one chunk are rejected
+    uint8_t too_long_sysex_msg[TX_QUEUE_SYSEX_MSG_MAX_SIZE + 1] = { 0 };
+    assert_eq(tx_queue_fifo_add_sysex_msg(&queue, too_long_sysex_msg, sizeof(too_long_sysex_msg)), TX_QUEUE_INVALID_DATA, "Too long sysex message should be rejected");
+}
+
+static void test_msg_groups() {
+    int tx_packet_size = 10; // one packet can hold 2 note on messages
+    struct tx_queue queue;
+    init_test_queue(&queue, tx_packet_size, 128);
+
+    const uint8_t chord[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x90, 0x40, 0x7f},
+    };
+    // A group that doesn't fit in the rest of a packet should go to the next one
+    add_note_on_to_fifo(&queue);
+    assert_eq(tx_queue_fifo_add_msg_group(&queue, chord, 2), TX_QUEUE_SUCCESS, "group should fit in FIFO");
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    assert_eq(queue.tx_packet_count, 2, "Group should be moved to a new packet");
+    assert_eq(tx_queue_first_tx_packet(&queue)->tx_buf_size, 5, "First packet should hold one note");
+    assert_eq(tx_queue_last_tx_packet(&queue)->tx_buf_size, 9, "Last packet should hold the group");
+
+    // A group should wait for a free packet instead of being split
+    add_note_on_to_fifo(&queue);
+    add_note_on_to_fifo(&queue);
+    add_note_on_to_fifo(&queue);
+    tx_queue_fifo_add_msg_group(&queue, chord, 2);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, TX_QUEUE_PACKET_COUNT, "All tx packets should be used");
+    assert_eq(tx_queue_last_tx_packet(&queue)->tx_buf_size, 5, "Last packet should hold one note");
+    assert_eq(fifo.num_bytes, 9, "Group should be left in the FIFO");
+    tx_queue_on_tx_packet_sent(&queue);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "Group should be read once there is a free packet");
+    assert_eq(tx_queue_last_tx_packet(&queue)->tx_buf_size, 9, "Last packet should hold the group");
+
+    // A group too large for one packet should be split
+    while (queue.has_tx_data) {
+        tx_queue_on_tx_packet_sent(&queue);
+    }
+    const uint8_t large_chord[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x90, 0x40, 0x7f},
+        {0x90, 0x43, 0x7f},
+    };
+    tx_queue_fifo_add_msg_group(&queue, large_chord, 3);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    assert_eq(queue.tx_packet_count, 2, "Large group should be split");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_bytes, 9, "Large group should be preserved");
+    assert_true(memcmp(parsed_bytes, large_chord, 9) == 0, "Large group should be preserved");
+}
+
+static void test_reordered_msgs() {
+    int tx_packet_size = 64;
+    struct tx_queue queue;
+    running_status_enabled = 1;
+    init_test_queue(&queue, tx_packet_size, 128);
+    running_status_enabled = 0;
+    queue.reorder_msgs = 1;
+
+    const uint8_t chord[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x91, 0x3c, 0x7f},
+        {0x90, 0x40, 0x7f},
+        {0x91, 0x40, 0x7f},
+    };
+    const uint8_t reordered_chord[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x90, 0x40, 0x7f},
+        {0x91, 0x3c, 0x7f},
+        {0x91, 0x40, 0x7f},
+    };
+    tx_queue_fifo_add_msg_group(&queue, chord, 4);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    assert_eq(queue.tx_packet_count, 1, "Messages should be written to one packet");
+    // header + 2 * (timestamp + 3 + 2) instead of header + 4 * (timestamp + 3)
+    assert_eq(tx_queue_first_tx_packet(&queue)->tx_buf_size, 13, "Reordering should enable running status");
+    assert_eq(queue.num_reordered_msgs, 4, "Reordered messages should be counted");
+    assert_eq(queue.num_reorder_bytes_saved, 4, "Saved bytes should be counted");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_bytes, 12, "Messages should be preserved");
+    assert_true(memcmp(parsed_bytes, reordered_chord, 12) == 0, "Messages should be grouped by status byte");
+
+    // Messages that gain nothing from reordering are written as is
+    tx_queue_on_tx_packet_sent(&queue);
+    const uint8_t notes[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x91, 0x3c, 0x7f},
+    };
+    tx_queue_fifo_add_msg_group(&queue, notes, 2);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.num_reordered_msgs, 4, "Messages in input order should not be counted");
+}
+
+static void test_packed_msgs() {
+    int tx_packet_size = 64;
+    int fifo_capacity = 12;
+    struct tx_queue queue;
+    init_test_queue(&queue, tx_packet_size, fifo_capacity);
+
+    // Messages take up as many bytes as their status byte implies
+    const uint8_t clock[3] = {0xf8, 0, 0};
+    int num_clocks = 0;
+    while (tx_queue_fifo_add_msg(&queue, clock) == TX_QUEUE_SUCCESS) {
+        num_clocks++;
+    }
+    assert_eq(num_clocks, fifo_capacity, "timing clocks should take up one byte each");
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_bytes, num_clocks, "timing clocks should be preserved");
+    tx_queue_on_tx_packet_sent(&queue);
+
+    const uint8_t msgs[][3] = {
+        {0xc0, 0x05, 0x00},
+        {0xf8, 0x00, 0x00},
+        {0x90, 0x3c, 0x7f},
+        {0xd0, 0x40, 0x00},
+        {0xf2, 0x01, 0x02},
+        {0xf6, 0x00, 0x00},
+    };
+    const uint8_t packed_msgs[] = {0xc0, 0x05, 0xf8, 0x90, 0x3c, 0x7f, 0xd0, 0x40, 0xf2, 0x01, 0x02, 0xf6};
+    assert_eq(tx_queue_fifo_add_msgs(&queue, msgs, 6), TX_QUEUE_SUCCESS, "packed messages should fit in FIFO");
+    assert_eq(fifo.num_bytes, sizeof(packed_msgs), "messages should be packed");
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading messages");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_bytes, sizeof(packed_msgs), "messages should be preserved");
+    assert_true(memcmp(parsed_bytes, packed_msgs, sizeof(packed_msgs)) == 0, "messages should be preserved");
+    tx_queue_on_tx_packet_sent(&queue);
+
+    // Groups are packed too
+    assert_eq(tx_queue_fifo_add_msg_group(&queue, msgs, 3), TX_QUEUE_SUCCESS, "packed group should fit in FIFO");
+    assert_eq(fifo.num_bytes, 3 + 6, "group should be packed");
+    tx_queue_read_from_fifo(&queue);
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_bytes, 6, "group should be preserved");
+    assert_true(memcmp(parsed_bytes, packed_msgs, 6) == 0, "group should be preserved");
+    tx_queue_on_tx_packet_sent(&queue);
+
+    // Sysex start and end take up one byte each
+    tx_queue_fifo_add_sysex_start(&queue);
+    tx_queue_fifo_add_sysex_end(&queue);
+    assert_eq(fifo.num_bytes, 2, "sysex start and end should take up one byte each");
+    tx_queue_read_from_fifo(&queue);
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_bytes, 2, "sysex start and end should be preserved");
+    tx_queue_on_tx_packet_sent(&queue);
+
+    // Status bytes that don't imply a size are rejected
+    const uint8_t undefined_msg[3] = {0xf4, 0x00, 0x00};
+    const uint8_t data_bytes[3] = {0x10, 0x20, 0x30};
+    assert_eq(tx_queue_fifo_add_msg(&queue, undefined_msg), TX_QUEUE_INVALID_DATA, "undefined status byte should be rejected");
+    assert_eq(tx_queue_fifo_add_msg(&queue, data_bytes), TX_QUEUE_INVALID_DATA, "message without status byte should be rejected");
+    const uint8_t msgs_with_undefined_msg[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0xf4, 0x00, 0x00},
+    };
+    assert_eq(tx_queue_fifo_add_msgs(&queue, msgs_with_undefined_msg, 2), TX_QUEUE_INVALID_DATA, "undefined status byte should be rejected");
+    assert_eq(tx_queue_fifo_add_msg_group(&queue, msgs_with_undefined_msg, 2), TX_QUEUE_INVALID_DATA, "undefined status byte should be rejected");
+
+    // Sysex start and end can only be added with the sysex calls
+    const uint8_t sysex_status_bytes[2] = {0xf0, 0xf7};
+    for (int i = 0; i < 2; i++) {
+        const uint8_t msgs_with_sysex_status[][3] = {
+            {0x90, 0x3c, 0x7f},
+            {sysex_status_bytes[i], 0x00, 0x00},
+        };
+        assert_eq(tx_queue_fifo_add_msg(&queue, msgs_with_sysex_status[1]), TX_QUEUE_INVALID_DATA, "sysex status byte should be rejected");
+        assert_eq(tx_queue_fifo_add_msgs(&queue, msgs_with_sysex_status, 2), TX_QUEUE_INVALID_DATA, "sysex status byte should be rejected");
+        assert_eq(tx_queue_fifo_add_msg_group(&queue, msgs_with_sysex_status, 2), TX_QUEUE_INVALID_DATA, "sysex status byte should be rejected");
+    }
+    assert_eq(fifo.num_bytes, 0, "nothing should be added");
+}
+
+static void test_built_in_ring() {
+    int tx_packet_size = 64;
+    struct tx_queue queue;
+    static uint8_t ring_buf[32];
+    tx_queue_init(&queue, &callbacks, running_status_enabled, note_off_as_note_on);
+    tx_queue_set_ring(&queue, ring_buf, sizeof(ring_buf));
+    tx_queue_fifo_add_tx_packet_size(&queue, tx_packet_size);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packets->tx_buf_max_size, tx_packet_size, "TX packet size should be set");
+    assert_true(tx_queue_fifo_is_empty(&queue), "ring should be empty");
+
+    // Fill the ring
+    int num_added_msgs = 0;
+    while (add_note_on_to_fifo(&queue) == TX_QUEUE_SUCCESS) {
+        num_added_msgs++;
+    }
+    assert_eq(num_added_msgs, sizeof(ring_buf) / 3, "ring should hold as many messages as fit");
+    tx_queue_read_from_fifo(&queue);
+    assert_true(tx_queue_fifo_is_empty(&queue), "ring should be empty after reading messages");
+    tx_queue_on_tx_packet_sent(&queue);
+
+    // Wrap around the ring a number of times with chunks of different sizes
+    const uint8_t sysex_msg[] = {0xf0, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0xf7};
+    const uint8_t chord[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x90, 0x40, 0x7f},
+    };
+    for (int i = 0; i < 20; i++) {
+        assert_eq(tx_queue_fifo_add_sysex_msg(&queue, sysex_msg, sizeof(sysex_msg)), TX_QUEUE_SUCCESS, "sysex message should fit in ring");
+        assert_eq(tx_queue_fifo_add_msg_group(&queue, chord, 2), TX_QUEUE_SUCCESS, "group should fit in ring");
+        assert_eq(tx_queue_fifo_add_msg_group(&queue, chord, 2), TX_QUEUE_SUCCESS, "group should fit in ring");
+        assert_eq(tx_queue_fifo_add_msg_group(&queue, chord, 2), TX_QUEUE_FIFO_FULL, "ring should be full");
+        tx_queue_read_from_fifo(&queue);
+        assert_true(tx_queue_fifo_is_empty(&queue), "ring should be empty after reading chunks");
+        parse_pending_tx_packets(&queue, tx_packet_size);
+        assert_eq(num_parsed_bytes, sizeof(sysex_msg) + 2 * sizeof(chord), "chunks should be preserved");
+        assert_true(memcmp(parsed_bytes, sysex_msg, sizeof(sysex_msg)) == 0, "sysex message should be preserved");
+        assert_true(memcmp(&parsed_bytes[sizeof(sysex_msg)], chord, sizeof(chord)) == 0, "group should be preserved");
+        assert_true(memcmp(&parsed_bytes[sizeof(sysex_msg) + sizeof(chord)], chord, sizeof(chord)) == 0, "group should be preserved");
+        while (queue.has_tx_data) {
+            tx_queue_on_tx_packet_sent(&queue);
+        }
+    }
+
+    add_note_on_to_fifo(&queue);
+    tx_queue_reset(&queue);
+    assert_true(tx_queue_fifo_is_empty(&queue), "reset should clear the ring");
+}
+
+static void test_built_in_ring_sysex_stream() {
+    // A sysex stream through a small ring and small packets, so the data chunks are
+    // added in parts and wrap around the ring
+    int tx_packet_size = 10;
+    struct tx_queue queue;
+    static uint8_t ring_buf[64];
+    tx_queue_init(&queue, &callbacks, running_status_enabled, note_off_as_note_on);
+    tx_queue_set_ring(&queue, ring_buf, sizeof(ring_buf));
+    tx_queue_fifo_add_tx_packet_size(&queue, tx_packet_size);
+    tx_queue_read_from_fifo(&queue);
+
+    uint8_t sysex_data_bytes[200];
+    int sysex_data_byte_count = sizeof(sysex_data_bytes);
+    for (int i = 0; i < sysex_data_byte_count; i++) {
+        sysex_data_bytes[i] = (i * 7) % 128;
+    }
+
+    struct ble_midi_parse_cb_t cb = {
+        .midi_message_cb = parsed_msg_cb,
+        .sysex_start_cb = parsed_sysex_start_cb,
+        .sysex_data_cb = parsed_sysex_data_cb,
+        .sysex_end_cb = parsed_sysex_end_cb,
+    };
+    struct ble_midi_parser_t parser;
+    ble_midi_parser_init(&parser, &cb);
+    num_parsed_bytes = 0;
+
+    assert_eq(tx_queue_fifo_add_sysex_start(&queue), TX_QUEUE_SUCCESS, "sysex start should fit in ring");
+    int num_added_data_bytes = 0;
+    int end_added = 0;
+    int num_rounds = 0;
+    while (!end_added || queue.has_tx_data || !tx_queue_fifo_is_empty(&queue)) {
+        assert_true(num_rounds++ < 1000, "sysex stream should be sent");
+        if (num_added_data_bytes < sysex_data_byte_count) {
+            int add_result = tx_queue_fifo_add_sysex_data(&queue, &sysex_data_bytes[num_added_data_bytes], sysex_data_byte_count - num_added_data_bytes);
+            if (add_result > 0) {
+                num_added_data_bytes += add_result;
+            }
+        } else if (!end_added) {
+            end_added = tx_queue_fifo_add_sysex_end(&queue) == TX_QUEUE_SUCCESS;
+        }
+        tx_queue_read_from_fifo(&queue);
+        if (num_rounds == 1) {
+            assert_true(!tx_queue_fifo_is_empty(&queue), "partially added data chunk should stay in the ring");
+        }
+        while (queue.has_tx_data) {
+            struct ble_midi_writer_t* packet = &queue.tx_packets[queue.first_tx_packet_idx];
+            assert_true(packet->tx_buf_size <= tx_packet_size, "Packet should not exceed the max packet size");
+            assert_eq(ble_midi_parser_feed(&parser, packet->tx_buf, packet->tx_buf_size), BLE_MIDI_PACKET_SUCCESS, "Packet should be valid");
+            tx_queue_on_tx_packet_sent(&queue);
+        }
+    }
+    assert_eq(num_parsed_bytes, sysex_data_byte_count + 2, "sysex stream should be preserved");
+    assert_eq(parsed_bytes[0], 0xf0, "sysex stream should start");
+    assert_true(memcmp(&parsed_bytes[1], sysex_data_bytes, sysex_data_byte_count) == 0, "sysex data should be preserved");
+    assert_eq(parsed_bytes[sysex_data_byte_count + 1], 0xf7, "sysex stream should end");
+}
+
+static void test_enqueue_timestamps() {
+    int tx_packet_size = 64;
+    struct tx_queue queue;
+    running_status_enabled = 1;
+    init_test_queue(&queue, tx_packet_size, 128);
+    running_status_enabled = 0;
+
+    // Messages added at the same time share a timestamp chunk
+    const uint8_t notes[][3] = {
+        {0x90, 0x3c, 0x7f},
+        {0x90, 0x40, 0x7f},
+        {0x90, 0x43, 0x7f},
+    };
+    const uint8_t sysex_msg[] = {0xf0, 0x01, 0xf7};
+    current_timestamp = 200;
+    tx_queue_fifo_add_msg(&queue, notes[0]);
+    tx_queue_fifo_add_msg(&queue, notes[1]);
+    assert_eq(fifo.num_bytes, 2 + 3 + 3, "messages added at the same time should share a timestamp chunk");
+    current_timestamp = 205;
+    tx_queue_fifo_add_msg(&queue, notes[2]);
+    current_timestamp = 210;
+    tx_queue_fifo_add_sysex_msg(&queue, sysex_msg, sizeof(sysex_msg));
+    assert_eq(fifo.num_bytes, 8 + 2 + 3 + 2 + 3 + sizeof(sysex_msg), "a changed timestamp should add a timestamp chunk");
+
+    // Reading later doesn't change the timestamps
+    current_timestamp = 250;
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(fifo.num_bytes, 0, "FIFO should be empty after reading chunks");
+    assert_eq(queue.tx_packet_count, 1, "chunks should be written to one packet");
+    // header + (timestamp + 3) + 2 with running status and the same timestamp, then
+    // (timestamp + 2) and the sysex message with two timestamps
+    assert_eq(tx_queue_first_tx_packet(&queue)->tx_buf_size, 1 + 4 + 2 + 3 + 5, "running status should skip repeated timestamps");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_timestamps, 4, "messages should be preserved");
+    assert_eq(parsed_timestamps[0], 200, "message should have the timestamp it was added at");
+    assert_eq(parsed_timestamps[1], 200, "message should have the timestamp it was added at");
+    assert_eq(parsed_timestamps[2], 205, "message should have the timestamp it was added at");
+    assert_eq(parsed_timestamps[3], 210, "sysex message should have the timestamp it was added at");
+    tx_queue_on_tx_packet_sent(&queue);
+
+    // Timestamps wrap around after 13 bits
+    current_timestamp = 0x1fff;
+    tx_queue_fifo_add_msg(&queue, notes[0]);
+    current_timestamp = 0;
+    tx_queue_fifo_add_msg(&queue, notes[1]);
+    // More than 127 ms later, which a timestamp byte can't express in the same packet
+    current_timestamp = 300;
+    tx_queue_fifo_add_msg(&queue, notes[2]);
+    tx_queue_read_from_fifo(&queue);
+    assert_eq(queue.tx_packet_count, 2, "a late message should go to a new packet");
+    parse_pending_tx_packets(&queue, tx_packet_size);
+    assert_eq(num_parsed_timestamps, 3, "messages should be preserved");
+    assert_eq(parsed_timestamps[0], 0x1fff, "message should have the timestamp it was added at");
+    assert_eq(parsed_timestamps[1], 0, "message should have the timestamp it was added at");
+    assert_eq(parsed_timestamps[2], 300, "message should have the timestamp it was added at");
+    current_timestamp = 123;
+}
+
 int main(int argc, char *argv[])
 {
     test_non_sysex_msgs();
@@ -338,6 +901,16 @@ int main(int argc, char *argv[])
     test_multi_packet_sysex();
     test_continued_multi_packet_sysex();
     test_invalid_sysex_data();
+    test_msg_runs();
+    test_packet_size_change();
+    test_packet_size_change_in_sysex();
+    test_sysex_msgs();
+    test_msg_groups();
+    test_reordered_msgs();
+    test_packed_msgs();
+    test_built_in_ring();
+    test_built_in_ring_sysex_stream();
+    test_enqueue_timestamps();
 
     // test_has_data_flag(); //should work both for sysex and messages
 
@@ -0,0 +1,6 @@
+#ifndef _ZEPHYR_STUBS_BLUETOOTH_H_
+#define _ZEPHYR_STUBS_BLUETOOTH_H_
+
+#include <zephyr/kernel.h>
+
+#endif // _ZEPHYR_STUBS_BLUETOOTH_H_
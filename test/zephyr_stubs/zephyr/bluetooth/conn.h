@@ -0,0 +1,37 @@
+#ifndef _ZEPHYR_STUBS_CONN_H_
+#define _ZEPHYR_STUBS_CONN_H_
+
+#include <stdint.h>
+
+struct bt_conn;
+typedef int bt_security_t;
+enum bt_security_err { BT_SECURITY_ERR_SUCCESS };
+
+struct bt_le_conn_param {
+    uint16_t interval_min;
+    uint16_t interval_max;
+    uint16_t latency;
+    uint16_t timeout;
+};
+#define BT_LE_CONN_PARAM(a, b, c, d) (&(struct bt_le_conn_param){ a, b, c, d })
+#define BT_CONN_INTERVAL_TO_MS(interval) ((interval) * 5 / 4)
+
+struct bt_conn_le_info {
+    uint16_t interval;
+};
+struct bt_conn_info {
+    struct bt_conn_le_info le;
+};
+int bt_conn_get_info(const struct bt_conn* conn, struct bt_conn_info* info);
+int bt_conn_le_param_update(struct bt_conn* conn, const struct bt_le_conn_param* param);
+
+struct bt_conn_cb {
+    void (*connected)(struct bt_conn* conn, uint8_t err);
+    void (*disconnected)(struct bt_conn* conn, uint8_t reason);
+    void (*le_param_updated)(struct bt_conn* conn, uint16_t interval, uint16_t latency, uint16_t timeout);
+    void (*security_changed)(struct bt_conn* conn, bt_security_t level, enum bt_security_err err);
+};
+// Zephyr registers these through a linker section. Here the test calls them directly.
+#define BT_CONN_CB_DEFINE(name) const struct bt_conn_cb name
+
+#endif // _ZEPHYR_STUBS_CONN_H_
@@ -0,0 +1,57 @@
+#ifndef _ZEPHYR_STUBS_GATT_H_
+#define _ZEPHYR_STUBS_GATT_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+
+struct bt_gatt_attr;
+typedef ssize_t (*bt_gatt_attr_read_func_t)(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                            void* buf, uint16_t len, uint16_t offset);
+typedef ssize_t (*bt_gatt_attr_write_func_t)(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                             const void* buf, uint16_t len, uint16_t offset, uint8_t flags);
+struct bt_gatt_attr {
+    bt_gatt_attr_read_func_t read;
+    bt_gatt_attr_write_func_t write;
+    void* user_data;
+};
+struct bt_gatt_service {
+    struct bt_gatt_attr* attrs;
+    size_t attr_count;
+};
+
+#define BT_GATT_PRIMARY_SERVICE(uuid) { 0 }
+#define BT_GATT_CHARACTERISTIC(uuid, props, perm, read, write, user_data) { read, write, user_data }
+#define BT_GATT_CCC(changed, perm) { 0, 0, (void*)changed }
+#define BT_GATT_SERVICE(attrs) { attrs, sizeof(attrs) / sizeof((attrs)[0]) }
+#define BT_GATT_SERVICE_DEFINE(name, ...) \
+    static struct bt_gatt_attr name##_attrs[] = { __VA_ARGS__ }; \
+    const struct bt_gatt_service name = BT_GATT_SERVICE(name##_attrs)
+
+#define BT_GATT_CHRC_READ 0x02
+#define BT_GATT_CHRC_WRITE_WITHOUT_RESP 0x04
+#define BT_GATT_CHRC_NOTIFY 0x10
+#define BT_GATT_PERM_READ 0x01
+#define BT_GATT_PERM_WRITE 0x02
+#define BT_GATT_PERM_READ_ENCRYPT 0x04
+#define BT_GATT_PERM_WRITE_ENCRYPT 0x08
+#define BT_GATT_CCC_NOTIFY 0x0001
+
+typedef void (*bt_gatt_complete_func_t)(struct bt_conn* conn, void* user_data);
+struct bt_gatt_notify_params {
+    const struct bt_uuid* uuid;
+    const struct bt_gatt_attr* attr;
+    const void* data;
+    uint16_t len;
+    bt_gatt_complete_func_t func;
+    void* user_data;
+};
+int bt_gatt_notify_cb(struct bt_conn* conn, struct bt_gatt_notify_params* params);
+uint16_t bt_gatt_get_mtu(struct bt_conn* conn);
+
+struct bt_gatt_cb {
+    void (*att_mtu_updated)(struct bt_conn* conn, uint16_t tx, uint16_t rx);
+};
+void bt_gatt_cb_register(struct bt_gatt_cb* cb);
+
+#endif // _ZEPHYR_STUBS_GATT_H_
@@ -0,0 +1,28 @@
+// Host stand-ins for the parts of the Zephyr kernel API used by ble_midi.c with
+// CONFIG_BLE_MIDI_TX_MODE_SINGLE_MSG. The tests are single threaded. Functions without a
+// body here are defined by the test.
+#ifndef _ZEPHYR_STUBS_KERNEL_H_
+#define _ZEPHYR_STUBS_KERNEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/types.h>
+
+typedef long atomic_t;
+typedef long atomic_val_t;
+#define ATOMIC_INIT(x) (x)
+static inline atomic_val_t atomic_get(const atomic_t* a) { return *a; }
+static inline atomic_val_t atomic_set(atomic_t* a, atomic_val_t v) { atomic_val_t old = *a; *a = v; return old; }
+static inline atomic_val_t atomic_inc(atomic_t* a) { return (*a)++; }
+static inline atomic_val_t atomic_dec(atomic_t* a) { return (*a)--; }
+static inline void atomic_set_bit(atomic_t* a, int bit) { *a |= 1L << bit; }
+static inline void atomic_clear_bit(atomic_t* a, int bit) { *a &= ~(1L << bit); }
+static inline bool atomic_test_bit(const atomic_t* a, int bit) { return (*a >> bit) & 1; }
+
+int64_t k_uptime_get(void);
+int64_t k_uptime_ticks(void);
+uint64_t k_ticks_to_ms_near64(uint64_t ticks);
+
+#endif // _ZEPHYR_STUBS_KERNEL_H_
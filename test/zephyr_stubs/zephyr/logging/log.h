@@ -0,0 +1,13 @@
+#ifndef _ZEPHYR_STUBS_LOG_H_
+#define _ZEPHYR_STUBS_LOG_H_
+
+#include <stdio.h>
+
+// Checks the format and arguments like Zephyr does, without printing anything
+#define LOG_MODULE_REGISTER(...)
+#define LOG_ERR(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#define LOG_WRN(...) LOG_ERR(__VA_ARGS__)
+#define LOG_INF(...) LOG_ERR(__VA_ARGS__)
+#define LOG_DBG(...) LOG_ERR(__VA_ARGS__)
+
+#endif // _ZEPHYR_STUBS_LOG_H_